@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Replay stored history against candidate thresholds.
+
+The replay runs in host/backtest.cpp, built and loaded through firmware.py:
+one pass over the samples evaluates every candidate, with the same rules
+as RuleEngine.evaluate(). This module only lays the thresholds out as a
+flat array, in rules.COLUMNS order, and turns the counters back into dicts.
+"""
+
+from array import array
+
+import firmware
+from rules import ALERTS, COLUMNS
+
+# Ventilation thresholds of the fan node (TVOC_THRESHOLD, eCO2_THRESHOLD and
+# AQI_THRESHOLD in esp32_node_fan.cpp), overridable per candidate
+FAN_DEFAULTS = {"fan_tvoc": 220, "fan_eco2": 800, "fan_aqi": 3}
+
+# A sample counts for at most this many seconds, so gaps are not "above"
+MAX_SAMPLE_SECONDS = 60
+
+_COOLDOWNS = array("d", [cooldown for _, cooldown in ALERTS])
+
+
+def _column(typecode, values):
+    """values as an array of typecode, copied only if they are not one already"""
+    if isinstance(values, array) and values.typecode == typecode:
+        return values
+    return array(typecode, values)
+
+
+def replay(times, tvoc, temperature, humidity, eco2, aqi, candidates):
+    """
+    Replay one room's columns against a list of threshold dicts. Returns one
+    result per candidate: alert counts per type, seconds above each threshold
+    and the fan duty cycle.
+    """
+    n = len(times)
+    if n == 0:
+        return [
+            {"samples": 0, "alerts": {}, "seconds": {}, "fan_duty": 0.0}
+            for _ in candidates
+        ]
+    times = _column("q", times)
+    columns = [_column("d", c) for c in (tvoc, temperature, humidity, eco2, aqi)]
+    bounds = array("d")
+    for candidate in candidates:
+        fan = {**FAN_DEFAULTS, **candidate}
+        bounds.extend(float(candidate[name]) for name in COLUMNS)
+        bounds.extend(float(fan[name]) for name in FAN_DEFAULTS)
+    alerts = array("I", bytes(4 * len(ALERTS) * len(candidates)))
+    seconds = array("q", bytes(8 * len(ALERTS) * len(candidates)))
+    fan_seconds = array("q", bytes(8 * len(candidates)))
+    span = firmware.load("backtest").backtest_replay(
+        times.buffer_info()[0],
+        *(column.buffer_info()[0] for column in columns),
+        n,
+        bounds.buffer_info()[0],
+        len(candidates),
+        _COOLDOWNS.buffer_info()[0],
+        MAX_SAMPLE_SECONDS,
+        alerts.buffer_info()[0],
+        seconds.buffer_info()[0],
+        fan_seconds.buffer_info()[0],
+    )
+
+    results = []
+    for c in range(len(candidates)):
+        row = slice(c * len(ALERTS), (c + 1) * len(ALERTS))
+        keys = [key for key, _ in ALERTS]
+        results.append(
+            {
+                "samples": n,
+                "alerts": dict(zip(keys, alerts[row])),
+                "seconds": dict(zip(keys, seconds[row])),
+                "fan_duty": round(fan_seconds[c] / span, 4) if span else 0.0,
+            }
+        )
+    return results
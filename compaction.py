@@ -0,0 +1,229 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Background compaction of the sensor history.
+
+Every round plans these jobs for each room of the store:
+
+- merge: the block files of a finished day become one day file, so a
+  30-day query maps 30 files instead of hundreds
+- archive: days older than raw_days are rewritten as compressed archive
+  files (tsstore.ArchiveFile), which stay queryable
+- trim: 1 min rollup buckets older than raw_days are dropped, ranges that
+  old are answered by the coarser tiers
+- expire: archive files older than archive_days are deleted (0 = never)
+
+plus whatever the jobs callback adds (the server purges old MariaDB rows).
+
+A job is a generator doing one bounded step of work per next() and
+yielding the bytes that step read or wrote. Steps run one at a time on an
+idle ingest shard (ShardPool.background), so a shard is never taken while
+it has messages queued and never held for more than one step; when no
+shard has been idle for a while, the compactor's own thread runs the step,
+so compaction keeps up under sustained ingest. Between steps the compactor
+sleeps long enough to keep its I/O under the budget.
+Files replaced by a merge or an archive are deleted one round later, once
+scans that started on them have finished, and the tombstone listing them
+after that.
+"""
+
+import logging
+import os
+import threading
+import time
+
+from tsstore import (
+    BLOCK_SAMPLES,
+    ROLLUP_TIERS,
+    ROW,
+    ArchiveFile,
+    ArchiveWriter,
+    BlockFile,
+    REPLACES_SUFFIX,
+)
+
+logger = logging.getLogger(__name__)
+
+DAY = 86400
+INTERVAL = 300  # Seconds between rounds
+
+
+def day_start(t):
+    """Local midnight before t"""
+    local = time.localtime(t)
+    return t - local.tm_hour * 3600 - local.tm_min * 60 - local.tm_sec
+
+
+def read_rows(block):
+    """All rows of a block file, and the bytes read"""
+    data = b"".join(block.scan(block.t_min, block.t_max))
+    return list(ROW.iter_unpack(data)), block.size
+
+
+class Compactor:
+    """Merges, archives and expires history files in paced background steps"""
+
+    def __init__(
+        self,
+        store,
+        submit,
+        bytes_per_second,
+        raw_days,
+        archive_days,
+        jobs=None,
+        interval=INTERVAL,
+    ):
+        self.name = "compaction"
+        self.store = store
+        self.submit = submit  # Runs a step on some worker thread, returns when done
+        self.rate = bytes_per_second
+        self.raw_seconds = raw_days * DAY
+        self.archive_seconds = archive_days * DAY
+        self.jobs = jobs  # jobs(now) -> more job generators for each round
+        self.interval = interval
+        self.retired = []  # Paths replaced this round, deleted in the next
+        self.rounds = 0
+        self.steps = 0
+        self.bytes = 0
+        self.merged = 0
+        self.archived = 0
+        self.expired = 0
+        self.longest_step = 0.0
+        self.thread = threading.Thread(target=self._run, name="compaction", daemon=True)
+
+    def start(self):
+        self.thread.start()
+
+    def stats(self):
+        return {
+            "rounds": self.rounds,
+            "steps": self.steps,
+            "io_mb": round(self.bytes / (1 << 20), 1),
+            "merged_days": self.merged,
+            "archived_days": self.archived,
+            "expired_files": self.expired,
+            "longest_step_ms": round(self.longest_step * 1000, 1),
+        }
+
+    def _run(self):
+        while True:
+            time.sleep(self.interval)
+            try:
+                self.run_once()
+            except Exception as e:
+                logger.error(f"Compaction error: {e}")
+
+    def run_once(self, now=None):
+        """One round: delete what the last round replaced, then run every job"""
+        for path in self.retired:
+            try:
+                os.remove(path)
+            except FileNotFoundError:
+                pass
+        self.retired = []
+        for job in self.plan(time.time() if now is None else now):
+            self._drive(job)
+        self.rounds += 1
+
+    def plan(self, now):
+        today = day_start(now)
+        cold = now - self.raw_seconds
+        for room in list(self.store.rooms):
+            files = self.store.files(room)
+            days = {}
+            for block in files:
+                if isinstance(block, BlockFile) and block.t_max < today:
+                    days.setdefault(day_start(block.t_min), []).append(block)
+            for day, blocks in sorted(days.items()):
+                if max(block.t_max for block in blocks) < cold:
+                    yield self._archive(room, blocks)
+                elif len(blocks) > 1:
+                    yield self._merge(room, blocks)
+            if self.archive_seconds:
+                expired = [
+                    block
+                    for block in files
+                    if isinstance(block, ArchiveFile)
+                    and block.t_max < now - self.archive_seconds
+                ]
+                if expired:
+                    yield self._expire(room, expired)
+            # Cut at midnight so the tier file is rewritten once a day
+            yield self._trim(room, day_start(cold))
+        if self.jobs:
+            yield from self.jobs(now)
+
+    def _drive(self, job):
+        """Run a job step by step through submit(), pacing steps to the budget"""
+        while True:
+            cost = []
+
+            def step():
+                started = time.perf_counter()
+                try:
+                    cost.append(next(job))
+                except StopIteration:
+                    pass
+                except Exception as e:
+                    logger.error(f"Compaction step error: {e}")
+                finally:
+                    elapsed = time.perf_counter() - started
+                    self.longest_step = max(self.longest_step, elapsed)
+
+            self.submit(step)
+            if not cost:
+                return
+            self.steps += 1
+            self.bytes += cost[0]
+            time.sleep(cost[0] / self.rate)
+
+    def _merge(self, room, blocks):
+        rows = []
+        for block in blocks:
+            block_rows, size = read_rows(block)
+            rows.extend(block_rows)
+            yield size
+        rows.sort(key=lambda row: row[0])
+        merged = BlockFile.write(
+            os.path.dirname(blocks[0].path),
+            rows,
+            max(block.lsn for block in blocks),
+            [block.path for block in blocks],
+        )
+        self.store.replace_files(room, blocks, [merged])
+        self.retired.extend(block.path for block in blocks)
+        self.retired.append(merged.path + REPLACES_SUFFIX)
+        self.merged += 1
+        yield merged.size
+
+    def _archive(self, room, blocks):
+        rows = []
+        for block in blocks:
+            block_rows, size = read_rows(block)
+            rows.extend(block_rows)
+            yield size
+        rows.sort(key=lambda row: row[0])
+        writer = ArchiveWriter(
+            os.path.dirname(blocks[0].path), max(block.lsn for block in blocks)
+        )
+        try:
+            # One group per step
+            for i in range(0, len(rows), BLOCK_SAMPLES):
+                yield writer.add(rows[i : i + BLOCK_SAMPLES])
+            archive = writer.close([block.path for block in blocks])
+        except BaseException:
+            writer.abort()
+            raise
+        self.store.replace_files(room, blocks, [archive])
+        self.retired.extend(block.path for block in blocks)
+        self.retired.append(archive.path + REPLACES_SUFFIX)
+        self.archived += 1
+
+    def _expire(self, room, archives):
+        self.store.replace_files(room, archives, [])
+        self.retired.extend(archive.path for archive in archives)
+        self.expired += len(archives)
+        yield 0
+
+    def _trim(self, room, before):
+        yield self.store.trim_rollup(room, ROLLUP_TIERS[0], before)
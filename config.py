@@ -15,13 +15,66 @@ DB_PORT = int(os.getenv("DB_PORT", 3306))
 DB_NAME = os.getenv("DB_NAME")
 DB_USER = os.getenv("DB_USER")
 DB_PASSWORD = os.getenv("DB_PASSWORD")
+# Ghi theo lô: tối đa DB_BATCH_SIZE mẫu hoặc DB_BATCH_DELAY_MS cho mỗi commit
+DB_BATCH_SIZE = int(os.getenv("DB_BATCH_SIZE", 200))
+DB_BATCH_DELAY_MS = int(os.getenv("DB_BATCH_DELAY_MS", 1000))
+# "batch" = group commit, "sync" = commit từng mẫu
+DB_DURABILITY = os.getenv("DB_DURABILITY", "batch")
+# Write-ahead log: mẫu được ghi vào đây trước, rồi mới ghi vào database
+WAL_DIR = os.getenv("WAL_DIR", "wal")
+# Kích thước mỗi file segment (MB), cấp phát trước khi tạo
+WAL_SEGMENT_MB = int(os.getenv("WAL_SEGMENT_MB", 64))
+# Chu kỳ fdatasync (ms): mất điện chỉ mất tối đa chừng này dữ liệu
+WAL_SYNC_MS = int(os.getenv("WAL_SYNC_MS", 50))
+# Dung lượng tối đa của log (MB), 0 = không giới hạn. Khi database ngừng quá
+# lâu, segment cũ nhất bị xoá dù chưa ghi vào database và có cảnh báo Telegram
+WAL_MAX_MB = int(os.getenv("WAL_MAX_MB", 4096))
+
+# Số luồng xử lý bản tin, chia theo phòng (mỗi phòng luôn do một luồng xử lý)
+INGEST_SHARDS = int(os.getenv("INGEST_SHARDS", 4))
+
+# Lưu trữ lịch sử (tsstore): file block bố cục cố định, đọc qua mmap
+HISTORY_DIR = os.getenv("HISTORY_DIR", "history")
+# Số mẫu gần nhất giữ trong RAM cho mỗi phòng (6 giờ ở chu kỳ 5 giây)
+HOT_WINDOW_SAMPLES = int(os.getenv("HOT_WINDOW_SAMPLES", 4320))
+
+# Nén và dọn dẹp lịch sử chạy nền (compaction.py)
+# Dữ liệu thô mới hơn số ngày này giữ dạng block, cũ hơn thì nén vào file archive
+HISTORY_RAW_DAYS = int(os.getenv("HISTORY_RAW_DAYS", 30))
+# Xoá file archive cũ hơn số ngày này, 0 = giữ mãi
+HISTORY_ARCHIVE_DAYS = int(os.getenv("HISTORY_ARCHIVE_DAYS", 0))
+# Xoá dữ liệu cảm biến trong MariaDB cũ hơn số ngày này, 0 = giữ mãi (mặc định).
+# Chỉ xoá các khoảng đã nằm trong file archive của lịch sử (HISTORY_RAW_DAYS nhỏ
+# hơn), lịch sử cảnh báo không bị xoá
+DB_RETENTION_DAYS = int(os.getenv("DB_RETENTION_DAYS", 0))
+# Giới hạn băng thông đọc/ghi (KB/s) của compaction để không ảnh hưởng ingest
+COMPACTION_KB_S = int(os.getenv("COMPACTION_KB_S", 1024))
+# Khoảng lịch sử tối đa (giờ) một lần /api/backtest được đọc vào RAM, mặc định
+# 1 năm (khoảng 300 MB cho một phòng ở chu kỳ 5 giây)
+BACKTEST_MAX_HOURS = int(os.getenv("BACKTEST_MAX_HOURS", 8760))
 
 # MQTT
 MQTT_BROKER = os.getenv("MQTT_BROKER")
 MQTT_PORT = int(os.getenv("MQTT_PORT", 1883))
+# Cây topic: <MQTT_TOPIC_ROOT>/<MQTT_SITE>/<phòng>/<DEVICE_ID>
+MQTT_TOPIC_ROOT = os.getenv("MQTT_TOPIC_ROOT", "sensors")
+MQTT_SITE = os.getenv("MQTT_SITE", "home")
+# Phòng có sẵn khi khởi động; phòng mới tự đăng ký khi node đầu tiên gửi dữ liệu
+ROOMS = [r for r in os.getenv("ROOMS", "bedroom,workingroom").split(",") if r]
+# Mẫu tên (glob) của phòng được tự đăng ký từ topic, để trống = chỉ phòng trong ROOMS
+ROOMS_AUTO = [p for p in os.getenv("ROOMS_AUTO", "*").split(",") if p]
+# Giới hạn số phòng và số thiết bị mỗi phòng được tự đăng ký
+MAX_ROOMS = int(os.getenv("MAX_ROOMS", 64))
+MAX_DEVICES_PER_ROOM = int(os.getenv("MAX_DEVICES_PER_ROOM", 64))
+# Topic cũ (một topic cho mỗi phòng) của node chưa cập nhật firmware, để trống = bỏ qua
 MQTT_TOPIC_BEDROOM = os.getenv("MQTT_TOPIC_BEDROOM")
 MQTT_TOPIC_WORKINGROOM = os.getenv("MQTT_TOPIC_WORKINGROOM")
+# Chu kỳ slot gửi dữ liệu cấp cho các room node (ms), 0 = tắt
+MQTT_SLOT_PERIOD_MS = int(os.getenv("MQTT_SLOT_PERIOD_MS", 0))
 
 # Telegram
 TELEGRAM_BOT_TOKEN = os.getenv("TELEGRAM_BOT_TOKEN")
 TELEGRAM_CHAT_ID = os.getenv("TELEGRAM_CHAT_ID")
+# Có thể trỏ tới một HTTP server giả lập khi kiểm thử
+TELEGRAM_API_URL = os.getenv("TELEGRAM_API_URL", "https://api.telegram.org")
+TELEGRAM_RATE_PER_MIN = int(os.getenv("TELEGRAM_RATE_PER_MIN", 20))
@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Visual-fidelity downsampling for chart endpoints.
+
+lttb() implements Largest-Triangle-Three-Buckets, minmax() keeps the lowest
+and highest point of every bucket. Both return indices into the input so a
+multi-metric row set can be reduced to the union of the points each metric
+needs while every metric keeps a shared x axis.
+"""
+
+
+def lttb(xs, ys, threshold):
+    """Indices of the points kept by Largest-Triangle-Three-Buckets"""
+    n = len(ys)
+    if threshold >= n:
+        return list(range(n))
+    if threshold < 3:
+        return [0, n - 1][:threshold]
+
+    every = (n - 2) / (threshold - 2)
+    selected = [0]
+    a = 0
+    for i in range(threshold - 2):
+        # Average of the next bucket is the third triangle vertex
+        next_start = int((i + 1) * every) + 1
+        next_end = min(int((i + 2) * every) + 1, n)
+        count = next_end - next_start
+        avg_x = sum(xs[next_start:next_end]) / count
+        avg_y = sum(ys[next_start:next_end]) / count
+
+        start = int(i * every) + 1
+        end = int((i + 1) * every) + 1
+        ax, ay = xs[a], ys[a]
+        best, best_area = start, -1.0
+        for j in range(start, end):
+            area = abs((ax - avg_x) * (ys[j] - ay) - (ax - xs[j]) * (avg_y - ay))
+            if area > best_area:
+                best, best_area = j, area
+        selected.append(best)
+        a = best
+    selected.append(n - 1)
+    return selected
+
+
+def minmax(ys, threshold):
+    """Indices of the min and max point of threshold / 2 equal buckets"""
+    n = len(ys)
+    buckets = threshold // 2
+    if threshold >= n or buckets < 1:
+        return list(range(n))
+    selected = []
+    for b in range(buckets):
+        start = b * n // buckets
+        end = (b + 1) * n // buckets
+        lo = min(range(start, end), key=ys.__getitem__)
+        hi = max(range(start, end), key=ys.__getitem__)
+        selected.extend(sorted({lo, hi}))
+    return selected
+
+
+def decimate_rows(rows, threshold, columns, x=0, mode="lttb"):
+    """
+    Reduce rows (tuples) to about threshold rows. Each of the value columns
+    gets an equal share of the budget and the union of their picks is kept.
+    """
+    if len(rows) <= threshold:
+        return rows
+    share = max(threshold // len(columns), 3)
+    xs = [row[x] for row in rows]
+    keep = set()
+    for column in columns:
+        ys = [row[column] for row in rows]
+        keep.update(lttb(xs, ys, share) if mode == "lttb" else minmax(ys, share))
+    return [rows[i] for i in sorted(keep)]
@@ -1,12 +1,35 @@
 #include <WiFi.h>
 #include <PubSubClient.h>
-#include <ArduinoJson.h>
+#include <Preferences.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include "fan_bank.h"
+#include "fan_control.h"
 
 #define FAN_PIN 13
 
-#define TVOC_THRESHOLD 220
-#define eCO2_THRESHOLD 800
-#define AQI_THRESHOLD 3
+// Room node điều khiển quạt này: sensors/<SITE_ID>/<ROOM_ID>/<ROOM_DEVICE_ID>
+#define SITE_ID "home"
+#define ROOM_ID "bedroom"
+// #define ROOM_ID "workingroom"
+#define ROOM_DEVICE_ID 1
+
+#define STR_(x) #x
+#define STR(x) STR_(x)
+#define TOPIC_BASE "sensors/" SITE_ID "/" ROOM_ID "/" STR(ROOM_DEVICE_ID)
+
+// =============== Fan Bank Configuration ===============
+// FAN_COUNT, stagger and rotation timing live in fan_bank.h
+const uint8_t fanPins[FAN_COUNT] = {FAN_PIN, 12, 14, 27};
+
+#define FAN_RUNTIME_SAVE_MS 900000UL     // Checkpoint runtime to NVS every 15 minutes
+
+// =============== State Persistence ===============
+#define STATE_MAGIC 0x46414E32           // "FAN2"
+#define STATE_MAX_AGE_S 600              // Resume only decisions younger than 10 minutes
+#define STATE_COLD_HOLD_S 120            // Hold time when the state age is unknown
+#define STATE_NVS_MIN_WRITE_MS 60000UL   // At most one NVS write per minute
+#define STATE_NVS_READING_MS 600000UL    // Refresh stored readings every 10 minutes
 
 // =============== WiFi Configuration ===============
 const char *ssid = "SSIoT-02";
@@ -22,12 +45,243 @@ const char *password = "SSIoT-02";
 const char *mqtt_server = "192.168.72.156";
 // const char *mqtt_server = "broker.emqx.io";
 const int mqtt_port = 1883;
-const char *mqtt_topic = "sensors/bedroom";
-// const char *mqtt_topic = "sensors/workingroom";
+const char *mqtt_topic = TOPIC_BASE;
+const char *mqtt_snapshot_topic = TOPIC_BASE "/snapshot";
+
+// Decorrelated jitter backoff between MQTT connection attempts
+#define RECONNECT_BASE_MS 1000
+#define RECONNECT_CAP_MS 30000
 
 WiFiClient espClient;
 PubSubClient client(espClient);
 
+// ===== Fan bank =====
+// Lập lịch trong fan_bank.h, ở đây chỉ điều khiển relay và lưu giờ chạy vào NVS
+FanBank fanBank;
+uint32_t fanSavedS[FAN_COUNT]; // Last runtime written to NVS
+unsigned long fanLastSave;
+Preferences prefs;
+
+void fanOutput(uint8_t idx, bool on)
+{
+  digitalWrite(fanPins[idx], on ? HIGH : LOW);
+  Serial.printf("Fan %d %s (%d/%d)\n", idx, on ? "ON" : "OFF",
+                fanActiveCount(fanBank), fanBank.target);
+}
+
+void fanBankSave(unsigned long now)
+{
+  fanLastSave = now;
+  bool dirty = false;
+  for (uint8_t i = 0; i < FAN_COUNT; i++)
+  {
+    fanFoldRuntime(fanBank, i, now);
+    dirty |= fanBank.runtimeS[i] != fanSavedS[i];
+  }
+  if (!dirty)
+  {
+    return; // Không ghi NVS khi không có gì thay đổi
+  }
+  prefs.putBytes("runtime", fanBank.runtimeS, sizeof(fanBank.runtimeS));
+  memcpy(fanSavedS, fanBank.runtimeS, sizeof(fanSavedS));
+}
+
+void fanBankBegin()
+{
+  for (uint8_t i = 0; i < FAN_COUNT; i++)
+  {
+    pinMode(fanPins[i], OUTPUT);
+    digitalWrite(fanPins[i], LOW);
+  }
+
+  unsigned long now = millis();
+  fanBankInit(fanBank, now);
+  prefs.begin("fanbank", false);
+  if (prefs.getBytesLength("runtime") == sizeof(fanBank.runtimeS))
+  {
+    prefs.getBytes("runtime", fanBank.runtimeS, sizeof(fanBank.runtimeS));
+  }
+  memcpy(fanSavedS, fanBank.runtimeS, sizeof(fanSavedS));
+  fanLastSave = now;
+}
+
+void fanBankSetTarget(uint8_t count)
+{
+  fanBankSetTarget(fanBank, count);
+}
+
+void fanBankUpdate(unsigned long now)
+{
+  fanBankStep(fanBank, now, fanOutput);
+  if (now - fanLastSave >= FAN_RUNTIME_SAVE_MS)
+  {
+    fanBankSave(now);
+  }
+}
+
+// ===== Lưu trạng thái =====
+// Quyết định và số đo cuối được ghi vào RTC memory mỗi lần nhận dữ liệu
+// (còn sau reset mềm/watchdog) và vào NVS có giới hạn tần suất ghi.
+struct FanState
+{
+  uint32_t magic;
+  uint32_t savedAt; // time(nullptr) at the reading, seconds
+  uint16_t tvoc;
+  uint16_t eco2;
+  int16_t tempCenti; // 0.01 °C
+  int16_t humCenti;  // 0.01 %RH
+  uint8_t level;
+  uint8_t aqi;
+  uint16_t reserved;
+  uint32_t checksum;
+};
+
+RTC_NOINIT_ATTR FanState rtcState;
+FanState liveState;
+FanState nvsState;
+bool stateDirty = false;
+unsigned long lastStateWrite = 0;
+
+bool resumeActive = false;
+unsigned long resumeUntil = 0;
+int64_t firstActuationUs = -1;
+
+int64_t mqttConnectedUs = 0;
+bool decidedSinceConnect = false;
+bool snapshotSubscribed = false;
+
+uint32_t stateChecksum(const FanState &st)
+{
+  // FNV-1a over everything before the checksum field
+  const uint8_t *p = (const uint8_t *)&st;
+  uint32_t h = 2166136261UL;
+  for (size_t i = 0; i < offsetof(FanState, checksum); i++)
+  {
+    h = (h ^ p[i]) * 16777619UL;
+  }
+  return h;
+}
+
+bool stateValid(const FanState &st)
+{
+  return st.magic == STATE_MAGIC && st.checksum == stateChecksum(st);
+}
+
+// Ghi nhận thời điểm actuation đầu tiên kể từ lúc boot
+void markFirstActuation(const char *source)
+{
+  if (firstActuationUs >= 0)
+  {
+    return;
+  }
+  firstActuationUs = esp_timer_get_time();
+  Serial.printf("[Boot] First actuation after %lld ms (%s)\n", firstActuationUs / 1000, source);
+}
+
+void stateRecord(uint8_t level, int tvoc, int eco2, int aqi, int tempCenti, int humCenti)
+{
+  FanState st;
+  memset(&st, 0, sizeof(st));
+  st.magic = STATE_MAGIC;
+  st.savedAt = (uint32_t)time(nullptr);
+  st.tempCenti = tempCenti;
+  st.humCenti = humCenti;
+  st.tvoc = tvoc < 0 ? 0 : tvoc;
+  st.eco2 = eco2 < 0 ? 0 : eco2;
+  st.level = level;
+  st.aqi = aqi < 0 ? 0 : aqi;
+  st.checksum = stateChecksum(st);
+
+  liveState = st;
+  rtcState = st;
+
+  // NVS: decision changes are written as soon as the rate limit allows,
+  // unchanged decisions only refresh the readings occasionally.
+  if (!stateValid(nvsState) || nvsState.level != level ||
+      millis() - lastStateWrite >= STATE_NVS_READING_MS)
+  {
+    stateDirty = true;
+  }
+}
+
+void stateFlush(unsigned long now)
+{
+  if (!stateDirty || now - lastStateWrite < STATE_NVS_MIN_WRITE_MS)
+  {
+    return;
+  }
+  prefs.putBytes("state", &liveState, sizeof(liveState));
+  nvsState = liveState;
+  stateDirty = false;
+  lastStateWrite = now;
+}
+
+// Khôi phục quyết định cuối ngay khi boot, trước khi có WiFi/MQTT
+void stateResume()
+{
+  memset(&nvsState, 0, sizeof(nvsState));
+  if (prefs.getBytesLength("state") == sizeof(nvsState))
+  {
+    prefs.getBytes("state", &nvsState, sizeof(nvsState));
+  }
+
+  const FanState *st = nullptr;
+  const char *source = nullptr;
+  if (stateValid(rtcState))
+  {
+    st = &rtcState;
+    source = "rtc";
+  }
+  else if (stateValid(nvsState))
+  {
+    st = &nvsState;
+    source = "nvs";
+  }
+  if (st == nullptr)
+  {
+    Serial.println("[State] No saved state");
+    return;
+  }
+  liveState = *st;
+
+  // time() keeps counting across software/watchdog resets only
+  esp_reset_reason_t reason = esp_reset_reason();
+  bool clockKept = reason == ESP_RST_SW || reason == ESP_RST_PANIC ||
+                   reason == ESP_RST_INT_WDT || reason == ESP_RST_TASK_WDT ||
+                   reason == ESP_RST_WDT || reason == ESP_RST_DEEPSLEEP;
+  uint32_t now = (uint32_t)time(nullptr);
+  uint32_t holdS = STATE_COLD_HOLD_S;
+  if (clockKept && now >= st->savedAt)
+  {
+    uint32_t age = now - st->savedAt;
+    if (age > STATE_MAX_AGE_S)
+    {
+      Serial.printf("[State] Saved state too old (%u s), not resuming\n", age);
+      return;
+    }
+    holdS = STATE_MAX_AGE_S - age;
+  }
+
+  fanBankSetTarget(fansForLevel(st->level));
+  fanBankUpdate(millis());
+  resumeActive = true;
+  resumeUntil = millis() + holdS * 1000UL;
+  markFirstActuation(source);
+  Serial.printf("[State] Resumed level %d from %s (reset reason %d), hold %u s\n",
+                st->level, source, reason, holdS);
+}
+
+// Quạt vẫn phải chạy theo lịch stagger trong lúc chờ WiFi/MQTT
+void waitServicingFans(unsigned long ms)
+{
+  unsigned long start = millis();
+  while (millis() - start < ms)
+  {
+    fanBankUpdate(millis());
+    delay(50);
+  }
+}
+
 // ===== Kết nối WiFi =====
 void setup_wifi()
 {
@@ -76,7 +330,7 @@ void setup_wifi()
       Serial.println(WiFi.status());
       break;
     }
-    delay(tryDelay);
+    waitServicingFans(tryDelay);
 
     if (numberOfTries <= 0)
     {
@@ -95,57 +349,109 @@ void setup_wifi()
   Serial.println("IP Address: " + WiFi.localIP());
 }
 
-// ===== Callback khi nhận MQTT =====
-void mqtt_callback(char *topic, byte *payload, unsigned int length)
+// ===== Áp dụng một bản ghi số đo =====
+// Ngưỡng, parse và mức thông gió nằm trong fan_control.h
+void applyReading(const Reading &r, const char *source)
 {
-  // Chuyển payload thành String
-  String jsonStr;
-  jsonStr.reserve(length + 1);
-  for (unsigned int i = 0; i < length; i++)
+  uint8_t level = ventilationLevel(r.tvoc, r.eco2, r.aqi);
+  fanBankSetTarget(fansForLevel(level));
+  resumeActive = false;
+  markFirstActuation(source);
+  stateRecord(level, r.tvoc, r.eco2, r.aqi, r.tempCenti, r.humCenti);
+
+  if (!decidedSinceConnect)
   {
-    jsonStr += (char)payload[i];
+    decidedSinceConnect = true;
+    Serial.printf("[MQTT] First decision %lld ms after connect (%s)\n",
+                  (esp_timer_get_time() - mqttConnectedUs) / 1000, source);
   }
-
-  Serial.println("Received JSON: " + jsonStr);
-
-  // Parse JSON
-  StaticJsonDocument<256> doc; // đủ cho dữ liệu mẫu
-  DeserializationError error = deserializeJson(doc, jsonStr);
-  if (error)
+  // Snapshot chỉ cần cho quyết định đầu tiên, sau đó dùng luồng dữ liệu
+  if (snapshotSubscribed)
   {
-    Serial.print("deserializeJson() failed: ");
-    Serial.println(error.c_str());
-    return;
+    client.unsubscribe(mqtt_snapshot_topic);
+    snapshotSubscribed = false;
   }
 
-  // Trích xuất dữ liệu
-  int tvoc = doc["tvoc"] | -1.0;
-  float temperature = doc["temperature"] | -1.0;
-  float humidity = doc["humidity"] | -1.0;
-  int eco2 = doc["eco2"] | -1;
-  int aqi = doc["aqi"] | -1;
-
-  if ((tvoc >= TVOC_THRESHOLD) || (eco2 >= eCO2_THRESHOLD) || (aqi >= AQI_THRESHOLD))
+  if (level > 0)
   {
-    digitalWrite(FAN_PIN, HIGH);
-    Serial.println("Fan ON: High TVOC, eCO2 or AQI detected!");
+    Serial.printf("Fan level %d: High TVOC, eCO2 or AQI detected!\n", level);
   }
   else
   {
-    digitalWrite(FAN_PIN, LOW);
     Serial.println("Fan OFF: Values are within normal range.");
   }
   // In ra kết quả
   Serial.println("===== Parsed Data =====");
-  Serial.printf("TVOC        : %d ppb\n", tvoc);
-  Serial.printf("Temperature : %.2f °C\n", temperature);
-  Serial.printf("Humidity    : %.2f %%\n", humidity);
-  Serial.printf("eCO2        : %d ppm\n", eco2);
-  Serial.printf("AQI         : %d\n", aqi);
+  Serial.printf("TVOC        : %d ppb\n", r.tvoc);
+  char num[12];
+  Serial.printf("Temperature : %s °C\n", formatCenti(num, sizeof(num), r.tempCenti));
+  Serial.printf("Humidity    : %s %%\n", formatCenti(num, sizeof(num), r.humCenti));
+  Serial.printf("eCO2        : %d ppm\n", r.eco2);
+  Serial.printf("AQI         : %d\n", r.aqi);
   Serial.println("=======================");
 }
 
+// Snapshot retained: "tvoc,eco2,aqi,temperature,humidity"
+void handleSnapshot(byte *payload, unsigned int length)
+{
+  if (length == 0 || length >= 64)
+  {
+    return; // Payload rỗng: room node đã mất kết nối và snapshot bị xoá
+  }
+  char buf[64];
+  memcpy(buf, payload, length);
+  buf[length] = '\0';
+
+  Reading r;
+  if (!parseSnapshot(buf, r))
+  {
+    Serial.print("Invalid snapshot: ");
+    Serial.println(buf);
+    return;
+  }
+  Serial.print("Received snapshot: ");
+  Serial.println(buf);
+  applyReading(r, "snapshot");
+}
+
+// ===== Callback khi nhận MQTT =====
+void mqtt_callback(char *topic, byte *payload, unsigned int length)
+{
+  if (strcmp(topic, mqtt_snapshot_topic) == 0)
+  {
+    if (snapshotSubscribed)
+    {
+      handleSnapshot(payload, length);
+    }
+    return;
+  }
+
+  char json[256];
+  if (length >= sizeof(json))
+  {
+    Serial.println("Payload too long, ignored");
+    return;
+  }
+  memcpy(json, payload, length);
+  json[length] = '\0';
+
+  Serial.print("Received JSON: ");
+  Serial.println(json);
+
+  // Trích xuất dữ liệu (fixed-point x100, không parse float). Payload cắt cụt
+  // hoặc hỏng bị bỏ, không tắt quạt hay ghi đè trạng thái đã lưu
+  Reading r;
+  if (!parseReadingJson(json, r))
+  {
+    Serial.println("Invalid reading, ignored");
+    return;
+  }
+  applyReading(r, "stream");
+}
+
 // ===== Reconnect MQTT =====
+unsigned long reconnectDelay = RECONNECT_BASE_MS;
+
 void mqtt_reconnect()
 {
   while (!client.connected())
@@ -155,23 +461,34 @@ void mqtt_reconnect()
     if (client.connect(clientId.c_str()))
     {
       Serial.println("connected");
+      mqttConnectedUs = esp_timer_get_time();
+      decidedSinceConnect = false;
       client.subscribe(mqtt_topic);
+      // Broker gửi ngay snapshot retained, không phải chờ mẫu 5 s tiếp theo
+      snapshotSubscribed = client.subscribe(mqtt_snapshot_topic);
+      reconnectDelay = RECONNECT_BASE_MS;
     }
     else
     {
+      // sleep = min(cap, random(base, sleep * 3))
+      reconnectDelay = random(RECONNECT_BASE_MS, reconnectDelay * 3);
+      if (reconnectDelay > RECONNECT_CAP_MS)
+      {
+        reconnectDelay = RECONNECT_CAP_MS;
+      }
       Serial.print("failed, rc=");
       Serial.print(client.state());
-      Serial.println(" try again in 2 seconds");
-      delay(2000);
+      Serial.printf(" try again in %lu ms\n", reconnectDelay);
+      waitServicingFans(reconnectDelay);
     }
   }
 }
 
 void setup()
 {
-  pinMode(FAN_PIN, OUTPUT);
-  digitalWrite(FAN_PIN, LOW);
+  fanBankBegin();
   Serial.begin(115200);
+  stateResume();
   setup_wifi();
 
   client.setServer(mqtt_server, mqtt_port);
@@ -188,4 +505,15 @@ void loop()
     mqtt_reconnect();
   }
   client.loop(); // Quan trọng: xử lý nhận liên tục
+
+  unsigned long now = millis();
+  if (resumeActive && (long)(now - resumeUntil) >= 0)
+  {
+    // Không có dữ liệu mới trong thời gian giữ: quay về trạng thái an toàn
+    resumeActive = false;
+    fanBankSetTarget(0);
+    Serial.println("[State] Resume hold expired without fresh data, fans OFF");
+  }
+  fanBankUpdate(now);
+  stateFlush(now);
 }
@@ -2,11 +2,21 @@
 #include <Wire.h>
 #include <WiFi.h>
 #include <PubSubClient.h>
-#include "DFRobot_ENS160.h"
-#include <Adafruit_AHTX0.h>
 
+// Topic sensors/<SITE_ID>/<ROOM_ID>/<DEVICE_ID>, DEVICE_ID phải khác nhau trong cùng một phòng
+#define SITE_ID "home"
+#define ROOM_ID "bedroom"
+// #define ROOM_ID "workingroom"
 #define DEVICE_ID 1
 
+#define STR_(x) #x
+#define STR(x) STR_(x)
+#define TOPIC_BASE "sensors/" SITE_ID "/" ROOM_ID "/" STR(DEVICE_ID)
+
+// Sau DEVICE_ID: formatPayload() ghép nó vào payload lúc biên dịch
+#include "room_payload.h"
+#include "room_sensors.h"
+
 #define SCL_PIN 22
 #define SDA_PIN 21
 
@@ -35,15 +45,53 @@ const char *password = "SSIoT-02";
 const char *mqtt_server = "192.168.72.156";
 // const char *mqtt_server = "broker.emqx.io";
 const int mqtt_port = 1883;
-const char *mqtt_topic = "sensors/bedroom";
-// const char *mqtt_topic = "sensors/workingroom";
+const char *mqtt_topic = TOPIC_BASE;
+// Retained "tvoc,eco2,aqi,temperature,humidity" for late subscribers,
+// cleared by the last will when this node drops off
+const char *mqtt_snapshot_topic = TOPIC_BASE "/snapshot";
+// Optional "offset_ms,period_ms" slot assignment sent by the server
+const char *mqtt_slot_topic = TOPIC_BASE "/slot";
+
+// Decorrelated jitter backoff between MQTT connection attempts
+#define RECONNECT_BASE_MS 1000
+#define RECONNECT_CAP_MS 60000
 
 WiFiClient espClient;
 PubSubClient mqttClient(espClient);
 
 // =============== Sensor Initialization ===============
-DFRobot_ENS160_I2C ens160(&Wire, 0x53); // Default I2C address 0x53
-Adafruit_AHTX0 aht;
+// AHT21 (0x38) và ENS160 (0x53) được đọc ở mức thanh ghi trong room_sensors.h
+class WireBus : public I2cBus
+{
+public:
+  bool write(uint8_t addr, const uint8_t *data, size_t len) override
+  {
+    Wire.beginTransmission(addr);
+    Wire.write(data, len);
+    return Wire.endTransmission() == 0;
+  }
+
+  bool read(uint8_t addr, uint8_t *data, size_t len) override
+  {
+    if (Wire.requestFrom(addr, (uint8_t)len) != len)
+    {
+      return false;
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+      data[i] = Wire.read();
+    }
+    return true;
+  }
+
+  void delayMs(uint32_t ms) override { delay(ms); }
+  uint32_t micros() override { return ::micros(); }
+};
+
+WireBus wireBus;
+RoomSensors sensors;
+
+#define SENSOR_RETRY_MS 3000
 
 void setup_wifi()
 {
@@ -111,6 +159,51 @@ void setup_wifi()
   Serial.println("IP Address: " + WiFi.localIP());
 }
 
+unsigned long publishInterval = 5000; // 5 seconds
+unsigned long nextPublishMillis = 0;
+unsigned long reconnectDelay = RECONNECT_BASE_MS;
+
+// Pha gửi cố định theo MAC để các node khởi động cùng lúc không gửi đồng loạt
+unsigned long macPhase(unsigned long period)
+{
+  uint64_t mac = ESP.getEfuseMac();
+  uint32_t h = 2166136261UL; // FNV-1a over the 6 MAC bytes
+  for (int i = 0; i < 6; i++)
+  {
+    h = (h ^ (uint8_t)(mac >> (8 * i))) * 16777619UL;
+  }
+  return h % period;
+}
+
+// Slot do server cấp: "offset_ms,period_ms". Server gửi cho mọi node cùng
+// lúc nên thời điểm nhận là mốc chung cho cả hệ thống.
+void mqtt_callback(char *topic, byte *payload, unsigned int length)
+{
+  char buf[32];
+  if (strcmp(topic, mqtt_slot_topic) != 0 || length >= sizeof(buf))
+  {
+    return;
+  }
+  memcpy(buf, payload, length);
+  buf[length] = '\0';
+
+  char *end;
+  unsigned long offset = strtoul(buf, &end, 10);
+  if (*end != ',')
+  {
+    return;
+  }
+  unsigned long period = strtoul(end + 1, &end, 10);
+  if (*end != '\0' || period < 1000 || offset >= period)
+  {
+    Serial.println("Invalid slot assignment: " + String(buf));
+    return;
+  }
+  publishInterval = period;
+  nextPublishMillis = millis() + offset;
+  Serial.println("Slot assigned: " + String(buf));
+}
+
 void reconnect()
 {
   while (!mqttClient.connected())
@@ -119,20 +212,40 @@ void reconnect()
     String mqttClientId = "ESP32Client-";
     mqttClientId += String(random(0xffff), HEX);
 
-    if (mqttClient.connect(mqttClientId.c_str()))
+    if (mqttClient.connect(mqttClientId.c_str(), mqtt_snapshot_topic, 0, true, ""))
     {
       Serial.println("Success!");
+      reconnectDelay = RECONNECT_BASE_MS;
+      mqttClient.subscribe(mqtt_slot_topic);
     }
     else
     {
+      // sleep = min(cap, random(base, sleep * 3)): cả đàn node không thử lại đồng loạt
+      reconnectDelay = random(RECONNECT_BASE_MS, reconnectDelay * 3);
+      if (reconnectDelay > RECONNECT_CAP_MS)
+      {
+        reconnectDelay = RECONNECT_CAP_MS;
+      }
       Serial.print("\nFailed, rc=");
       Serial.print(mqttClient.state());
-      Serial.println("\nTrying again in 5s.");
-      delay(5000);
+      Serial.printf("\nTrying again in %lu ms.\n", reconnectDelay);
+      delay(reconnectDelay);
     }
   }
 }
 
+// Bỏ qua slot lỗi; lỗi liên tiếp thì khởi tạo lại cả hai cảm biến
+void handleSensorFailure()
+{
+  Serial.println("Sensor read failed (" + String(sensors.failures + 1) + "), skipping this slot");
+  bool ahtOk, ensOk;
+  if (sensorFailure(sensors, ahtOk, ensOk))
+  {
+    Serial.println(String("Sensors reinitialized: AHT21 ") + (ahtOk ? "ok" : "failed") +
+                   ", ENS160 " + (ensOk ? "ok" : "failed"));
+  }
+}
+
 void setColor(uint8_t r, uint8_t g, uint8_t b)
 {
   ledcWrite(CH_RED, r);
@@ -157,61 +270,62 @@ void setup()
 
   // Initialize I2C
   Wire.begin(SDA_PIN, SCL_PIN); // SDA = GPIO21, SCL = GPIO22
+  sensorsInit(sensors, wireBus);
 
   // Initialize AHT21 sensor
-  if (!aht.begin())
+  while (!sensorsBeginAht21(sensors))
   {
     Serial.println("AHT21 not found! Check connection!");
-    while (1)
-      ;
+    delay(SENSOR_RETRY_MS);
   }
   Serial.println("AHT21 initialized successfully");
 
-  // Initialize ENS160 sensor
-  while (NO_ERR != ens160.begin())
+  // Initialize ENS160 sensor in standard mode
+  while (!sensorsBeginEns160(sensors))
   {
     Serial.println("ENS160 initialization failed, check connection!");
-    delay(3000);
+    delay(SENSOR_RETRY_MS);
   }
   Serial.println("ENS160 initialized successfully");
 
-  // Set operating mode
-  ens160.setPWRMode(ENS160_STANDARD_MODE);
-  ens160.setTempAndHum(25.0, 50.0); // Sample values, will be updated later
-
   setup_wifi();
   mqttClient.setServer(mqtt_server, mqtt_port);
+  mqttClient.setCallback(mqtt_callback);
   randomSeed(micros()); // Initialize random seed for random() function
-}
 
-unsigned long lastPublishMillis = 0;
-const unsigned long publishInterval = 5000; // 5 seconds
+  unsigned long phase = macPhase(publishInterval);
+  nextPublishMillis = millis() + phase;
+  Serial.println("Publish phase offset: " + String(phase) + " ms");
+}
 
 void loop()
 {
-  if (millis() - lastPublishMillis >= publishInterval)
+  // Xử lý gói đến (slot) ngay khi nhận để giữ mốc thời gian chính xác
+  mqttClient.loop();
+
+  if ((long)(millis() - nextPublishMillis) >= 0)
   {
-    lastPublishMillis = millis();
+    // Lịch cố định theo pha: bỏ qua các slot đã lỡ thay vì gửi dồn
+    do
+    {
+      nextPublishMillis += publishInterval;
+    } while ((long)(millis() - nextPublishMillis) >= 0);
+
     if (!mqttClient.connected())
     {
       reconnect();
     }
     mqttClient.loop();
 
-    // Read data from AHT21
-    sensors_event_t humidity, temp;
-    aht.getEvent(&humidity, &temp);
-
-    // Update environmental parameters for ENS160
-    ens160.setTempAndHum(temp.temperature, humidity.relative_humidity);
-
-    // Read data from ENS160
-    uint8_t status = ens160.getENS160Status();
-    int aqi = ens160.getAQI();
-    int tvoc = ens160.getTVOC();
-    int eco2 = ens160.getECO2();
+    // Read data from AHT21 and ENS160
+    Sample sample;
+    if (!readSample(sensors, sample))
+    {
+      handleSensorFailure();
+      return;
+    }
 
-    switch (aqi)
+    switch (sample.aqi)
     {
     case 1:
       setColor(0, 0, 255); // Blue for excellent air quality
@@ -234,36 +348,32 @@ void loop()
     }
 
     // Print results to Serial Monitor
+    char num[12];
     Serial.println("\n======= Sensor Reading =======");
     Serial.println("Device ID: " + String(DEVICE_ID));
-    Serial.println("ENS160 Status: " + String(status));
-    Serial.println("AQI: " + String(aqi));
-    Serial.println("TVOC: " + String(tvoc) + " ppb");
-    Serial.println("eCO2: " + String(eco2) + " ppm");
-    Serial.printf("Temperature: %.2f°C\n", temp.temperature);
-    Serial.printf("Humidity: %.2f%%\n", humidity.relative_humidity);
+    Serial.println("ENS160 Status: " + String(sample.status));
+    Serial.println("Acquisition: " + String(sensors.acquisitionUs) + " us");
+    Serial.println("AQI: " + String(sample.aqi));
+    Serial.println("TVOC: " + String(sample.tvoc) + " ppb");
+    Serial.println("eCO2: " + String(sample.eco2) + " ppm");
+    *appendCenti(num, sample.tempCenti) = '\0';
+    Serial.printf("Temperature: %s°C\n", num);
+    *appendCenti(num, sample.humCenti) = '\0';
+    Serial.printf("Humidity: %s%%\n", num);
 
     // Create JSON string
-    String payload = "{";
-    // payload += "\"Device ID\":" + String(DEVICE_ID) + ",";
-    // payload += "\"ENS160 Status\":" + String(status) + ",";
-    // payload += "\"AQI\":" + String(aqi) + ",";
-    // payload += "\"TVOC\":" + String(tvoc) + ",";
-    // payload += "\"eCO2\":" + String(eco2) + ",";
-    // payload += "\"Temperature\":" + String(temp.temperature) + ",";
-    // payload += "\"Humidity\":" + String(humidity.relative_humidity);
-
-    payload += "\"tvoc\":" + String(tvoc) + ",";
-    payload += "\"temperature\":" + String(temp.temperature) + ",";
-    payload += "\"humidity\":" + String(humidity.relative_humidity) + ",";
-    payload += "\"eco2\":" + String(eco2) + ",";
-    payload += "\"aqi\":" + String(aqi);
-    payload += "}";
+    char payload[112];
+    size_t payloadLen = formatPayload(sample, payload);
 
     // Chỉ gửi dữ liệu lên MQTT mỗi 5 giây
 
     // Send data to MQTT
-    mqttClient.publish(mqtt_topic, payload.c_str());
-    Serial.println("Data sent to MQTT: " + payload);
+    mqttClient.publish(mqtt_topic, (const uint8_t *)payload, payloadLen, false);
+    Serial.print("Data sent to MQTT: ");
+    Serial.println(payload);
+
+    char snapshot[48];
+    size_t snapshotLen = formatSnapshot(sample, snapshot);
+    mqttClient.publish(mqtt_snapshot_topic, (const uint8_t *)snapshot, snapshotLen, true);
   }
 }
\ No newline at end of file
@@ -0,0 +1,663 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Columnar bulk export of the sensor history
+Reads the history directory (HISTORY_DIR) directly, so it works offline,
+with or without the server running, and writes one Parquet or Arrow IPC
+file per room with the columns
+
+    timestamp, room, tvoc, temperature, humidity, eco2, aqi
+
+Rooms are exported in parallel, one worker process per --jobs. Each worker
+streams its room file by file and writes a row group (Parquet) or record
+batch (Arrow) every --row-group rows, so memory stays bounded by the row
+group size whatever the range. Block files are split into columns with
+strided memoryviews without touching single values; archive files are
+decompressed group by group, column by column. Samples still in the server's open head (the last
+hour at most) are not in any file yet and are not exported.
+
+Both formats are written here, no Arrow library is needed:
+- Parquet: timestamps (ms) and aqi are DELTA_BINARY_PACKED, the room is
+  RLE_DICTIONARY encoded, the float readings are PLAIN; pages can be gzip
+  compressed (--compression gzip). The footer holds each row group's
+  timestamp range, so readers can skip row groups by time.
+- Arrow IPC file: the room is a dictionary-encoded column, everything else
+  plain buffers. The format has no delta encoding, and its only codecs
+  (LZ4, zstd) are not in the standard library, so it is uncompressed.
+"""
+
+import argparse
+import logging
+import multiprocessing
+import os
+import struct
+import time
+import zlib
+from array import array
+from collections import deque
+from datetime import datetime
+from functools import partial
+from operator import sub
+
+from config import HISTORY_DIR
+from tsstore import METRICS, load_room
+
+# Configure logging
+logging.basicConfig(level=logging.INFO)
+logger = logging.getLogger(__name__)
+
+ROW_GROUP = 1 << 17  # Rows per row group / record batch, bounds worker memory
+INT_METRICS = ("aqi",)  # Integer readings, exported as int32
+END_OF_TIME = 1 << 62
+
+
+def read_room(directory, start, end, rows):
+    """Batches of about rows rows of one room in [start, end]: timestamps and metric columns"""
+    files, _ = load_room(directory)
+    times = bytearray()
+    columns = [bytearray() for _ in METRICS]
+    for block in files:
+        if block.t_max < start or block.t_min > end:
+            continue
+        for chunk_times, chunk_columns in block.columns(start, end):
+            times += chunk_times
+            for column, chunk in zip(columns, chunk_columns):
+                column += chunk
+            if len(times) >= rows * 8:
+                yield times, columns
+                times = bytearray()
+                columns = [bytearray() for _ in METRICS]
+    if times:
+        yield times, columns
+
+
+# ===== Parquet =====
+PARQUET_MAGIC = b"PAR1"
+
+# Thrift compact protocol field types
+T_TRUE, T_FALSE, T_I32, T_I64, T_BINARY, T_LIST, T_STRUCT = 1, 2, 5, 6, 8, 9, 12
+
+# parquet.thrift enums
+INT32, INT64, DOUBLE, BYTE_ARRAY = 1, 2, 5, 6
+REQUIRED = 0
+CONVERTED_UTF8, CONVERTED_TIMESTAMP_MILLIS = 0, 9
+PLAIN, RLE, DELTA_BINARY_PACKED, RLE_DICTIONARY = 0, 3, 5, 8
+DATA_PAGE, DICTIONARY_PAGE = 0, 2
+CODECS = {"none": 0, "gzip": 2}
+GZIP_LEVEL = 1  # 5x faster than the default 6 for a quarter more bytes
+
+DELTA_BLOCK = 128  # Values per block of a DELTA_BINARY_PACKED page
+DELTA_MINIBLOCKS = 4
+
+
+def varint(n):
+    out = bytearray()
+    while n > 0x7F:
+        out.append(n & 0x7F | 0x80)
+        n >>= 7
+    out.append(n)
+    return bytes(out)
+
+
+def zigzag(n):
+    return (n << 1) ^ (n >> 63)
+
+
+def thrift(fields):
+    """Compact protocol struct from (field id, type, value), ids ascending, None skipped"""
+    out = bytearray()
+    last = 0
+    for field, kind, value in fields:
+        if value is None:
+            continue
+        if kind == T_TRUE:
+            kind = T_TRUE if value else T_FALSE
+        if 0 < field - last <= 15:
+            out.append((field - last) << 4 | kind)
+        else:
+            out.append(kind)
+            out += varint(zigzag(field))
+        last = field
+        out += thrift_value(kind, value)
+    out.append(0)
+    return bytes(out)
+
+
+def thrift_value(kind, value):
+    if kind in (T_TRUE, T_FALSE):
+        return b""
+    if kind in (T_I32, T_I64):
+        return varint(zigzag(value))
+    if kind == T_BINARY:
+        value = value.encode() if isinstance(value, str) else value
+        return varint(len(value)) + value
+    if kind == T_STRUCT:
+        return thrift(value)
+    # T_LIST: (element type, items)
+    element, items = value
+    if len(items) < 15:
+        head = bytes([len(items) << 4 | element])
+    else:
+        head = bytes([0xF0 | element]) + varint(len(items))
+    return head + b"".join(thrift_value(element, item) for item in items)
+
+
+def delta_binary_packed(values, bits=64):
+    """DELTA_BINARY_PACKED encoding of a non-empty list of bits-wide ints"""
+    miniblock = DELTA_BLOCK // DELTA_MINIBLOCKS
+    out = bytearray(
+        varint(DELTA_BLOCK)
+        + varint(DELTA_MINIBLOCKS)
+        + varint(len(values))
+        + varint(zigzag(values[0]))
+    )
+    deltas = list(map(sub, values[1:], values[:-1]))
+    limit = 1 << (bits - 1)
+    if deltas and (min(deltas) < -limit or max(deltas) >= limit):
+        # Wrap around as the reader's fixed-width arithmetic does
+        deltas = [(delta + limit) % (2 * limit) - limit for delta in deltas]
+    for i in range(0, len(deltas), DELTA_BLOCK):
+        block = deltas[i : i + DELTA_BLOCK]
+        low = min(block)
+        widths = bytearray(DELTA_MINIBLOCKS)
+        packed = bytearray()
+        for m in range(0, len(block), miniblock):
+            values = block[m : m + miniblock]
+            width = (max(values) - low).bit_length()
+            widths[m // miniblock] = width
+            if width:
+                # LSB first; a short last miniblock is padded with zeros
+                acc = 0
+                for delta in reversed(values):
+                    acc = (acc << width) | (delta - low)
+                packed += acc.to_bytes(miniblock * width // 8, "little")
+        out += varint(zigzag(low)) + widths + packed
+    return bytes(out)
+
+
+def parquet_schema():
+    """SchemaElements: the root, then one per column"""
+    timestamp = [
+        (1, T_TRUE, True),  # isAdjustedToUTC
+        (2, T_STRUCT, [(1, T_STRUCT, [])]),  # unit: MILLIS
+    ]
+    # type, repetition_type, name, converted_type, logicalType
+    elements = [
+        [
+            (1, T_I32, INT64),
+            (3, T_I32, REQUIRED),
+            (4, T_BINARY, "timestamp"),
+            (6, T_I32, CONVERTED_TIMESTAMP_MILLIS),
+            (10, T_STRUCT, [(8, T_STRUCT, timestamp)]),
+        ],
+        [
+            (1, T_I32, BYTE_ARRAY),
+            (3, T_I32, REQUIRED),
+            (4, T_BINARY, "room"),
+            (6, T_I32, CONVERTED_UTF8),
+            (10, T_STRUCT, [(1, T_STRUCT, [])]),  # STRING
+        ],
+    ]
+    for metric in METRICS:
+        kind = INT32 if metric in INT_METRICS else DOUBLE
+        elements.append([(1, T_I32, kind), (3, T_I32, REQUIRED), (4, T_BINARY, metric)])
+    root = [(4, T_BINARY, "schema"), (5, T_I32, len(elements))]
+    return [root] + elements
+
+
+class ParquetWriter:
+    """Parquet file of one room, one row group per write()"""
+
+    extension = "parquet"
+
+    def __init__(self, path, room, compression="none"):
+        self.file = open(path, "wb")
+        self.file.write(PARQUET_MAGIC)
+        self.room = room.encode()
+        self.codec = CODECS[compression]
+        self.row_groups = []
+        self.rows = 0
+
+    def _compress(self, data):
+        if not self.codec:
+            return data
+        gzip = zlib.compressobj(GZIP_LEVEL, zlib.DEFLATED, 31)
+        return gzip.compress(data) + gzip.flush()
+
+    def _page(self, kind, page_header, data):
+        """Write a page, returns its size before and after compression"""
+        body = self._compress(data)
+        header = thrift(
+            [
+                (1, T_I32, kind),
+                (2, T_I32, len(data)),
+                (3, T_I32, len(body)),
+                (5 if kind == DATA_PAGE else 7, T_STRUCT, page_header),
+            ]
+        )
+        self.file.write(header)
+        self.file.write(body)
+        return len(header) + len(data), len(header) + len(body)
+
+    def _column(self, name, kind, count, encoding, data, dictionary=None, stats=None):
+        """One column chunk with a single data page: its ColumnChunk and sizes"""
+        start = self.file.tell()
+        raw = written = 0
+        encodings = [encoding]
+        if dictionary is not None:
+            raw, written = self._page(
+                DICTIONARY_PAGE, [(1, T_I32, 1), (2, T_I32, PLAIN)], dictionary
+            )
+            encodings = [PLAIN, encoding]
+        data_offset = self.file.tell()
+        # Required top-level columns carry no definition or repetition levels
+        page_header = [
+            (1, T_I32, count),
+            (2, T_I32, encoding),
+            (3, T_I32, RLE),
+            (4, T_I32, RLE),
+        ]
+        sizes = self._page(DATA_PAGE, page_header, data)
+        raw += sizes[0]
+        written += sizes[1]
+        meta = [
+            (1, T_I32, kind),
+            (2, T_LIST, (T_I32, encodings)),
+            (3, T_LIST, (T_BINARY, [name])),
+            (4, T_I32, self.codec),
+            (5, T_I64, count),
+            (6, T_I64, raw),
+            (7, T_I64, written),
+            (9, T_I64, data_offset),
+            (11, T_I64, start if dictionary is not None else None),
+            (12, T_STRUCT, stats),
+        ]
+        return [(2, T_I64, start), (3, T_STRUCT, meta)], raw, written
+
+    def write(self, times, columns):
+        """Write one row group from packed timestamps (s) and metric columns"""
+        count = len(times) // 8
+        start = self.file.tell()
+        millis = [t * 1000 for t in memoryview(times).cast("q")]
+        first, last = min(millis), max(millis)
+        stats = [
+            (5, T_BINARY, struct.pack("<q", last)),  # max_value
+            (6, T_BINARY, struct.pack("<q", first)),  # min_value
+        ]
+        chunks = [
+            self._column(
+                "timestamp",
+                INT64,
+                count,
+                DELTA_BINARY_PACKED,
+                delta_binary_packed(millis),
+                stats=stats,
+            ),
+            # Every row has dictionary entry 0: one RLE run of bit width 1
+            self._column(
+                "room",
+                BYTE_ARRAY,
+                count,
+                RLE_DICTIONARY,
+                b"\x01" + varint(count << 1) + b"\x00",
+                dictionary=struct.pack("<I", len(self.room)) + self.room,
+            ),
+        ]
+        for metric, column in zip(METRICS, columns):
+            if metric in INT_METRICS:
+                values = list(map(int, memoryview(column).cast("d")))
+                chunk = self._column(
+                    metric,
+                    INT32,
+                    count,
+                    DELTA_BINARY_PACKED,
+                    delta_binary_packed(values, 32),
+                )
+            else:
+                chunk = self._column(metric, DOUBLE, count, PLAIN, column)
+            chunks.append(chunk)
+        self.row_groups.append(
+            [
+                (1, T_LIST, (T_STRUCT, [chunk for chunk, _, _ in chunks])),
+                (2, T_I64, sum(raw for _, raw, _ in chunks)),
+                (3, T_I64, count),
+                (5, T_I64, start),
+                (6, T_I64, self.file.tell() - start),
+            ]
+        )
+        self.rows += count
+
+    def close(self):
+        footer = thrift(
+            [
+                (1, T_I32, 2),
+                (2, T_LIST, (T_STRUCT, parquet_schema())),
+                (3, T_I64, self.rows),
+                (4, T_LIST, (T_STRUCT, self.row_groups)),
+                (6, T_BINARY, "AirSense export.py"),
+                # TypeDefinedOrder for every column, so min/max_value are used
+                (7, T_LIST, (T_STRUCT, [[(1, T_STRUCT, [])]] * (2 + len(METRICS)))),
+            ]
+        )
+        self.file.write(footer)
+        self.file.write(struct.pack("<I", len(footer)) + PARQUET_MAGIC)
+        size = self.file.tell()
+        self.file.close()
+        return size
+
+
+# ===== Arrow IPC =====
+ARROW_MAGIC = b"ARROW1"
+CONTINUATION = 0xFFFFFFFF
+METADATA_V5 = 4
+# Message header and type union members
+HEADER_SCHEMA, HEADER_DICTIONARY_BATCH, HEADER_RECORD_BATCH = 1, 2, 3
+TYPE_INT, TYPE_FLOAT, TYPE_UTF8, TYPE_TIMESTAMP = 2, 3, 5, 10
+PRECISION_DOUBLE = 2
+UNIT_SECOND = 0
+ROOM_DICTIONARY = 0  # Dictionary id of the room column
+
+
+class Table:
+    """Flatbuffer table: slots in field order, each None, (format, scalar) or a child"""
+
+    def __init__(self, *slots):
+        self.slots = slots
+
+    def place(self, buf, pending):
+        fields = []
+        for slot, value in enumerate(self.slots):
+            if value is None:
+                continue
+            fmt = value[0] if isinstance(value, tuple) else "I"
+            fields.append((struct.calcsize(fmt), slot, value))
+        # Largest first after the vtable offset, so every field is aligned
+        fields.sort(key=lambda field: -field[0])
+        offsets = {}
+        size = 4
+        for width, slot, _ in fields:
+            size += -size % width
+            offsets[slot] = size
+            size += width
+        pad(buf, 2)
+        vtable = len(buf)
+        buf += struct.pack(
+            f"<HH{len(self.slots)}H",
+            4 + 2 * len(self.slots),
+            size,
+            *(offsets.get(slot, 0) for slot in range(len(self.slots))),
+        )
+        pad(buf, 8)
+        table = len(buf)
+        buf += bytes(size)
+        struct.pack_into("<i", buf, table, table - vtable)
+        for _, slot, value in fields:
+            if isinstance(value, tuple):
+                struct.pack_into("<" + value[0], buf, table + offsets[slot], value[1])
+            else:
+                pending.append((table + offsets[slot], value))
+        return table
+
+
+class String:
+    def __init__(self, text):
+        self.data = text.encode()
+
+    def place(self, buf, pending):
+        pad(buf, 4)
+        position = len(buf)
+        buf += struct.pack("<I", len(self.data)) + self.data + b"\0"
+        return position
+
+
+class Vector:
+    """Flatbuffer vector of tables or strings"""
+
+    def __init__(self, items):
+        self.items = items
+
+    def place(self, buf, pending):
+        pad(buf, 4)
+        position = len(buf)
+        buf += struct.pack("<I", len(self.items)) + bytes(4 * len(self.items))
+        for i, item in enumerate(self.items):
+            pending.append((position + 4 + 4 * i, item))
+        return position
+
+
+class Structs:
+    """Flatbuffer vector of structs with 8-byte fields"""
+
+    def __init__(self, fmt, items):
+        self.data = b"".join(struct.pack("<" + fmt, *item) for item in items)
+        self.count = len(items)
+
+    def place(self, buf, pending):
+        buf += bytes(-(len(buf) + 4) % 8)  # Elements 8-byte aligned
+        position = len(buf)
+        buf += struct.pack("<I", self.count) + self.data
+        return position
+
+
+def pad(buf, alignment):
+    buf += bytes(-len(buf) % alignment)
+
+
+def flatbuffer(root):
+    """
+    Serialize a table. Children are laid out after their parents, so every
+    offset points forward as the format requires. Padded to 8 bytes.
+    """
+    buf = bytearray(4)
+    pending = deque([(0, root)])
+    while pending:
+        at, child = pending.popleft()
+        position = child.place(buf, pending)
+        struct.pack_into("<I", buf, at, position - at)
+    pad(buf, 8)
+    return bytes(buf)
+
+
+def arrow_field(name, type_id, type_table, dictionary=None):
+    # name, nullable, type_type, type, dictionary, children
+    return Table(
+        String(name), ("?", False), ("B", type_id), type_table, dictionary, Vector([])
+    )
+
+
+def arrow_schema():
+    int32 = Table(("i", 32), ("?", True))
+    fields = [
+        arrow_field(
+            "timestamp", TYPE_TIMESTAMP, Table(("h", UNIT_SECOND), String("UTC"))
+        ),
+        arrow_field(
+            "room",
+            TYPE_UTF8,
+            Table(),
+            Table(("q", ROOM_DICTIONARY), int32, ("?", False)),
+        ),
+    ]
+    for metric in METRICS:
+        if metric in INT_METRICS:
+            fields.append(arrow_field(metric, TYPE_INT, int32))
+        else:
+            fields.append(
+                arrow_field(metric, TYPE_FLOAT, Table(("h", PRECISION_DOUBLE)))
+            )
+    return Table(("h", 0), Vector(fields))  # Little endian
+
+
+def record_batch(count, columns):
+    """RecordBatch table and body; columns are lists of buffers, none has nulls"""
+    specs = []
+    body = bytearray()
+    for buffers in columns:
+        specs.append((len(body), 0))  # Validity bitmap left out
+        for data in buffers:
+            specs.append((len(body), len(data)))
+            body += data
+            pad(body, 8)
+    nodes = [(count, 0)] * len(columns)
+    return Table(("q", count), Structs("qq", nodes), Structs("qq", specs)), body
+
+
+class ArrowWriter:
+    """Arrow IPC file of one room, one record batch per write()"""
+
+    extension = "arrow"
+
+    def __init__(self, path, room, compression="none"):
+        self.file = open(path, "wb")
+        self.file.write(ARROW_MAGIC + b"\0\0")
+        self.schema = arrow_schema()
+        self.batches = []
+        self.rows = 0
+        self._message(HEADER_SCHEMA, self.schema, b"")
+        # The room column's dictionary: a utf8 array of one string
+        name = room.encode()
+        batch, body = record_batch(1, [[struct.pack("<ii", 0, len(name)), name]])
+        self.dictionaries = [
+            self._message(
+                HEADER_DICTIONARY_BATCH,
+                Table(("q", ROOM_DICTIONARY), batch, ("?", False)),
+                body,
+            )
+        ]
+
+    def _message(self, header_type, header, body):
+        """Write an encapsulated message, returns its footer Block"""
+        meta = flatbuffer(
+            Table(("h", METADATA_V5), ("B", header_type), header, ("q", len(body)))
+        )
+        offset = self.file.tell()
+        self.file.write(struct.pack("<Ii", CONTINUATION, len(meta)) + meta)
+        self.file.write(body)
+        return offset, 8 + len(meta), len(body)
+
+    def write(self, times, columns):
+        """Write one record batch from packed timestamps (s) and metric columns"""
+        count = len(times) // 8
+        buffers = [times, bytes(4 * count)]  # Room: dictionary index 0
+        for metric, column in zip(METRICS, columns):
+            if metric in INT_METRICS:
+                column = array("i", map(int, memoryview(column).cast("d"))).tobytes()
+            buffers.append(column)
+        batch, body = record_batch(count, [[data] for data in buffers])
+        self.batches.append(self._message(HEADER_RECORD_BATCH, batch, body))
+        self.rows += count
+
+    def close(self):
+        self.file.write(struct.pack("<Ii", CONTINUATION, 0))  # End of stream
+        footer = flatbuffer(
+            Table(
+                ("h", METADATA_V5),
+                self.schema,
+                Structs("qi4xq", self.dictionaries),
+                Structs("qi4xq", self.batches),
+            )
+        )
+        self.file.write(footer)
+        self.file.write(struct.pack("<i", len(footer)) + ARROW_MAGIC)
+        size = self.file.tell()
+        self.file.close()
+        return size
+
+
+WRITERS = {"parquet": ParquetWriter, "arrow": ArrowWriter}
+
+
+# ===== export =====
+def export_room(args, room):
+    """Export one room, returns (room, rows, bytes, seconds)"""
+    started = time.perf_counter()
+    writer_class = WRITERS[args.format]
+    path = os.path.join(args.output, f"{room}.{writer_class.extension}")
+    writer = None
+    for times, columns in read_room(
+        os.path.join(args.history_dir, room), args.start, args.end, args.row_group
+    ):
+        if writer is None:
+            writer = writer_class(path + ".tmp", room, args.compression)
+        writer.write(times, columns)
+    if writer is None:
+        return room, 0, 0, time.perf_counter() - started
+    size = writer.close()
+    os.replace(path + ".tmp", path)
+    return room, writer.rows, size, time.perf_counter() - started
+
+
+def export(args):
+    """Export every selected room, returns a summary"""
+    rooms = args.rooms or sorted(
+        name
+        for name in os.listdir(args.history_dir)
+        if os.path.isdir(os.path.join(args.history_dir, name))
+    )
+    os.makedirs(args.output, exist_ok=True)
+    started = time.perf_counter()
+    rows = size = 0
+    with multiprocessing.Pool(args.jobs) as pool:
+        for room, room_rows, room_size, seconds in pool.imap_unordered(
+            partial(export_room, args), rooms
+        ):
+            if room_rows:
+                logger.info(
+                    f"{room}: {room_rows} rows, {room_size / (1 << 20):.1f} MB "
+                    f"in {seconds:.1f}s"
+                )
+            else:
+                logger.info(f"{room}: no rows in range")
+            rows += room_rows
+            size += room_size
+    elapsed = time.perf_counter() - started
+    return {
+        "rooms": len(rooms),
+        "rows": rows,
+        "mb": round(size / (1 << 20), 1),
+        "seconds": round(elapsed, 2),
+        "rows_per_s": round(rows / elapsed) if elapsed else 0,
+    }
+
+
+def parse_time(text):
+    """Epoch seconds, or an ISO date / date and time in local time"""
+    try:
+        return int(float(text))
+    except ValueError:
+        return int(datetime.fromisoformat(text).timestamp())
+
+
+def main():
+    """Main function to export history to columnar files"""
+    parser = argparse.ArgumentParser(
+        description="Export sensor history to Parquet or Arrow IPC files"
+    )
+    parser.add_argument("output", help="Directory for the files, one per room")
+    parser.add_argument("--history-dir", default=HISTORY_DIR)
+    parser.add_argument(
+        "--rooms",
+        type=lambda text: text.split(","),
+        help="Comma separated (default: all)",
+    )
+    parser.add_argument("--start", type=parse_time, default=0, help="e.g. 2025-01-01")
+    parser.add_argument("--end", type=parse_time, default=END_OF_TIME)
+    parser.add_argument("--format", choices=list(WRITERS), default="parquet")
+    parser.add_argument(
+        "--compression",
+        choices=list(CODECS),
+        default="none",
+        help="Page compression, Parquet only",
+    )
+    parser.add_argument("--jobs", type=int, default=os.cpu_count())
+    parser.add_argument("--row-group", type=int, default=ROW_GROUP)
+    args = parser.parse_args()
+    summary = export(args)
+    logger.info(
+        f"Exported {summary['rows']} rows of {summary['rooms']} rooms, "
+        f"{summary['mb']} MB in {summary['seconds']}s ({summary['rows_per_s']} rows/s)"
+    )
+
+
+if __name__ == "__main__":
+    main()
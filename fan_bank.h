@@ -0,0 +1,149 @@
+// Bộ lập lịch quạt: stagger, load shedding và xoay vòng theo giờ chạy.
+// Chỉ là logic thuần (không digitalWrite, Serial hay NVS) để biên dịch và
+// kiểm thử được trên máy host: pio test -e native
+#pragma once
+
+#include <stdint.h>
+
+#ifndef FAN_COUNT
+#define FAN_COUNT 4
+#endif
+#ifndef FAN_STAGGER_MS
+#define FAN_STAGGER_MS 3000UL            // Gap between two relay closures (inrush)
+#endif
+#ifndef FAN_ROTATE_INTERVAL_MS
+#define FAN_ROTATE_INTERVAL_MS 1800000UL // Check runtime balance every 30 minutes
+#endif
+#ifndef FAN_ROTATE_MIN_DIFF_S
+#define FAN_ROTATE_MIN_DIFF_S 600        // Swap only if runtime differs by 10+ minutes
+#endif
+
+// Lượng gió yêu cầu (số quạt) được chuyển thành trạng thái từng relay:
+// bật lần lượt cách nhau FAN_STAGGER_MS, ưu tiên quạt có ít giờ chạy nhất.
+struct FanBank
+{
+  uint8_t target;                 // Number of outputs requested
+  bool on[FAN_COUNT];
+  unsigned long onSince[FAN_COUNT]; // millis() of last fold into runtimeS
+  uint32_t runtimeS[FAN_COUNT];     // Accumulated runtime, persisted by the caller
+  unsigned long lastStart;
+  unsigned long lastRotate;
+  bool started; // lastStart is valid
+};
+
+// Called for every relay change, the caller drives the pin
+typedef void (*FanOutputFn)(uint8_t idx, bool on);
+
+inline void fanBankInit(FanBank &bank, unsigned long now)
+{
+  bank.target = 0;
+  for (uint8_t i = 0; i < FAN_COUNT; i++)
+  {
+    bank.on[i] = false;
+    bank.onSince[i] = now;
+    bank.runtimeS[i] = 0;
+  }
+  bank.lastStart = now;
+  bank.lastRotate = now;
+  bank.started = false;
+}
+
+inline void fanBankSetTarget(FanBank &bank, uint8_t count)
+{
+  bank.target = count > FAN_COUNT ? FAN_COUNT : count;
+}
+
+// Cộng thời gian chạy của phiên hiện tại vào runtimeS, giữ lại phần lẻ < 1 s
+inline void fanFoldRuntime(FanBank &bank, uint8_t idx, unsigned long now)
+{
+  if (!bank.on[idx])
+  {
+    return;
+  }
+  unsigned long elapsed = now - bank.onSince[idx];
+  bank.runtimeS[idx] += elapsed / 1000;
+  bank.onSince[idx] = now - (elapsed % 1000);
+}
+
+inline uint8_t fanActiveCount(const FanBank &bank)
+{
+  uint8_t n = 0;
+  for (uint8_t i = 0; i < FAN_COUNT; i++)
+  {
+    if (bank.on[i])
+    {
+      n++;
+    }
+  }
+  return n;
+}
+
+// Returns the running (wantOn = true) or idle output with the most/least
+// runtime, or -1 if there is none.
+inline int fanPick(const FanBank &bank, bool wantOn, bool mostRuntime)
+{
+  int best = -1;
+  for (uint8_t i = 0; i < FAN_COUNT; i++)
+  {
+    if (bank.on[i] != wantOn)
+    {
+      continue;
+    }
+    if (best < 0 ||
+        (mostRuntime ? bank.runtimeS[i] > bank.runtimeS[best]
+                     : bank.runtimeS[i] < bank.runtimeS[best]))
+    {
+      best = i;
+    }
+  }
+  return best;
+}
+
+inline void fanSwitch(FanBank &bank, uint8_t idx, bool on, unsigned long now, FanOutputFn output)
+{
+  bank.on[idx] = on;
+  bank.onSince[idx] = now;
+  output(idx, on);
+}
+
+// Gọi liên tục trong loop(): mỗi lần chỉ đóng tối đa một relay
+inline void fanBankStep(FanBank &bank, unsigned long now, FanOutputFn output)
+{
+  uint8_t active = fanActiveCount(bank);
+
+  // Turning off causes no inrush, shed the most worn outputs at once
+  while (active > bank.target)
+  {
+    int idx = fanPick(bank, true, true);
+    fanFoldRuntime(bank, idx, now);
+    fanSwitch(bank, idx, false, now, output);
+    active--;
+  }
+
+  bool staggerElapsed = !bank.started || now - bank.lastStart >= FAN_STAGGER_MS;
+
+  if (active < bank.target && staggerElapsed)
+  {
+    fanSwitch(bank, fanPick(bank, false, false), true, now, output);
+    bank.lastStart = now;
+    bank.started = true;
+  }
+  else if (active == bank.target && active > 0 && active < FAN_COUNT &&
+           staggerElapsed && now - bank.lastRotate >= FAN_ROTATE_INTERVAL_MS)
+  {
+    // Rotation: hand the load from the most used running fan to the least used idle one
+    bank.lastRotate = now;
+    for (uint8_t i = 0; i < FAN_COUNT; i++)
+    {
+      fanFoldRuntime(bank, i, now);
+    }
+    int worn = fanPick(bank, true, true);
+    int fresh = fanPick(bank, false, false);
+    if (bank.runtimeS[worn] >= bank.runtimeS[fresh] + FAN_ROTATE_MIN_DIFF_S)
+    {
+      fanSwitch(bank, fresh, true, now, output);
+      fanSwitch(bank, worn, false, now, output);
+      bank.lastStart = now;
+    }
+  }
+}
@@ -0,0 +1,201 @@
+// Quyết định thông gió và parse payload của room node, không dùng float.
+// Logic thuần (không Serial hay MQTT) để dùng chung cho firmware, kiểm thử
+// host (pio test -e native) và bản build host của bench.py / mqtt_trace.py
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "fan_bank.h"
+
+#define TVOC_THRESHOLD 220
+#define eCO2_THRESHOLD 800
+#define AQI_THRESHOLD 3
+
+// Upper bounds of ventilation levels 1 and 2, anything above is level 3
+#define TVOC_LEVEL2 650
+#define TVOC_LEVEL3 2200
+#define eCO2_LEVEL2 1000
+#define eCO2_LEVEL3 1500
+#define VENT_MAX_LEVEL 3
+
+// Một bản ghi số đo của room node, nhiệt độ và độ ẩm x100
+struct Reading
+{
+  int tvoc;
+  int tempCenti;
+  int humCenti;
+  int eco2;
+  int aqi;
+};
+
+// Mức thông gió 0..VENT_MAX_LEVEL từ chỉ số xấu nhất
+inline uint8_t ventilationLevel(int tvoc, int eco2, int aqi)
+{
+  uint8_t level = 0;
+  if (tvoc >= TVOC_THRESHOLD)
+  {
+    level = tvoc >= TVOC_LEVEL3 ? 3 : (tvoc >= TVOC_LEVEL2 ? 2 : 1);
+  }
+  if (eco2 >= eCO2_THRESHOLD)
+  {
+    uint8_t l = eco2 >= eCO2_LEVEL3 ? 3 : (eco2 >= eCO2_LEVEL2 ? 2 : 1);
+    level = l > level ? l : level;
+  }
+  if (aqi >= AQI_THRESHOLD)
+  {
+    uint8_t l = aqi - AQI_THRESHOLD + 1;
+    l = l > VENT_MAX_LEVEL ? VENT_MAX_LEVEL : l;
+    level = l > level ? l : level;
+  }
+  return level;
+}
+
+// Số quạt cần bật cho một mức thông gió (làm tròn lên)
+inline uint8_t fansForLevel(uint8_t level)
+{
+  return (level * FAN_COUNT + VENT_MAX_LEVEL - 1) / VENT_MAX_LEVEL;
+}
+
+// ===== Fixed-point parsing =====
+// Phần nguyên dài nhất: 9999999 x 100 vẫn vừa int32_t
+#define CENTI_MAX_DIGITS 7
+
+// Đọc số thập phân "-12.345" thành giá trị x100 (làm tròn), không dùng float.
+// Trả về con trỏ sau số, hoặc nullptr nếu không có số hoặc phần nguyên quá
+// CENTI_MAX_DIGITS chữ số.
+inline const char *parseCenti(const char *p, int32_t &out)
+{
+  bool neg = *p == '-';
+  if (neg)
+  {
+    p++;
+  }
+  if (*p < '0' || *p > '9')
+  {
+    return nullptr;
+  }
+  int32_t whole = 0;
+  for (int digits = 0; *p >= '0' && *p <= '9'; digits++)
+  {
+    if (digits == CENTI_MAX_DIGITS)
+    {
+      return nullptr;
+    }
+    whole = whole * 10 + (*p++ - '0');
+  }
+  int32_t milli = 0; // Ba chữ số thập phân đầu tiên
+  int digits = 0;
+  if (*p == '.')
+  {
+    p++;
+    while (*p >= '0' && *p <= '9')
+    {
+      if (digits < 3)
+      {
+        milli = milli * 10 + (*p - '0');
+        digits++;
+      }
+      p++;
+    }
+  }
+  for (; digits < 3; digits++)
+  {
+    milli *= 10;
+  }
+  int32_t centi = whole * 100 + (milli + 5) / 10;
+  out = neg ? -centi : centi;
+  return p;
+}
+
+// Giá trị x100 của "key" trong JSON phẳng của room node; false nếu không có
+// khoá hoặc giá trị không phải một số kết thúc bằng ',' hay '}'
+inline bool jsonCenti(const char *json, const char *key, int32_t &out)
+{
+  char pattern[24];
+  snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+  const char *p = strstr(json, pattern);
+  if (p == nullptr)
+  {
+    return false;
+  }
+  p += strlen(pattern);
+  while (*p == ' ')
+  {
+    p++;
+  }
+  p = parseCenti(p, out);
+  if (p == nullptr)
+  {
+    return false;
+  }
+  while (*p == ' ')
+  {
+    p++;
+  }
+  return *p == ',' || *p == '}';
+}
+
+// Giá trị x100 -> "d.dd"
+inline const char *formatCenti(char *buf, size_t size, int32_t centi)
+{
+  int32_t mag = centi < 0 ? -centi : centi;
+  snprintf(buf, size, "%s%d.%02d", centi < 0 ? "-" : "", (int)(mag / 100), (int)(mag % 100));
+  return buf;
+}
+
+// Bản ghi JSON của luồng dữ liệu. false nếu payload không phải một object
+// trọn vẹn (bị cắt) hoặc thiếu hay hỏng một trong năm số đo; r khi đó không
+// dùng được
+inline bool parseReadingJson(const char *json, Reading &r)
+{
+  const char *end = json + strlen(json);
+  while (*json == ' ')
+  {
+    json++;
+  }
+  while (end > json && (end[-1] == ' ' || end[-1] == '\n' || end[-1] == '\r'))
+  {
+    end--;
+  }
+  if (*json != '{' || end == json || end[-1] != '}')
+  {
+    return false;
+  }
+  int32_t tvoc, temp, hum, eco2, aqi;
+  if (!jsonCenti(json, "tvoc", tvoc) || !jsonCenti(json, "temperature", temp) ||
+      !jsonCenti(json, "humidity", hum) || !jsonCenti(json, "eco2", eco2) ||
+      !jsonCenti(json, "aqi", aqi))
+  {
+    return false;
+  }
+  r.tvoc = tvoc / 100;
+  r.tempCenti = temp;
+  r.humCenti = hum;
+  r.eco2 = eco2 / 100;
+  r.aqi = aqi / 100;
+  return true;
+}
+
+// Snapshot retained: "tvoc,eco2,aqi,temperature,humidity"
+inline bool parseSnapshot(const char *csv, Reading &r)
+{
+  int32_t field[5];
+  const char *p = csv;
+  for (int i = 0; i < 5; i++)
+  {
+    p = parseCenti(p, field[i]);
+    if (p == nullptr || *p != (i < 4 ? ',' : '\0'))
+    {
+      return false;
+    }
+    p++;
+  }
+  r.tvoc = field[0] / 100;
+  r.eco2 = field[1] / 100;
+  r.aqi = field[2] / 100;
+  r.tempCenti = field[3];
+  r.humCenti = field[4];
+  return true;
+}
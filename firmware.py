@@ -0,0 +1,154 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Host builds of the firmware logic.
+
+The Arduino-free parts of the ESP32 sketches (fan_bank.h, fan_control.h,
+room_sensors.h against the I2C emulator of host/i2c_emulator.h) are
+compiled for this machine through the small C shims in host/ and loaded
+with ctypes, so benchmarks and trace replays run the firmware's own code
+rather than a Python copy of it. The server's own hot loops that Python
+runs too slowly (the Gorilla codec of tsstore.py, the threshold replay of
+backtest.py) are built the same way from host/gorilla.cpp and
+host/backtest.cpp. A shim is rebuilt only when it or a header in the
+repository root or host/ changes: the library name carries a hash of the
+sources and lives in host/build/.
+
+Needs a C++ compiler: $CXX, or c++ from PATH.
+"""
+
+import ctypes
+import glob
+import hashlib
+import os
+import subprocess
+
+ROOT = os.path.dirname(os.path.abspath(__file__))
+HOST_DIR = os.path.join(ROOT, "host")
+BUILD_DIR = os.path.join(HOST_DIR, "build")
+CXXFLAGS = ("-std=c++11", "-O2", "-shared", "-fPIC", "-Wall")
+
+
+class AcquisitionStats(ctypes.Structure):
+    """AcquisitionStats of host/room_node.cpp"""
+
+    _fields_ = [
+        (name, ctypes.c_uint64)
+        for name in (
+            "slots",
+            "samples",
+            "reinits",
+            "reinit_failures",
+            "transactions",
+            "nacks",
+            "corrupted",
+            "bus_us",
+        )
+    ]
+
+
+# Signatures of the exported functions, per shim
+SIGNATURES = {
+    "fan_node": {
+        "fan_count": ((), ctypes.c_int),
+        "fan_ventilation_level": ((ctypes.c_int,) * 3, ctypes.c_int),
+        "fan_stream_target": ((ctypes.c_char_p,), ctypes.c_int),
+        "fan_snapshot_target": ((ctypes.c_char_p,), ctypes.c_int),
+        "fan_parse": (
+            (ctypes.c_char_p, ctypes.c_uint32, ctypes.c_int),
+            ctypes.c_uint64,
+        ),
+    },
+    "room_node": {
+        "room_acquisition": (
+            (ctypes.c_uint32,) * 3
+            + (ctypes.c_double, ctypes.c_double, ctypes.c_uint32)
+            + (
+                ctypes.POINTER(ctypes.c_uint32),
+                ctypes.POINTER(ctypes.c_uint8),
+                ctypes.POINTER(AcquisitionStats),
+            ),
+            ctypes.c_int,
+        ),
+        "room_format": (
+            (ctypes.c_uint32, ctypes.c_uint32, ctypes.c_int)
+            + (ctypes.c_char_p, ctypes.c_size_t),
+            ctypes.c_size_t,
+        ),
+    },
+    "backtest": {
+        "backtest_replay": (
+            (ctypes.c_void_p,) * 6
+            + (ctypes.c_uint32, ctypes.c_void_p, ctypes.c_uint32, ctypes.c_void_p)
+            + (ctypes.c_int64,)
+            + (ctypes.c_void_p,) * 3,
+            ctypes.c_int64,
+        ),
+    },
+    "gorilla": {
+        "gorilla_encode_times": (
+            (ctypes.c_void_p, ctypes.c_uint32, ctypes.c_char_p, ctypes.c_size_t),
+            ctypes.c_size_t,
+        ),
+        "gorilla_decode_times": (
+            (ctypes.c_char_p, ctypes.c_size_t, ctypes.c_uint32)
+            + (ctypes.c_void_p, ctypes.c_size_t),
+            ctypes.c_int,
+        ),
+        "gorilla_encode_values": (
+            (ctypes.c_void_p, ctypes.c_uint32, ctypes.c_char_p, ctypes.c_size_t),
+            ctypes.c_size_t,
+        ),
+        "gorilla_decode_values": (
+            (ctypes.c_char_p, ctypes.c_size_t, ctypes.c_uint32)
+            + (ctypes.c_void_p, ctypes.c_size_t),
+            ctypes.c_int,
+        ),
+        "gorilla_decode_block": (
+            (ctypes.c_char_p, ctypes.c_size_t, ctypes.c_uint32)
+            + (ctypes.c_void_p, ctypes.c_void_p),
+            ctypes.c_int,
+        ),
+    },
+}
+
+_loaded = {}
+
+
+def build(name):
+    """Compiles host/<name>.cpp if needed, returns the library path"""
+    source = os.path.join(HOST_DIR, f"{name}.cpp")
+    digest = hashlib.sha256()
+    headers = glob.glob(os.path.join(ROOT, "*.h")) + glob.glob(
+        os.path.join(HOST_DIR, "*.h")
+    )
+    for path in [source] + sorted(headers):
+        with open(path, "rb") as f:
+            digest.update(f.read())
+    library = os.path.join(BUILD_DIR, f"{name}-{digest.hexdigest()[:16]}.so")
+    if os.path.exists(library):
+        return library
+
+    os.makedirs(BUILD_DIR, exist_ok=True)
+    tmp = f"{library}.{os.getpid()}.tmp"
+    cxx = os.environ.get("CXX", "c++")
+    subprocess.run(
+        [cxx, *CXXFLAGS, f"-I{ROOT}", "-o", tmp, source],
+        check=True,
+        capture_output=True,
+        text=True,
+    )
+    os.replace(tmp, library)  # Parallel builds of the same sources agree
+    return library
+
+
+def load(name):
+    """The shim host/<name>.cpp as a ctypes library, built on first use"""
+    lib = _loaded.get(name)
+    if lib is None:
+        lib = ctypes.CDLL(build(name))
+        for func, (argtypes, restype) in SIGNATURES[name].items():
+            getattr(lib, func).argtypes = argtypes
+            getattr(lib, func).restype = restype
+        _loaded[name] = lib
+    return lib
@@ -0,0 +1,326 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Fleet Simulator for load testing the TVOC Monitoring Server
+Runs thousands of virtual room nodes on one asyncio event loop. Every node
+publishes the exact payload built by formatPayload() in esp32_node_room.cpp,
+driven by a simple room model: occupancy follows a day/night schedule,
+occupants raise CO2 and TVOC, ventilation pulls them back towards outdoor
+air, and temperature/humidity follow a diurnal cycle.
+
+A monitor connection subscribes to the fleet topics to measure per-message
+latency through the broker.
+"""
+
+import argparse
+import asyncio
+import logging
+import math
+import random
+import struct
+import time
+from collections import deque
+
+from config import MQTT_BROKER, MQTT_PORT
+
+# Configure logging
+logging.basicConfig(level=logging.INFO)
+logger = logging.getLogger(__name__)
+
+OUTDOOR_CO2 = 420  # ppm
+CO2_PER_PERSON = 18000  # ppm·m³ per hour exhaled by one adult at rest
+ROOM_VOLUME = 40  # m³
+
+
+# ===== Minimal MQTT 3.1.1 client (QoS 0 only) =====
+def encode_length(n):
+    out = bytearray()
+    while True:
+        byte, n = n % 128, n // 128
+        out.append(byte | 0x80 if n else byte)
+        if not n:
+            return bytes(out)
+
+
+def encode_str(s):
+    data = s.encode()
+    return struct.pack("!H", len(data)) + data
+
+
+def packet(header, body):
+    return bytes([header]) + encode_length(len(body)) + body
+
+
+class MqttConnection:
+    """One TCP connection to the broker shared by many virtual nodes"""
+
+    def __init__(self, client_id, on_publish=None):
+        self.client_id = client_id
+        self.on_publish = on_publish
+        self.reader = None
+        self.writer = None
+
+    async def connect(self, host, port, keepalive=60):
+        self.reader, self.writer = await asyncio.open_connection(host, port)
+        body = encode_str("MQTT") + bytes([4, 0x02]) + struct.pack("!H", keepalive)
+        self.writer.write(packet(0x10, body + encode_str(self.client_id)))
+        header, payload = await self._read_packet()
+        if header >> 4 != 2 or payload[1] != 0:
+            raise ConnectionError(f"MQTT connection refused: {payload[1]}")
+        asyncio.ensure_future(self._read_loop())
+        asyncio.ensure_future(self._ping_loop(keepalive / 2))
+
+    def publish(self, topic, payload):
+        self.writer.write(packet(0x30, encode_str(topic) + payload))
+
+    def subscribe(self, topic_filter):
+        body = struct.pack("!H", 1) + encode_str(topic_filter) + b"\x00"
+        self.writer.write(packet(0x82, body))
+
+    async def drain(self):
+        await self.writer.drain()
+
+    async def _read_packet(self):
+        header = (await self.reader.readexactly(1))[0]
+        length, shift = 0, 0
+        while True:
+            byte = (await self.reader.readexactly(1))[0]
+            length |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                break
+        return header, await self.reader.readexactly(length)
+
+    async def _read_loop(self):
+        try:
+            while True:
+                header, body = await self._read_packet()
+                if header >> 4 == 3 and self.on_publish:
+                    (n,) = struct.unpack_from("!H", body)
+                    self.on_publish(body[2 : 2 + n].decode(), body[2 + n :])
+        except (asyncio.IncompleteReadError, ConnectionError) as e:
+            logger.error(f"{self.client_id}: connection lost: {e}")
+
+    async def _ping_loop(self, every):
+        while not self.writer.is_closing():
+            await asyncio.sleep(every)
+            self.writer.write(b"\xc0\x00")
+
+
+# ===== Room model =====
+def format_centi(centi):
+    """Same rendering as appendCenti() on the room node"""
+    sign = "-" if centi < 0 else ""
+    centi = abs(centi)
+    return f"{sign}{centi // 100}.{centi % 100:02d}"
+
+
+def tvoc_aqi(tvoc):
+    """ENS160-style AQI index (1..5) from TVOC"""
+    for aqi, bound in enumerate((65, 220, 660, 2200), start=1):
+        if tvoc < bound:
+            return aqi
+    return 5
+
+
+class VirtualRoom:
+    """Air state of one room, advanced in simulated seconds"""
+
+    def __init__(self, rng, office):
+        self.rng = rng
+        self.office = office  # Occupied by day instead of by night
+        self.capacity = rng.randint(1, 4)
+        self.occupants = 0
+        self.ach = rng.uniform(0.3, 1.0)  # Air changes per hour, windows shut
+        self.window_open = False
+        self.co2 = OUTDOOR_CO2 + rng.uniform(0, 200)
+        self.tvoc_events = 0.0  # Cooking, cleaning... decays away
+        self.temp_offset = rng.uniform(-2, 2)
+
+    def occupied_probability(self, hour):
+        if self.office:
+            return 0.9 if 8 <= hour < 18 else 0.05
+        return 0.9 if hour >= 19 or hour < 7 else 0.3
+
+    def step(self, sim_time, dt):
+        hour = (sim_time / 3600) % 24
+        rng = self.rng
+        # Occupancy is re-drawn about every 15 minutes, windows toggle ~2x/hour
+        if rng.random() < dt / 900:
+            wanted = rng.random() < self.occupied_probability(hour)
+            self.occupants = rng.randint(1, self.capacity) if wanted else 0
+        if rng.random() < dt / 1800:
+            self.window_open = not self.window_open
+        if self.occupants and rng.random() < dt / 7200:
+            self.tvoc_events += rng.uniform(200, 1500)
+
+        # CO2 mass balance with ventilation towards outdoor air
+        ach = self.ach + (4.0 if self.window_open else 0.0)
+        source = self.occupants * CO2_PER_PERSON / ROOM_VOLUME
+        self.co2 += (source - ach * (self.co2 - OUTDOOR_CO2)) * dt / 3600
+        self.tvoc_events *= math.exp(-ach * dt / 3600)
+
+        diurnal = math.sin((hour - 9) / 24 * 2 * math.pi)
+        tvoc = 30 + 0.6 * (self.co2 - OUTDOOR_CO2) + self.tvoc_events
+        tvoc *= rng.uniform(0.95, 1.05)
+        temperature = 26 + 3 * diurnal + 0.4 * self.occupants + self.temp_offset
+        humidity = 60 - 10 * diurnal + 2 * self.occupants - 8 * self.window_open
+        return (
+            int(tvoc),
+            int(temperature * 100 + rng.uniform(-5, 5)),
+            int(max(5, min(95, humidity)) * 100 + rng.uniform(-20, 20)),
+            int(self.co2),
+            tvoc_aqi(tvoc),
+        )
+
+
+def format_payload(device, tvoc, temp_centi, hum_centi, eco2, aqi):
+    """Byte-for-byte formatPayload() of esp32_node_room.cpp"""
+    return (
+        f'{{"device":{device},"tvoc":{tvoc},"temperature":{format_centi(temp_centi)},'
+        f'"humidity":{format_centi(hum_centi)},"eco2":{eco2},"aqi":{aqi}}}'
+    ).encode()
+
+
+# ===== Fleet =====
+class Fleet:
+    """Virtual room nodes sharing a pool of MQTT connections"""
+
+    def __init__(self, args):
+        self.args = args
+        self.rng = random.Random(args.seed)
+        self.published = 0
+        self.received = 0
+        self.latencies = []
+        self.in_flight = {}  # topic -> deque of send times
+        self.outages = 0
+
+    def topic(self, n):
+        return self.args.topic.format(n=n)
+
+    def topic_filter(self):
+        """Wildcard over the fleet: every topic level holding {n} becomes +"""
+        levels = self.args.topic.split("/")
+        return "/".join("+" if "{n}" in level else level for level in levels)
+
+    def on_monitor_publish(self, topic, payload):
+        sent = self.in_flight.get(topic)
+        if sent:
+            self.latencies.append(time.perf_counter() - sent.popleft())
+            self.received += 1
+
+    def phase(self, n):
+        interval = self.args.interval
+        if self.args.phase == "aligned":
+            return 0.0
+        if self.args.phase == "spread":
+            return n * interval / self.args.nodes
+        return self.rng.uniform(0, interval)
+
+    async def node(self, n, conn, start):
+        """One virtual room node"""
+        args = self.args
+        rng = random.Random(self.rng.random())
+        room = VirtualRoom(rng, office=rng.random() < 0.4)
+        topic = self.topic(n)
+        # DEVICE_ID is the last topic level, as on the room node
+        last = topic.rsplit("/", 1)[-1]
+        device = int(last) if last.isdigit() else 0
+        sent = self.in_flight.setdefault(topic, deque(maxlen=100))
+        next_at = start + self.phase(n)
+        outage_until = 0.0
+        while True:
+            await asyncio.sleep(max(0.0, next_at - time.monotonic()))
+            now = time.monotonic()
+            # Simulated clock runs args.speed times faster than real time
+            sim_time = args.start_hour * 3600 + (now - start) * args.speed
+            values = room.step(sim_time, args.interval * args.speed)
+            next_at += args.interval
+            if now < outage_until:
+                continue
+            if rng.random() < args.outage_rate * args.interval / 3600:
+                outage_until = now + args.outage_seconds
+                self.outages += 1
+                continue
+            if args.monitor:
+                sent.append(time.perf_counter())
+            conn.publish(topic, format_payload(device, *values))
+            self.published += 1
+
+    async def report(self):
+        last, last_time = 0, time.monotonic()
+        while True:
+            await asyncio.sleep(self.args.report)
+            now = time.monotonic()
+            rate = (self.published - last) / (now - last_time)
+            last, last_time = self.published, now
+            line = f"Published {self.published} ({rate:.0f} msg/s), outages {self.outages}"
+            if self.latencies:
+                lat = sorted(self.latencies)
+                self.latencies = []
+                p50 = lat[len(lat) // 2] * 1000
+                p99 = lat[min(len(lat) - 1, int(len(lat) * 0.99))] * 1000
+                line += f", latency p50 {p50:.1f} ms p99 {p99:.1f} ms"
+            logger.info(line)
+
+    async def run(self):
+        args = self.args
+        conns = []
+        for i in range(args.connections):
+            conn = MqttConnection(f"fleet-sim-{i}-{random.getrandbits(24):06x}")
+            await conn.connect(args.broker, args.port)
+            conns.append(conn)
+        if args.monitor:
+            monitor = MqttConnection(
+                f"fleet-mon-{random.getrandbits(24):06x}", self.on_monitor_publish
+            )
+            await monitor.connect(args.broker, args.port)
+            monitor.subscribe(self.topic_filter())
+        logger.info(
+            f"Starting {args.nodes} nodes over {args.connections} connections, "
+            f"every {args.interval}s ({args.nodes / args.interval:.0f} msg/s target)"
+        )
+        start = time.monotonic()
+        # Keep references so the tasks are not garbage collected
+        self.tasks = [
+            asyncio.ensure_future(self.node(n, conns[n % len(conns)], start))
+            for n in range(args.nodes)
+        ]
+        self.tasks.append(asyncio.ensure_future(self.report()))
+        while True:
+            # Apply TCP backpressure from the broker
+            await asyncio.gather(*(conn.drain() for conn in conns))
+            await asyncio.sleep(0.05)
+
+
+def main():
+    """Main function to run the simulated fleet"""
+    parser = argparse.ArgumentParser(description="Simulate a fleet of ESP32 room nodes")
+    parser.add_argument("--nodes", type=int, default=1000, help="Virtual room nodes")
+    parser.add_argument("--connections", type=int, default=16, help="MQTT connections shared by the nodes")
+    parser.add_argument("--interval", type=float, default=5.0, help="Seconds between publishes per node")
+    parser.add_argument("--phase", choices=["random", "spread", "aligned"], default="random",
+                        help="Publish phase of the nodes (aligned = all at once)")
+    parser.add_argument("--outage-rate", type=float, default=0.0, help="Outages per node per hour")
+    parser.add_argument("--outage-seconds", type=float, default=60.0, help="Length of one outage")
+    parser.add_argument("--speed", type=float, default=1.0, help="Simulated seconds per real second")
+    parser.add_argument("--start-hour", type=float, default=8.0, help="Simulated hour of day at start")
+    parser.add_argument("--topic", default="sensors/sim/room{n}/1", help="Topic template, {n} = node number")
+    parser.add_argument("--monitor", action="store_true", help="Measure latency through the broker")
+    parser.add_argument("--report", type=float, default=10.0, help="Seconds between reports")
+    parser.add_argument("--seed", type=int, default=None, help="Random seed")
+    parser.add_argument("--broker", default=MQTT_BROKER or "localhost")
+    parser.add_argument("--port", type=int, default=MQTT_PORT)
+    args = parser.parse_args()
+
+    logger.info(f"MQTT Broker: {args.broker}:{args.port}")
+    try:
+        asyncio.run(Fleet(args).run())
+    except KeyboardInterrupt:
+        logger.info("Stopping fleet simulator...")
+    except OSError as e:
+        logger.error(f"Failed to connect to MQTT broker: {e}")
+
+
+if __name__ == "__main__":
+    main()
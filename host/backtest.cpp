@@ -0,0 +1,126 @@
+// Backtest ngưỡng cảnh báo (backtest.py): chạy lại lịch sử của một phòng với
+// nhiều bộ ngưỡng trong một lượt qua các mẫu, gọi qua ctypes. Cùng quy tắc
+// với RuleEngine.evaluate() của rules.py.
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+
+namespace
+{
+  // Order of rules.COLUMNS, then the fan thresholds of backtest.FAN_DEFAULTS
+  enum Bound
+  {
+    TVOC_EXCELLENT,
+    TEMP_MIN = 5,
+    FAN_TVOC = 11,
+    FAN_ECO2,
+    FAN_AQI,
+    BOUNDS
+  };
+
+  const int TVOC_LEVELS = 5;
+  const int TVOC_ALERT_LEVEL = 2; // rules.TVOC_ALERT_LEVEL
+  // rules.ALERTS: the alerting TVOC levels, then high and low of each range
+  const int FIRST_RANGE_ALERT = TVOC_LEVELS - TVOC_ALERT_LEVEL;
+  const int ALERTS = FIRST_RANGE_ALERT + 2 * 3;
+
+  // Per candidate: alerts raised, seconds covered and last time fired of
+  // every alert type
+  struct Tally
+  {
+    uint32_t *count;
+    int64_t *covered;
+    double *last;
+    const double *cooldowns;
+
+    void hit(int alert, double t, int64_t duration)
+    {
+      covered[alert] += duration;
+      if (t - last[alert] > cooldowns[alert])
+      {
+        count[alert]++;
+        last[alert] = t;
+      }
+    }
+  };
+}
+
+extern "C"
+{
+  // times và năm cột (tvoc, nhiệt độ, độ ẩm, eCO2, AQI) có n mẫu, sắp theo
+  // thời gian. bounds: BOUNDS giá trị cho mỗi candidate, cooldowns: số giây
+  // của từng cảnh báo theo rules.ALERTS. Mỗi mẫu được tính tối đa
+  // maxSampleSeconds giây. Ghi số cảnh báo và số giây của từng cảnh báo
+  // (ALERTS giá trị mỗi candidate) và số giây quạt bật; trả về tổng số giây
+  int64_t backtest_replay(const int64_t *times, const double *tvoc, const double *temperature,
+                          const double *humidity, const double *eco2, const double *aqi, uint32_t n,
+                          const double *bounds, uint32_t candidates, const double *cooldowns,
+                          int64_t maxSampleSeconds, uint32_t *alerts, int64_t *seconds,
+                          int64_t *fanSeconds)
+  {
+    const double *ranges[3] = {temperature, humidity, eco2};
+    size_t slots = (size_t)candidates * ALERTS;
+    std::vector<double> lastFired(slots, -INFINITY);
+    std::vector<Tally> tallies(candidates);
+    for (size_t i = 0; i < slots; i++)
+    {
+      alerts[i] = 0;
+      seconds[i] = 0;
+    }
+    for (uint32_t c = 0; c < candidates; c++)
+    {
+      Tally tally = {alerts + c * ALERTS, seconds + c * ALERTS, &lastFired[c * ALERTS], cooldowns};
+      tallies[c] = tally;
+      fanSeconds[c] = 0;
+    }
+
+    // Sample by sample so the columns are read once for every candidate
+    int64_t span = 0;
+    for (uint32_t i = 0; i < n; i++)
+    {
+      int64_t duration = i + 1 < n ? times[i + 1] - times[i] : 0;
+      if (duration > maxSampleSeconds)
+      {
+        duration = maxSampleSeconds;
+      }
+      span += duration;
+      double t = (double)times[i];
+      for (uint32_t c = 0; c < candidates; c++)
+      {
+        const double *bound = bounds + (size_t)c * BOUNDS;
+        Tally &tally = tallies[c];
+        // First level whose upper bound the value is not at least (NaN: 0)
+        int level = TVOC_LEVELS - 1;
+        for (int k = 0; k < TVOC_LEVELS - 1; k++)
+        {
+          if (!(tvoc[i] >= bound[TVOC_EXCELLENT + k]))
+          {
+            level = k;
+            break;
+          }
+        }
+        if (level >= TVOC_ALERT_LEVEL)
+        {
+          tally.hit(level - TVOC_ALERT_LEVEL, t, duration);
+        }
+        for (int r = 0; r < 3; r++)
+        {
+          double value = ranges[r][i];
+          if (value > bound[TEMP_MIN + 2 * r + 1])
+          {
+            tally.hit(FIRST_RANGE_ALERT + 2 * r, t, duration);
+          }
+          else if (!(value >= bound[TEMP_MIN + 2 * r]))
+          {
+            tally.hit(FIRST_RANGE_ALERT + 2 * r + 1, t, duration);
+          }
+        }
+        if (tvoc[i] >= bound[FAN_TVOC] || eco2[i] >= bound[FAN_ECO2] || aqi[i] >= bound[FAN_AQI])
+        {
+          fanSeconds[c] += duration;
+        }
+      }
+    }
+    return span;
+  }
+}
@@ -0,0 +1,79 @@
+// Quyết định của fan node cho bản build host (firmware.py): cùng parse và
+// cùng ngưỡng như esp32_node_fan.cpp, gọi qua ctypes
+#include <math.h>
+#include <stdlib.h>
+
+#include "fan_bank.h"
+#include "fan_control.h"
+
+// Như ArduinoJson của sketch cũ: số thực của một khoá, def nếu thiếu
+static double jsonFloat(const char *json, const char *key, double def)
+{
+  char pattern[24];
+  snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+  const char *p = strstr(json, pattern);
+  return p ? strtod(p + strlen(pattern), nullptr) : def;
+}
+
+extern "C"
+{
+  int fan_count() { return FAN_COUNT; }
+
+  int fan_ventilation_level(int tvoc, int eco2, int aqi)
+  {
+    return ventilationLevel(tvoc, eco2, aqi);
+  }
+
+  // Số quạt cho một bản ghi JSON của luồng dữ liệu, -1 nếu bản ghi không hợp
+  // lệ (fan node bỏ qua nó)
+  int fan_stream_target(const char *json)
+  {
+    Reading r;
+    if (!parseReadingJson(json, r))
+    {
+      return -1;
+    }
+    return fansForLevel(ventilationLevel(r.tvoc, r.eco2, r.aqi));
+  }
+
+  // Số quạt cho một snapshot retained, -1 nếu snapshot không hợp lệ
+  int fan_snapshot_target(const char *csv)
+  {
+    Reading r;
+    if (!parseSnapshot(csv, r))
+    {
+      return -1;
+    }
+    return fansForLevel(ventilationLevel(r.tvoc, r.eco2, r.aqi));
+  }
+
+  // Parse count payload nối nhau bằng '\0': bằng parseReadingJson hoặc qua
+  // double như sketch cũ khi useFloat. Trả về FNV-1a của các Reading
+  uint64_t fan_parse(const char *payloads, uint32_t count, int useFloat)
+  {
+    uint64_t hash = 14695981039346656037ULL;
+    const char *p = payloads;
+    for (uint32_t i = 0; i < count; i++, p += strlen(p) + 1)
+    {
+      Reading r;
+      if (useFloat)
+      {
+        r.tvoc = (int)jsonFloat(p, "tvoc", -1);
+        r.tempCenti = (int)lround(jsonFloat(p, "temperature", -1) * 100);
+        r.humCenti = (int)lround(jsonFloat(p, "humidity", -1) * 100);
+        r.eco2 = (int)jsonFloat(p, "eco2", -1);
+        r.aqi = (int)jsonFloat(p, "aqi", -1);
+      }
+      else if (!parseReadingJson(p, r))
+      {
+        r.tvoc = r.tempCenti = r.humCenti = r.eco2 = r.aqi = -1;
+      }
+      const int fields[] = {r.tvoc, r.tempCenti, r.humCenti, r.eco2, r.aqi};
+      for (int v : fields)
+      {
+        hash = (hash ^ (uint32_t)v) * 1099511628211ULL;
+      }
+    }
+    return hash;
+  }
+}
@@ -0,0 +1,332 @@
+// Codec Gorilla của kho lịch sử (tsstore.py): timestamp delta-of-delta và
+// số thực XOR với giá trị trước, thành dòng bit MSB trước, gọi qua ctypes.
+// Cột timestamp và từng cột giá trị là các dòng riêng (block file bản 3);
+// gorilla_decode_block đọc dòng xen kẽ của archive bản 1 và 2.
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace
+{
+  // (control, control bits, value bits) of the delta-of-delta buckets
+  const int DOD_BUCKETS[3][3] = {{0x2, 2, 7}, {0x6, 3, 9}, {0xE, 4, 12}};
+
+  class BitWriter
+  {
+  public:
+    BitWriter(uint8_t *out, size_t size) : out(out), size(size), bytes(0), acc(0), nbits(0), overflow(false) {}
+
+    // The low width bits of value, up to a byte at a time
+    void write(uint64_t value, int width)
+    {
+      while (width > 0)
+      {
+        int take = width < 8 - nbits ? width : 8 - nbits;
+        width -= take;
+        acc = acc << take | (unsigned)((value >> width) & ((1u << take) - 1));
+        nbits += take;
+        if (nbits == 8)
+        {
+          flush();
+        }
+      }
+    }
+
+    // Bytes written once the last one is padded with zeros, 0 on overflow
+    size_t finish()
+    {
+      if (nbits)
+      {
+        acc <<= 8 - nbits;
+        flush();
+      }
+      return overflow ? 0 : bytes;
+    }
+
+  private:
+    void flush()
+    {
+      if (bytes < size)
+      {
+        out[bytes++] = (uint8_t)acc;
+      }
+      else
+      {
+        overflow = true;
+      }
+      acc = 0;
+      nbits = 0;
+    }
+
+    uint8_t *out;
+    size_t size, bytes;
+    unsigned acc;
+    int nbits;
+    bool overflow;
+  };
+
+  class BitReader
+  {
+  public:
+    BitReader(const uint8_t *data, size_t length) : data(data), bits(length * 8), pos(0) {}
+
+    // false once a read runs past the end, the value is then 0
+    bool read(int width, uint64_t &value)
+    {
+      value = 0;
+      if (pos + width > bits)
+      {
+        fail();
+        return false;
+      }
+      while (width > 0)
+      {
+        int offset = pos & 7, take = width < 8 - offset ? width : 8 - offset;
+        value = value << take | ((data[pos >> 3] >> (8 - offset - take)) & ((1u << take) - 1));
+        pos += take;
+        width -= take;
+      }
+      return true;
+    }
+
+    void fail() { pos = bits + 1; }
+
+    bool ok() const { return pos <= bits; }
+
+  private:
+    const uint8_t *data;
+    size_t bits, pos;
+  };
+
+  int64_t toSigned(uint64_t value, int width)
+  {
+    return width < 64 && value >> (width - 1) ? (int64_t)(value - (1ULL << width)) : (int64_t)value;
+  }
+
+  uint64_t floatBits(double value)
+  {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+  }
+
+  double bitsFloat(uint64_t bits)
+  {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  void putDod(BitWriter &w, int64_t dod)
+  {
+    if (dod == 0)
+    {
+      w.write(0, 1);
+      return;
+    }
+    for (const int *bucket : DOD_BUCKETS)
+    {
+      if (dod >= -(1LL << (bucket[2] - 1)) && dod < (1LL << (bucket[2] - 1)))
+      {
+        w.write(bucket[0], bucket[1]);
+        w.write((uint64_t)dod, bucket[2]);
+        return;
+      }
+    }
+    w.write(0xF, 4);
+    w.write((uint64_t)dod, 64);
+  }
+
+  int64_t getDod(BitReader &r)
+  {
+    uint64_t bit, value;
+    r.read(1, bit);
+    if (!bit)
+    {
+      return 0;
+    }
+    for (const int *bucket : DOD_BUCKETS)
+    {
+      r.read(1, bit);
+      if (!bit)
+      {
+        r.read(bucket[2], value);
+        return toSigned(value, bucket[2]);
+      }
+    }
+    r.read(64, value);
+    return (int64_t)value;
+  }
+
+  // Window of meaningful bits of the last XOR sent with its own header;
+  // the writer starts without one (lead -1), a reader from lead 0
+  struct XorWindow
+  {
+    int lead;
+    int trail;
+  };
+
+  void putXor(BitWriter &w, XorWindow &window, uint64_t x)
+  {
+    if (x == 0)
+    {
+      w.write(0, 1);
+      return;
+    }
+    int leading = __builtin_clzll(x), trailing = __builtin_ctzll(x);
+    if (leading > 31)
+    {
+      leading = 31;
+    }
+    if (window.lead >= 0 && leading >= window.lead && trailing >= window.trail)
+    {
+      w.write(0x2, 2);
+      w.write(x >> window.trail, 64 - window.lead - window.trail);
+      return;
+    }
+    int significant = 64 - leading - trailing;
+    w.write(0x3, 2);
+    w.write(leading, 5);
+    w.write(significant - 1, 6);
+    w.write(x >> trailing, significant);
+    window.lead = leading;
+    window.trail = trailing;
+  }
+
+  uint64_t getXor(BitReader &r, XorWindow &window)
+  {
+    uint64_t bit, value;
+    r.read(1, bit);
+    if (!bit)
+    {
+      return 0;
+    }
+    r.read(1, bit);
+    if (bit)
+    {
+      uint64_t lead, significant;
+      r.read(5, lead);
+      r.read(6, significant);
+      window.lead = (int)lead;
+      window.trail = 64 - (int)lead - (int)significant - 1;
+      if (window.trail < 0)
+      {
+        window.trail = 0;
+        r.fail();
+        return 0;
+      }
+    }
+    r.read(64 - window.lead - window.trail, value);
+    return value << window.trail;
+  }
+}
+
+extern "C"
+{
+  // Cột timestamp tăng dần: timestamp đầu 64 bit rồi delta-of-delta. Trả về
+  // số byte ghi vào out, 0 nếu không đủ size
+  size_t gorilla_encode_times(const int64_t *times, uint32_t count, uint8_t *out, size_t size)
+  {
+    BitWriter w(out, size);
+    if (count)
+    {
+      w.write((uint64_t)times[0], 64);
+    }
+    int64_t delta = 0;
+    for (uint32_t i = 1; i < count; i++)
+    {
+      int64_t next = times[i] - times[i - 1];
+      putDod(w, next - delta);
+      delta = next;
+    }
+    return w.finish();
+  }
+
+  // Ngược lại của gorilla_encode_times: count timestamp vào out[i * stride].
+  // 0, hoặc -1 nếu dữ liệu ngắn hơn count giá trị
+  int gorilla_decode_times(const uint8_t *data, size_t length, uint32_t count, int64_t *out, size_t stride)
+  {
+    BitReader r(data, length);
+    uint64_t first;
+    if (count && !r.read(64, first))
+    {
+      return -1;
+    }
+    int64_t t = (int64_t)first, delta = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+      if (i)
+      {
+        delta += getDod(r);
+        t += delta;
+      }
+      out[i * stride] = t;
+    }
+    return r.ok() ? 0 : -1;
+  }
+
+  // Cột số thực: giá trị đầu 64 bit rồi XOR với giá trị trước
+  size_t gorilla_encode_values(const double *values, uint32_t count, uint8_t *out, size_t size)
+  {
+    BitWriter w(out, size);
+    XorWindow window = {-1, 0};
+    uint64_t prev = count ? floatBits(values[0]) : 0;
+    if (count)
+    {
+      w.write(prev, 64);
+    }
+    for (uint32_t i = 1; i < count; i++)
+    {
+      uint64_t bits = floatBits(values[i]);
+      putXor(w, window, bits ^ prev);
+      prev = bits;
+    }
+    return w.finish();
+  }
+
+  int gorilla_decode_values(const uint8_t *data, size_t length, uint32_t count, double *out, size_t stride)
+  {
+    BitReader r(data, length);
+    XorWindow window = {0, 0};
+    uint64_t bits;
+    if (count && !r.read(64, bits))
+    {
+      return -1;
+    }
+    for (uint32_t i = 0; i < count; i++)
+    {
+      if (i)
+      {
+        bits ^= getXor(r, window);
+      }
+      out[i * stride] = bitsFloat(bits);
+    }
+    return r.ok() ? 0 : -1;
+  }
+
+  // Block một metric của archive bản 1 và 2: timestamp và giá trị xen kẽ
+  // trong một dòng (64 bit mỗi thứ, rồi từng cặp delta-of-delta, XOR)
+  int gorilla_decode_block(const uint8_t *data, size_t length, uint32_t count, int64_t *times, double *values)
+  {
+    BitReader r(data, length);
+    uint64_t first, bits;
+    if (count && (!r.read(64, first) || !r.read(64, bits)))
+    {
+      return -1;
+    }
+    XorWindow window = {0, 0};
+    int64_t t = (int64_t)first, delta = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+      if (i)
+      {
+        delta += getDod(r);
+        t += delta;
+        bits ^= getXor(r, window);
+      }
+      times[i] = t;
+      values[i] = bitsFloat(bits);
+    }
+    return r.ok() ? 0 : -1;
+  }
+}
@@ -0,0 +1,373 @@
+// Bus I2C giả lập với mô hình ENS160 và AHT21 ở mức thanh ghi, đồng hồ ảo:
+// room_sensors.h chạy trên máy host với thời gian chuyển đổi, cờ data-ready,
+// lỗi bus tiêm vào và kịch bản khí/nhiệt độ/độ ẩm theo thời gian.
+// Dùng bởi test/test_room_sensors và host/room_node.cpp (bench.py).
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <map>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "room_sensors.h"
+
+// Giá trị tuyến tính từng đoạn theo thời gian (ms, tăng dần), giữ nguyên
+// ngoài hai đầu
+class Profile
+{
+public:
+  Profile(double value = 0) { points.push_back(std::make_pair(0ULL, value)); }
+
+  Profile &at(uint64_t ms, double value)
+  {
+    if (ms == 0)
+    {
+      points[0].second = value;
+    }
+    else
+    {
+      points.push_back(std::make_pair(ms, value));
+    }
+    return *this;
+  }
+
+  double value(uint64_t ms) const
+  {
+    if (ms <= points.front().first)
+    {
+      return points.front().second;
+    }
+    for (size_t i = 1; i < points.size(); i++)
+    {
+      if (ms < points[i].first)
+      {
+        const std::pair<uint64_t, double> &a = points[i - 1], &b = points[i];
+        return a.second + (b.second - a.second) * (double)(ms - a.first) / (double)(b.first - a.first);
+      }
+    }
+    return points.back().second;
+  }
+
+private:
+  std::vector<std::pair<uint64_t, double> > points;
+};
+
+// Một thiết bị trên bus: false = NACK
+class I2cDevice
+{
+public:
+  virtual ~I2cDevice() {}
+  virtual bool write(uint64_t nowUs, const uint8_t *data, size_t len) = 0;
+  virtual bool read(uint64_t nowUs, uint8_t *data, size_t len) = 0;
+};
+
+class EmulatedBus : public I2cBus
+{
+public:
+  explicit EmulatedBus(uint32_t clockHz = 100000) : clockHz(clockHz), rng(1) {}
+
+  void attach(uint8_t addr, I2cDevice *device) { devices[addr] = device; }
+  void detach(uint8_t addr) { devices.erase(addr); }
+
+  // The next count transactions to addr are not acknowledged
+  void failNext(uint8_t addr, unsigned count) { forcedNacks[addr] = count; }
+
+  // Random faults per transaction: NACK, or one flipped bit in read data
+  void setErrorRates(double nack, double corrupt, uint32_t seed)
+  {
+    nackRate = nack;
+    corruptRate = corrupt;
+    rng.seed(seed);
+  }
+
+  bool write(uint8_t addr, const uint8_t *data, size_t len) override
+  {
+    I2cDevice *device = begin(addr, len);
+    if (device == nullptr || !device->write(nowUs, data, len))
+    {
+      nacks++;
+      return false;
+    }
+    return true;
+  }
+
+  bool read(uint8_t addr, uint8_t *data, size_t len) override
+  {
+    I2cDevice *device = begin(addr, len);
+    if (device == nullptr || !device->read(nowUs, data, len))
+    {
+      nacks++;
+      return false;
+    }
+    if (len > 0 && corruptRate > 0 && uniform(rng) < corruptRate)
+    {
+      data[rng() % len] ^= (uint8_t)(1 << (rng() % 8));
+      corrupted++;
+    }
+    return true;
+  }
+
+  void delayMs(uint32_t ms) override { nowUs += (uint64_t)ms * 1000; }
+  uint32_t micros() override { return (uint32_t)nowUs; }
+
+  uint64_t nowUs = 0;      // Virtual clock
+  uint64_t busUs = 0;      // Time the bus was busy
+  uint64_t transactions = 0;
+  uint64_t nacks = 0;
+  uint64_t corrupted = 0;
+
+private:
+  // Start, address byte and len data bytes (9 clocks each), stop
+  I2cDevice *begin(uint8_t addr, size_t len)
+  {
+    uint64_t us = ((len + 1) * 9 + 2) * 1000000ULL / clockHz;
+    nowUs += us;
+    busUs += us;
+    transactions++;
+    std::map<uint8_t, unsigned>::iterator forced = forcedNacks.find(addr);
+    if (forced != forcedNacks.end() && forced->second > 0)
+    {
+      forced->second--;
+      return nullptr;
+    }
+    if (nackRate > 0 && uniform(rng) < nackRate)
+    {
+      return nullptr;
+    }
+    std::map<uint8_t, I2cDevice *>::iterator it = devices.find(addr);
+    return it == devices.end() ? nullptr : it->second;
+  }
+
+  uint32_t clockHz;
+  std::map<uint8_t, I2cDevice *> devices;
+  std::map<uint8_t, unsigned> forcedNacks;
+  double nackRate = 0;
+  double corruptRate = 0;
+  std::mt19937 rng;
+  std::uniform_real_distribution<double> uniform;
+};
+
+// ENS160: PART_ID, OPMODE, TEMP_IN/RH_IN, DATA_STATUS/AQI/TVOC/ECO2. Ở chế độ
+// standard một mẫu mới sau mỗi conversionMs; NEWDAT tự xoá khi đọc DATA_x.
+class Ens160Model : public I2cDevice
+{
+public:
+  Profile tvoc = Profile(100);
+  Profile eco2 = Profile(450);
+  Profile aqi = Profile(1);
+  uint32_t conversionMs = 1000;
+  uint32_t warmupMs = 180000;  // Validity flag 1 after entering standard mode
+  uint32_t resetMs = 2;        // NACKs everything while resetting
+  uint16_t partId = ENS160_PART_ID;
+  bool invalidOutput = false;  // Report validity flag 3
+
+  uint16_t tempIn = 0; // Last compensation written, K x64
+  uint16_t rhIn = 0;   // %RH x512
+
+  bool write(uint64_t nowUs, const uint8_t *data, size_t len) override
+  {
+    if (nowUs < busyUntilUs || len == 0)
+    {
+      return false;
+    }
+    update(nowUs);
+    pointer = data[0];
+    for (size_t i = 1; i < len; i++, pointer++)
+    {
+      writeReg(nowUs, pointer, data[i]);
+    }
+    return true;
+  }
+
+  bool read(uint64_t nowUs, uint8_t *data, size_t len) override
+  {
+    if (nowUs < busyUntilUs)
+    {
+      return false;
+    }
+    update(nowUs);
+    for (size_t i = 0; i < len; i++, pointer++)
+    {
+      data[i] = readReg(pointer);
+    }
+    return true;
+  }
+
+private:
+  void writeReg(uint64_t nowUs, uint8_t reg, uint8_t value)
+  {
+    switch (reg)
+    {
+    case ENS160_REG_OPMODE:
+      if (value == ENS160_OPMODE_RESET)
+      {
+        opmode = 0;
+        newData = false;
+        dataValid = false;
+        busyUntilUs = nowUs + resetMs * 1000ULL;
+      }
+      else
+      {
+        opmode = value;
+        standardSinceUs = nowUs;
+        nextSampleUs = nowUs + conversionMs * 1000ULL;
+      }
+      break;
+    case ENS160_REG_TEMP_IN:
+      tempIn = (tempIn & 0xFF00) | value;
+      break;
+    case ENS160_REG_TEMP_IN + 1:
+      tempIn = (tempIn & 0x00FF) | value << 8;
+      break;
+    case ENS160_REG_TEMP_IN + 2:
+      rhIn = (rhIn & 0xFF00) | value;
+      break;
+    case ENS160_REG_TEMP_IN + 3:
+      rhIn = (rhIn & 0x00FF) | value << 8;
+      break;
+    }
+  }
+
+  uint8_t readReg(uint8_t reg)
+  {
+    switch (reg)
+    {
+    case ENS160_REG_PART_ID:
+      return (uint8_t)partId;
+    case ENS160_REG_PART_ID + 1:
+      return (uint8_t)(partId >> 8);
+    case ENS160_REG_OPMODE:
+      return opmode;
+    case ENS160_REG_STATUS:
+    {
+      uint8_t validity = invalidOutput ? ENS160_INVALID_OUTPUT : (warming ? 1 : 0);
+      return (opmode == ENS160_OPMODE_STANDARD ? 0x80 : 0) | validity << 2 |
+             (newData ? ENS160_STATUS_NEWDAT : 0);
+    }
+    case ENS160_REG_STATUS + 1:
+    case ENS160_REG_STATUS + 2:
+    case ENS160_REG_STATUS + 3:
+    case ENS160_REG_STATUS + 4:
+    case ENS160_REG_STATUS + 5:
+      newData = false;
+      return dataValid ? data[reg - ENS160_REG_STATUS - 1] : 0;
+    }
+    return 0;
+  }
+
+  // Conversions completed up to nowUs
+  void update(uint64_t nowUs)
+  {
+    if (opmode != ENS160_OPMODE_STANDARD || nowUs < nextSampleUs)
+    {
+      return;
+    }
+    uint64_t sampleUs = nextSampleUs + (nowUs - nextSampleUs) / (conversionMs * 1000ULL) * conversionMs * 1000ULL;
+    nextSampleUs = sampleUs + conversionMs * 1000ULL;
+    uint64_t ms = sampleUs / 1000;
+    uint16_t t = (uint16_t)(tvoc.value(ms) + 0.5);
+    uint16_t e = (uint16_t)(eco2.value(ms) + 0.5);
+    data[0] = (uint8_t)(aqi.value(ms) + 0.5) & 0x07;
+    data[1] = (uint8_t)t;
+    data[2] = (uint8_t)(t >> 8);
+    data[3] = (uint8_t)e;
+    data[4] = (uint8_t)(e >> 8);
+    warming = sampleUs - standardSinceUs < warmupMs * 1000ULL;
+    newData = true;
+    dataValid = true;
+  }
+
+  uint8_t pointer = 0;
+  uint8_t opmode = 0; // Deep sleep after power-on
+  uint8_t data[5] = {0};
+  bool newData = false;
+  bool dataValid = false;
+  bool warming = true;
+  uint64_t busyUntilUs = 0;
+  uint64_t standardSinceUs = 0;
+  uint64_t nextSampleUs = 0;
+};
+
+// AHT21: soft reset, init/calibration, trigger; status + 20-bit RH + 20-bit T
+// + CRC-8. Busy trong conversionMs sau mỗi lệnh đo.
+class Aht21Model : public I2cDevice
+{
+public:
+  Profile temperature = Profile(25.0); // °C
+  Profile humidity = Profile(50.0);    // %RH
+  uint32_t conversionMs = 80;
+  uint32_t resetMs = 20;      // NACKs everything while resetting
+  bool calibrated = true;     // Calibration bit after reset
+  bool stuckBusy = false;     // Never finishes a measurement
+
+  bool write(uint64_t nowUs, const uint8_t *data, size_t len) override
+  {
+    if (nowUs < resetUntilUs || len == 0)
+    {
+      return false;
+    }
+    switch (data[0])
+    {
+    case AHT21_CMD_RESET:
+      cal = calibrated;
+      resetUntilUs = nowUs + resetMs * 1000ULL;
+      break;
+    case AHT21_CMD_INIT:
+      cal = true;
+      break;
+    case AHT21_CMD_TRIGGER:
+      if (len != 3 || data[1] != 0x33 || data[2] != 0x00)
+      {
+        return false;
+      }
+      readyAtUs = nowUs + conversionMs * 1000ULL;
+      measuring = true;
+      break;
+    default:
+      return false;
+    }
+    return true;
+  }
+
+  bool read(uint64_t nowUs, uint8_t *out, size_t len) override
+  {
+    if (nowUs < resetUntilUs)
+    {
+      return false;
+    }
+    if (measuring && nowUs >= readyAtUs && !stuckBusy)
+    {
+      measuring = false;
+      convert(readyAtUs / 1000);
+    }
+    frame[0] = (measuring ? AHT21_STATUS_BUSY : 0) | (cal ? AHT21_STATUS_CALIBRATED : 0) | 0x10;
+    frame[6] = aht21Crc(frame, 6);
+    memcpy(out, frame, len < sizeof(frame) ? len : sizeof(frame));
+    return true;
+  }
+
+private:
+  void convert(uint64_t ms)
+  {
+    double rh = humidity.value(ms), t = temperature.value(ms);
+    rh = rh < 0 ? 0 : (rh > 100 ? 100 : rh);
+    uint32_t h = (uint32_t)(rh / 100.0 * (1 << 20) + 0.5);
+    uint32_t c = (uint32_t)((t + 50.0) / 200.0 * (1 << 20) + 0.5);
+    h = h > 0xFFFFF ? 0xFFFFF : h;
+    c = c > 0xFFFFF ? 0xFFFFF : c;
+    frame[1] = (uint8_t)(h >> 12);
+    frame[2] = (uint8_t)(h >> 4);
+    frame[3] = (uint8_t)((h & 0x0F) << 4 | c >> 16);
+    frame[4] = (uint8_t)(c >> 8);
+    frame[5] = (uint8_t)c;
+  }
+
+  uint8_t frame[7] = {0};
+  bool cal = true;
+  bool measuring = false;
+  uint64_t readyAtUs = 0;
+  uint64_t resetUntilUs = 0;
+};
@@ -0,0 +1,121 @@
+// Đường thu thập dữ liệu của room node (room_sensors.h) trên bus I2C giả lập,
+// cho bản build host (firmware.py, bench.py acquisition, fixed_point), gọi qua ctypes
+#include <stdio.h>
+
+#include "room_sensors.h"
+#include "host/i2c_emulator.h"
+
+extern "C"
+{
+  struct AcquisitionStats
+  {
+    uint64_t slots;
+    uint64_t samples;        // Slots that published
+    uint64_t reinits;        // Recoveries after SENSOR_MAX_FAILURES
+    uint64_t reinitFailures; // Recoveries where a sensor did not come back
+    uint64_t transactions;
+    uint64_t nacks;
+    uint64_t corrupted;
+    uint64_t busUs;          // Virtual time the bus was busy
+  };
+
+  // Chạy setup() và slots lần đọc của loop() cách nhau intervalMs trên đồng
+  // hồ ảo; acquisitionUs[i] và ok[i] là kết quả của slot i
+  int room_acquisition(uint32_t slots, uint32_t intervalMs, uint32_t clockHz,
+                       double nackRate, double corruptRate, uint32_t seed,
+                       uint32_t *acquisitionUs, uint8_t *ok, AcquisitionStats *stats)
+  {
+    EmulatedBus bus(clockHz);
+    Ens160Model ens;
+    Aht21Model aht;
+    // Một ngày có người ở: khí tăng lên buổi tối, nhiệt độ/độ ẩm dao động
+    uint64_t day = 86400000ULL;
+    ens.tvoc.at(0, 80).at(day / 3, 250).at(day * 3 / 4, 900).at(day, 120);
+    ens.eco2.at(0, 420).at(day / 3, 700).at(day * 3 / 4, 1400).at(day, 500);
+    ens.aqi.at(0, 1).at(day / 3, 2).at(day * 3 / 4, 4).at(day, 1);
+    aht.temperature.at(0, 21.5).at(day / 2, 27.25).at(day, 22.0);
+    aht.humidity.at(0, 62.0).at(day / 2, 44.5).at(day, 58.0);
+    bus.attach(ENS160_ADDR, &ens);
+    bus.attach(AHT21_ADDR, &aht);
+
+    RoomSensors sensors;
+    sensorsInit(sensors, bus);
+    if (!sensorsBeginAht21(sensors) || !sensorsBeginEns160(sensors))
+    {
+      return -1;
+    }
+    bus.setErrorRates(nackRate, corruptRate, seed);
+
+    AcquisitionStats s = {};
+    uint64_t next = bus.nowUs + intervalMs * 1000ULL;
+    for (uint32_t i = 0; i < slots; i++, next += intervalMs * 1000ULL)
+    {
+      if (bus.nowUs < next)
+      {
+        bus.nowUs = next;
+      }
+      Sample sample;
+      ok[i] = readSample(sensors, sample);
+      acquisitionUs[i] = sensors.acquisitionUs;
+      bool ahtOk, ensOk;
+      if (ok[i])
+      {
+        s.samples++;
+      }
+      else if (sensorFailure(sensors, ahtOk, ensOk))
+      {
+        s.reinits++;
+        s.reinitFailures += !(ahtOk && ensOk);
+      }
+    }
+    s.slots = slots;
+    s.transactions = bus.transactions;
+    s.nacks = bus.nacks;
+    s.corrupted = bus.corrupted;
+    s.busUs = bus.busUs;
+    *stats = s;
+    return 0;
+  }
+
+  // Đổi samples bộ giá trị thô ngẫu nhiên (seed) của AHT21 (-40..85 °C) và
+  // ENS160 thành payload JSON nối nhau bằng '\0' trong out: bằng số nguyên
+  // (aht21Centi, formatPayload) hoặc như sketch cũ khi useFloat (float như
+  // Adafruit_AHTX0, "%.2f" như String(float)). Trả về số byte đã ghi
+  size_t room_format(uint32_t samples, uint32_t seed, int useFloat, char *out, size_t size)
+  {
+    uint32_t x = seed ? seed : 1;
+    char *p = out;
+    for (uint32_t i = 0; i < samples && size - (p - out) >= 128; i++)
+    {
+      uint32_t r[4];
+      for (int k = 0; k < 4; k++)
+      {
+        x ^= x << 13; // xorshift32
+        x ^= x >> 17;
+        x ^= x << 5;
+        r[k] = x;
+      }
+      uint32_t hum = r[0] >> 12, temp = 52429 + r[1] % 655361;
+      uint16_t tvoc = r[2] % 65001, eco2 = 400 + r[3] % 64601;
+      uint8_t aqi = 1 + (r[2] >> 20) % 5;
+      if (useFloat)
+      {
+        float h = ((float)hum * 100) / 0x100000;
+        float t = ((float)temp * 200 / 0x100000) - 50;
+        p += snprintf(p, 128,
+                      "{\"device\":" STR(DEVICE_ID) ",\"tvoc\":%u,\"temperature\":%.2f,"
+                      "\"humidity\":%.2f,\"eco2\":%u,\"aqi\":%u}",
+                      tvoc, t, h, eco2, aqi);
+      }
+      else
+      {
+        int32_t tempCenti, humCenti;
+        aht21Centi(hum, temp, tempCenti, humCenti);
+        Sample s = {0, aqi, tvoc, eco2, (int16_t)tempCenti, (uint16_t)humCenti};
+        p += formatPayload(s, p);
+      }
+      *p++ = '\0';
+    }
+    return p - out;
+  }
+}
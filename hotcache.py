@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+In-memory hot window of recent samples per room.
+
+Every room has a single writer, the ingest shard that owns it. The latest
+reading is published RCU style: the writer builds a new dict and swaps the
+reference, and a published dict is never modified, so readers hold a
+consistent copy without locking. Recent samples live in a fixed-size ring guarded by a sequence
+counter (seqlock): the writer makes it odd while writing a slot, and readers
+copy the ring and retry if the counter moved.
+"""
+
+import time
+from datetime import datetime
+
+
+class Ring:
+    """Fixed-size ring of (timestamp, tvoc, temperature, humidity, eco2, aqi) rows"""
+
+    def __init__(self, capacity):
+        self.capacity = capacity
+        self.rows = [None] * capacity
+        self.count = 0  # Rows ever appended
+        self.seq = 0  # Odd while a write is in progress
+
+    def append(self, row):
+        self.seq += 1
+        self.rows[self.count % self.capacity] = row
+        self.count += 1
+        self.seq += 1
+
+    def snapshot(self):
+        """Consistent copy of the retained rows, oldest first"""
+        while True:
+            seq = self.seq
+            if seq & 1:
+                time.sleep(0)  # Writer is mid-update, let it finish
+                continue
+            count = self.count
+            rows = self.rows[:]
+            if self.seq == seq:
+                break
+        if count <= self.capacity:
+            return rows[:count]
+        split = count % self.capacity
+        return rows[split:] + rows[:split]
+
+
+class HotWindow:
+    """Latest reading and a ring of recent rows for every room, indexed by room id"""
+
+    def __init__(self, capacity):
+        self.capacity = capacity
+        self.rings = []
+        self.published = []
+
+    def add_room(self, room_id):
+        """Size the window for a new room; ids are handed out densely"""
+        if room_id != len(self.rings):
+            raise ValueError(f"Room id {room_id} is not the next id")
+        self.published.append(
+            {
+                "tvoc": 0,
+                "temperature": 0,
+                "humidity": 0,
+                "eco2": 0,
+                "aqi": 1,
+                "timestamp": datetime.now(),
+            }
+        )
+        self.rings.append(Ring(self.capacity))
+
+    def publish(self, room_id, reading):
+        """Replace the latest reading; the dict must not be modified afterwards"""
+        self.published[room_id] = reading
+
+    def latest(self, room_id):
+        return self.published[room_id]
+
+    def append(self, room_id, row):
+        self.rings[room_id].append(row)
+
+    def query(self, room_id, start, end):
+        """
+        Rows (timestamp, tvoc, temperature, humidity, eco2, aqi) in [start, end],
+        or None when the window does not reach back to start
+        """
+        rows = self.rings[room_id].snapshot()
+        if not rows or rows[0][0] > start:
+            return None
+        return [row for row in rows if start <= row[0] <= end]
+
+    def tail(self, room_id, start, end, count):
+        """
+        The newest count rows in [start, end], or None when the window holds
+        fewer and does not reach back to start
+        """
+        rows = self.rings[room_id].snapshot()
+        rows = [row for row in rows if start <= row[0] <= end]
+        if len(rows) < count and (not rows or rows[0][0] > start):
+            return None
+        return rows[-count:]
+
+    def stats(self):
+        return {"rooms": len(self.rings), "rows": sum(r.count for r in self.rings)}
@@ -0,0 +1,300 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+MQTT Trace Recorder / Replayer for the TVOC Monitoring Server
+record: subscribes to the sensor topics and appends every message with its
+        receive timestamp to a compact binary trace file
+replay: re-injects a trace into a broker, the server's ingest path or the
+        fan-node decision logic at original speed, N times faster or as fast
+        as possible, keeping the recorded inter-arrival times
+info:   summarizes a trace
+
+Trace format: an 8-byte magic followed by records of
+<float64 receive time, uint16 topic id, uint8 flags, uint16 length> and
+length bytes. A record with FLAG_TOPIC defines the topic name of its id, so
+each topic string is stored once. A torn record at the end of the file (the
+recorder was killed mid-write) is ignored by readers and cut off when the
+recorder appends to the file again.
+"""
+
+import argparse
+import json
+import logging
+import struct
+import time
+
+import paho.mqtt.client as mqtt
+
+from config import MQTT_BROKER, MQTT_PORT
+
+# Configure logging
+logging.basicConfig(level=logging.INFO)
+logger = logging.getLogger(__name__)
+
+MAGIC = b"AQTRACE1"
+RECORD = struct.Struct("<dHBH")
+FLAG_TOPIC = 0x01  # Payload is the topic name for this id
+FLAG_RETAIN = 0x02  # Message was delivered as retained
+
+
+def read_records(f):
+    """Yield (end offset, receive time, topic id, flags, payload) of every
+    complete record, f positioned after the magic"""
+    end = f.tell()
+    while True:
+        header = f.read(RECORD.size)
+        if len(header) < RECORD.size:
+            return
+        t, topic_id, flags, length = RECORD.unpack(header)
+        payload = f.read(length)
+        if len(payload) < length:
+            return  # Torn final record
+        end += RECORD.size + length
+        yield end, t, topic_id, flags, payload
+
+
+class TraceWriter:
+    """Append-only trace file
+
+    Reopening an existing trace cuts a torn final record off before
+    appending, so it cannot swallow the first new record, and keeps the
+    topic ids already defined in the file.
+    """
+
+    def __init__(self, path):
+        self.file = open(path, "a+b")
+        self.topics = {}
+        self.file.seek(0)
+        magic = self.file.read(len(MAGIC))
+        if len(magic) < len(MAGIC) and MAGIC.startswith(magic):
+            end = 0  # Empty, or killed while writing the magic
+        elif magic != MAGIC:
+            self.file.close()
+            raise ValueError(f"{path} is not a trace file")
+        else:
+            end = len(MAGIC)
+            for end, _, topic_id, flags, payload in read_records(self.file):
+                if flags & FLAG_TOPIC:
+                    self.topics[payload.decode()] = topic_id
+        self.file.truncate(end)
+        if end == 0:
+            self.file.write(MAGIC)
+
+    def write(self, t, topic, payload, retain=False):
+        topic_id = self.topics.get(topic)
+        if topic_id is None:
+            topic_id = self.topics[topic] = len(self.topics)
+            name = topic.encode()
+            self.file.write(RECORD.pack(t, topic_id, FLAG_TOPIC, len(name)) + name)
+        flags = FLAG_RETAIN if retain else 0
+        self.file.write(RECORD.pack(t, topic_id, flags, len(payload)) + payload)
+
+    def flush(self):
+        self.file.flush()
+
+    def close(self):
+        self.file.close()
+
+
+def read_trace(path):
+    """Yield (receive time, topic, payload, retained) from a trace file"""
+    topics = {}
+    with open(path, "rb") as f:
+        if f.read(len(MAGIC)) != MAGIC:
+            raise ValueError(f"{path} is not a trace file")
+        for _, t, topic_id, flags, payload in read_records(f):
+            if flags & FLAG_TOPIC:
+                topics[topic_id] = payload.decode()
+            else:
+                yield t, topics[topic_id], payload, bool(flags & FLAG_RETAIN)
+
+
+# ===== record =====
+def record(args):
+    writer = TraceWriter(args.trace)
+    count = 0
+
+    def on_connect(client, userdata, flags, rc):
+        if rc == 0:
+            logger.info(f"MQTT connection successful, recording {args.topic}")
+            client.subscribe(args.topic)
+        else:
+            logger.error(f"MQTT connection failed: {rc}")
+
+    def on_message(client, userdata, msg):
+        nonlocal count
+        writer.write(time.time(), msg.topic, msg.payload, msg.retain)
+        count += 1
+
+    client = mqtt.Client()
+    client.on_connect = on_connect
+    client.on_message = on_message
+    client.connect(args.broker, args.port, 60)
+    client.loop_start()
+    try:
+        while True:
+            time.sleep(1)
+            writer.flush()  # Lose at most about a second on a crash
+    except KeyboardInterrupt:
+        logger.info(f"Recorded {count} messages to {args.trace}")
+    finally:
+        client.loop_stop()
+        client.disconnect()
+        writer.close()
+
+
+# ===== replay targets =====
+class Message:
+    """The parts of a paho MQTTMessage the callbacks use"""
+
+    def __init__(self, topic, payload, retain):
+        self.topic = topic
+        self.payload = payload
+        self.retain = retain
+
+
+class NullClient:
+    def subscribe(self, *args, **kwargs):
+        pass
+
+    def unsubscribe(self, *args, **kwargs):
+        pass
+
+
+def broker_target(args):
+    client = mqtt.Client()
+    client.connect(args.broker, args.port, 60)
+    client.loop_start()
+
+    def deliver(topic, payload, retain):
+        client.publish(topic, payload, retain=retain)
+
+    return deliver
+
+
+def ingest_target(args):
+    """server3.on_message and its shard's work inline, other stages stubbed out"""
+    logging.getLogger("server3").setLevel(logging.WARNING)
+    import server3
+
+    for stage in (server3.storage_stage, server3.history_stage, server3.push_stage):
+        stage.put = lambda sample: None
+    server3.ingest.put = lambda room_id, item: server3.ingest_message(item)
+    client = NullClient()
+
+    def deliver(topic, payload, retain):
+        server3.on_message(client, None, Message(topic, payload, retain))
+
+    return deliver
+
+
+def fan_target(args):
+    """Fan-node decision for every reading, by esp32_node_fan.cpp's own
+    parser and thresholds built for the host"""
+    import firmware
+
+    node = firmware.load("fan_node")
+
+    def deliver(topic, payload, retain):
+        if topic.endswith("/snapshot"):
+            if not payload:
+                return None  # Cleared by the room node's last will
+            fans = node.fan_snapshot_target(payload)
+        else:
+            fans = node.fan_stream_target(payload)
+        return None if fans < 0 else fans  # Ignored by the node
+
+    return deliver
+
+
+TARGETS = {"broker": broker_target, "ingest": ingest_target, "fan": fan_target}
+
+
+def replay(args):
+    deliver = TARGETS[args.target](args)
+    latencies = []
+    lag = 0.0  # Worst lateness against the recorded schedule
+    start = first = None
+    count = 0
+    for t, topic, payload, retain in read_trace(args.trace):
+        if start is None:
+            start, first = time.perf_counter(), t
+        if args.speed > 0:
+            # Schedule against the trace start so sleep errors do not accumulate
+            due = start + (t - first) / args.speed
+            wait = due - time.perf_counter()
+            if wait > 0:
+                time.sleep(wait)
+            else:
+                lag = max(lag, -wait)
+        began = time.perf_counter()
+        deliver(topic, payload, retain)
+        latencies.append(time.perf_counter() - began)
+        count += 1
+    if not count:
+        logger.info("Trace is empty")
+        return
+    elapsed = time.perf_counter() - start
+    latencies.sort()
+    logger.info(
+        f"Replayed {count} messages into {args.target} in {elapsed:.2f}s "
+        f"({count / elapsed:.0f} msg/s), handler p50 "
+        f"{latencies[len(latencies) // 2] * 1e6:.1f} µs, p99 "
+        f"{latencies[int(len(latencies) * 0.99)] * 1e6:.1f} µs, max lag {lag * 1000:.1f} ms"
+    )
+
+
+def info(args):
+    count = 0
+    sizes = 0
+    topics = {}
+    first = last = None
+    for t, topic, payload, retain in read_trace(args.trace):
+        first = t if first is None else first
+        last = t
+        count += 1
+        sizes += len(payload)
+        topics[topic] = topics.get(topic, 0) + 1
+    if not count:
+        logger.info("Trace is empty")
+        return
+    logger.info(f"{count} messages over {last - first:.1f}s, {sizes} payload bytes")
+    for topic, n in sorted(topics.items()):
+        logger.info(f"  {topic}: {n}")
+
+
+def main():
+    """Main function to record, replay or inspect a trace"""
+    parser = argparse.ArgumentParser(
+        description="Record and replay MQTT sensor traffic"
+    )
+    parser.add_argument("--broker", default=MQTT_BROKER or "localhost")
+    parser.add_argument("--port", type=int, default=MQTT_PORT)
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    rec = commands.add_parser("record", help="Record messages to a trace file")
+    rec.add_argument("trace")
+    rec.add_argument("--topic", default="sensors/#", help="Topic filter to record")
+    rec.set_defaults(run=record)
+
+    rep = commands.add_parser("replay", help="Replay a trace file")
+    rep.add_argument("trace")
+    rep.add_argument("--target", choices=list(TARGETS), default="broker")
+    rep.add_argument(
+        "--speed",
+        type=float,
+        default=1.0,
+        help="1 = recorded timing, N = N times faster, 0 = as fast as possible",
+    )
+    rep.set_defaults(run=replay)
+
+    inf = commands.add_parser("info", help="Summarize a trace file")
+    inf.add_argument("trace")
+    inf.set_defaults(run=info)
+
+    args = parser.parse_args()
+    args.run(args)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Registry of rooms and devices.
+
+Room nodes publish on <root>/<site>/<room>/<device>. Every room and every
+device is given a dense integer id the first time it is seen, so per-room
+and per-device state lives in lists indexed by id instead of dicts keyed by
+name, and adding a room appends one slot to each of them. Resolving a known
+topic is a single dict lookup; parsing and registering happen once per
+device, under a lock, and only the MQTT thread registers devices.
+
+Registration from a topic is bounded, since anyone who can publish on the
+broker chooses the topic: a new room must match one of the auto_rooms
+patterns and stay within max_rooms, and a room takes at most
+max_devices_per_room devices. Topics refused this way are counted in
+rejected like malformed ones. Rooms added explicitly (configuration,
+aliases) are not limited.
+"""
+
+import fnmatch
+import re
+import threading
+from array import array
+
+# Room names end up in URLs, Socket.IO namespaces, file names and the DB
+ROOM_NAME = re.compile(r"[a-z0-9_-]{1,20}\Z")
+# <room>/<device number> below the site prefix
+DEVICE_PATH = re.compile(r"([a-z0-9_-]{1,20})/([0-9]{1,9})\Z")
+
+
+class Registry:
+    """Topic -> device id hash index plus per-device and per-room tables"""
+
+    def __init__(
+        self,
+        root,
+        site,
+        on_room=None,
+        auto_rooms=("*",),
+        max_rooms=None,
+        max_devices_per_room=None,
+    ):
+        self.prefix = f"{root}/{site}/"
+        self.auto_rooms = re.compile(
+            "|".join(fnmatch.translate(p) for p in auto_rooms) or r"(?!)"
+        )
+        self.max_rooms = max_rooms
+        self.max_devices_per_room = max_devices_per_room
+        # on_room(room id, name) sizes the per-room state of a new room; it
+        # runs before the room can be resolved by anyone else
+        self.on_room = on_room
+        self.lock = threading.Lock()
+        self.topics = {}  # topic -> device id
+        self.rooms = {}  # room name -> room id
+        self.room_names = []  # room id -> name
+        self.room_devices = []  # room id -> list of device ids
+        self.devices = {}  # (room id, device number) -> device id
+        self.device_room = array("I")  # device id -> room id
+        self.device_number = array("I")  # device id -> DEVICE_ID of the node
+        self.device_topic = []  # device id -> data topic
+        self.last_seen = array("d")  # device id -> epoch of the last sample, 0 = never
+        self.aliases = []  # Extra topics resolved to a fixed device
+        self.rejected = 0
+
+    def add_room(self, name):
+        """Room id of name, registering the room if it is new"""
+        room_id = self.rooms.get(name)
+        if room_id is not None:
+            return room_id
+        if not ROOM_NAME.match(name):
+            raise ValueError(f"Invalid room name: {name!r}")
+        with self.lock:
+            room_id = self.rooms.get(name)
+            if room_id is None:
+                room_id = len(self.room_names)
+                self.room_names.append(name)
+                self.room_devices.append([])
+                if self.on_room:
+                    self.on_room(room_id, name)
+                self.rooms[name] = room_id
+        return room_id
+
+    def add_device(self, room, number, topic=None):
+        """Device id of (room, number), registering both if they are new"""
+        room_id = self.add_room(room)
+        with self.lock:
+            device_id = self.devices.get((room_id, number))
+            if device_id is None:
+                device_id = len(self.device_room)
+                self.device_room.append(room_id)
+                self.device_number.append(number)
+                self.device_topic.append(topic or self.topic(room, number))
+                self.last_seen.append(0.0)
+                self.room_devices[room_id].append(device_id)
+                self.devices[(room_id, number)] = device_id
+        return device_id
+
+    def topic(self, room, number):
+        return f"{self.prefix}{room}/{number}"
+
+    def alias(self, topic, room, number=0):
+        """Route a topic outside the hierarchy (a pre-registry node) to a device"""
+        self.topics[topic] = self.add_device(room, number, topic)
+        self.aliases.append(topic)
+
+    def resolve(self, topic):
+        """Device id for a data topic, or None if it is not a device topic"""
+        device_id = self.topics.get(topic)
+        if device_id is not None:
+            return device_id
+        if not topic.startswith(self.prefix):
+            return None
+        match = DEVICE_PATH.match(topic, len(self.prefix))
+        if match is None or not self.admits(match.group(1), int(match.group(2))):
+            self.rejected += 1
+            return None
+        device_id = self.add_device(match.group(1), int(match.group(2)))
+        self.topics[topic] = device_id
+        return device_id
+
+    def admits(self, room, number):
+        """Whether a topic may register (room, number) if it is new"""
+        room_id = self.rooms.get(room)
+        if room_id is None:
+            return self.auto_rooms.match(room) is not None and (
+                self.max_rooms is None or len(self.room_names) < self.max_rooms
+            )
+        return (
+            self.max_devices_per_room is None
+            or (room_id, number) in self.devices
+            or len(self.room_devices[room_id]) < self.max_devices_per_room
+        )
+
+    def room_id(self, name):
+        """Room id of a registered room, None otherwise"""
+        return self.rooms.get(name)
+
+    def subscriptions(self, suffix=""):
+        """Topic filters covering every device topic, with suffix appended"""
+        return [self.prefix + "+/+" + suffix] + [t + suffix for t in self.aliases]
+
+    def stats(self):
+        return {
+            "rooms": len(self.room_names),
+            "devices": len(self.device_room),
+            "rejected_topics": self.rejected,
+        }
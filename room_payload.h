@@ -0,0 +1,110 @@
+// Mẫu đo fixed-point và định dạng payload của room node, không dùng float.
+// Logic thuần để biên dịch được trên máy host (pio test -e native, firmware.py)
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef DEVICE_ID
+#define DEVICE_ID 1
+#endif
+
+#ifndef STR
+#define STR_(x) #x
+#define STR(x) STR_(x)
+#endif
+
+// ===== Fixed-point sample =====
+// Nhiệt độ và độ ẩm được lưu dưới dạng x100 (centi-độ, centi-%) từ lúc đọc
+// cảm biến tới lúc gửi, không chuyển float sang chuỗi.
+struct Sample
+{
+  uint8_t status;
+  uint8_t aqi;
+  uint16_t tvoc;     // ppb
+  uint16_t eco2;     // ppm
+  int16_t tempCenti; // 0.01 °C
+  uint16_t humCenti; // 0.01 %RH
+};
+
+// Ghi v dạng thập phân vào p, trả về con trỏ sau ký tự cuối
+inline char *appendInt(char *p, int32_t v)
+{
+  if (v < 0)
+  {
+    *p++ = '-';
+    v = -v;
+  }
+  char tmp[10];
+  int n = 0;
+  do
+  {
+    tmp[n++] = '0' + v % 10;
+    v /= 10;
+  } while (v);
+  while (n)
+  {
+    *p++ = tmp[--n];
+  }
+  return p;
+}
+
+// Giá trị x100 -> "d.dd", cùng kết quả với String(float) 2 chữ số thập phân
+inline char *appendCenti(char *p, int32_t centi)
+{
+  if (centi < 0)
+  {
+    *p++ = '-';
+    centi = -centi;
+  }
+  p = appendInt(p, centi / 100);
+  *p++ = '.';
+  *p++ = '0' + (centi % 100) / 10;
+  *p++ = '0' + centi % 10;
+  return p;
+}
+
+inline char *appendStr(char *p, const char *s)
+{
+  while (*s)
+  {
+    *p++ = *s++;
+  }
+  return p;
+}
+
+// {"device":..,"tvoc":..,"temperature":..,"humidity":..,"eco2":..,"aqi":..}
+inline size_t formatPayload(const Sample &s, char *buf)
+{
+  char *p = buf;
+  p = appendStr(p, "{\"device\":" STR(DEVICE_ID) ",\"tvoc\":");
+  p = appendInt(p, s.tvoc);
+  p = appendStr(p, ",\"temperature\":");
+  p = appendCenti(p, s.tempCenti);
+  p = appendStr(p, ",\"humidity\":");
+  p = appendCenti(p, s.humCenti);
+  p = appendStr(p, ",\"eco2\":");
+  p = appendInt(p, s.eco2);
+  p = appendStr(p, ",\"aqi\":");
+  p = appendInt(p, s.aqi);
+  *p++ = '}';
+  *p = '\0';
+  return p - buf;
+}
+
+// tvoc,eco2,aqi,temperature,humidity
+inline size_t formatSnapshot(const Sample &s, char *buf)
+{
+  char *p = buf;
+  p = appendInt(p, s.tvoc);
+  *p++ = ',';
+  p = appendInt(p, s.eco2);
+  *p++ = ',';
+  p = appendInt(p, s.aqi);
+  *p++ = ',';
+  p = appendCenti(p, s.tempCenti);
+  *p++ = ',';
+  p = appendCenti(p, s.humCenti);
+  *p = '\0';
+  return p - buf;
+}
@@ -0,0 +1,300 @@
+// Đọc AHT21 + ENS160 của room node ở mức thanh ghi qua một bus I2C trừu
+// tượng: trên ESP32 là Wire, trên máy host là bus giả lập (host/i2c_emulator.h)
+// để kiểm thử đường thu thập dữ liệu và các nhánh lỗi: pio test -e native
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "room_payload.h"
+
+// Một transaction là start, địa chỉ, dữ liệu, stop; false khi thiết bị NACK
+class I2cBus
+{
+public:
+  virtual ~I2cBus() {}
+  virtual bool write(uint8_t addr, const uint8_t *data, size_t len) = 0;
+  virtual bool read(uint8_t addr, uint8_t *data, size_t len) = 0;
+  virtual void delayMs(uint32_t ms) = 0;
+  virtual uint32_t micros() = 0;
+};
+
+// ===== ENS160 (datasheet rev 0.95) =====
+#define ENS160_ADDR 0x53
+#define ENS160_PART_ID 0x0160
+#define ENS160_REG_PART_ID 0x00
+#define ENS160_REG_OPMODE 0x10
+#define ENS160_REG_TEMP_IN 0x13 // Kelvin x64, RH_IN (%RH x512) follows
+#define ENS160_REG_STATUS 0x20  // AQI, TVOC, ECO2 follow
+#define ENS160_OPMODE_STANDARD 0x02
+#define ENS160_OPMODE_RESET 0xF0
+#define ENS160_STATUS_NEWDAT 0x02
+#define ENS160_RESET_MS 10
+#define ENS160_OPMODE_MS 20
+// Validity flag của ENS160: 0 normal, 1 warm-up, 2 initial start-up, 3 invalid
+#define ENS160_INVALID_OUTPUT 3
+
+// ===== AHT21 =====
+#define AHT21_ADDR 0x38
+#define AHT21_CMD_RESET 0xBA
+#define AHT21_CMD_INIT 0xBE
+#define AHT21_CMD_TRIGGER 0xAC
+#define AHT21_STATUS_BUSY 0x80
+#define AHT21_STATUS_CALIBRATED 0x08
+#define AHT21_RESET_MS 20
+#define AHT21_CONVERSION_MS 80 // Typical measurement time
+#define AHT21_POLL_MS 10
+#define AHT21_TIMEOUT_MS 200
+
+// Khởi tạo lại cảm biến sau số lần đọc lỗi liên tiếp này
+#define SENSOR_MAX_FAILURES 3
+
+struct GasReading
+{
+  uint8_t validity;
+  bool newData;
+  uint8_t aqi;
+  uint16_t tvoc;
+  uint16_t eco2;
+};
+
+struct RoomSensors
+{
+  I2cBus *bus;
+  uint8_t failures;        // Consecutive failed acquisitions
+  bool gasReady;           // ENS160 has produced data since begin
+  uint32_t acquisitionUs;  // Duration of the last acquisition
+};
+
+inline bool i2cReadReg(I2cBus &bus, uint8_t addr, uint8_t reg, uint8_t *data, size_t len)
+{
+  return bus.write(addr, &reg, 1) && bus.read(addr, data, len);
+}
+
+inline bool ens160Begin(I2cBus &bus)
+{
+  const uint8_t reset[] = {ENS160_REG_OPMODE, ENS160_OPMODE_RESET};
+  if (!bus.write(ENS160_ADDR, reset, sizeof(reset)))
+  {
+    return false;
+  }
+  bus.delayMs(ENS160_RESET_MS);
+  uint8_t id[2];
+  if (!i2cReadReg(bus, ENS160_ADDR, ENS160_REG_PART_ID, id, sizeof(id)) ||
+      (id[0] | id[1] << 8) != ENS160_PART_ID)
+  {
+    return false;
+  }
+  const uint8_t standard[] = {ENS160_REG_OPMODE, ENS160_OPMODE_STANDARD};
+  if (!bus.write(ENS160_ADDR, standard, sizeof(standard)))
+  {
+    return false;
+  }
+  bus.delayMs(ENS160_OPMODE_MS);
+  return true;
+}
+
+// Bù nhiệt độ/độ ẩm cho ENS160: TEMP_IN = K x64, RH_IN = %RH x512
+inline bool ens160SetEnv(I2cBus &bus, int32_t tempCenti, int32_t humCenti)
+{
+  uint16_t t = (uint16_t)(((tempCenti + 27315) * 64 + 50) / 100);
+  uint16_t h = (uint16_t)((humCenti * 512 + 50) / 100);
+  const uint8_t data[] = {ENS160_REG_TEMP_IN, (uint8_t)t, (uint8_t)(t >> 8),
+                          (uint8_t)h, (uint8_t)(h >> 8)};
+  return bus.write(ENS160_ADDR, data, sizeof(data));
+}
+
+// DATA_STATUS..DATA_ECO2 trong một lần đọc liên tiếp
+inline bool ens160Read(I2cBus &bus, GasReading &out)
+{
+  uint8_t d[6];
+  if (!i2cReadReg(bus, ENS160_ADDR, ENS160_REG_STATUS, d, sizeof(d)))
+  {
+    return false;
+  }
+  out.validity = (d[0] >> 2) & 0x03;
+  out.newData = d[0] & ENS160_STATUS_NEWDAT;
+  out.aqi = d[1] & 0x07;
+  out.tvoc = d[2] | d[3] << 8;
+  out.eco2 = d[4] | d[5] << 8;
+  return true;
+}
+
+inline uint8_t aht21Crc(const uint8_t *data, size_t len)
+{
+  uint8_t crc = 0xFF; // CRC-8, polynomial x^8 + x^5 + x^4 + 1
+  for (size_t i = 0; i < len; i++)
+  {
+    crc ^= data[i];
+    for (int b = 0; b < 8; b++)
+    {
+      crc = crc & 0x80 ? (uint8_t)(crc << 1) ^ 0x31 : (uint8_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+// Chờ cờ busy tắt, false khi quá AHT21_TIMEOUT_MS hoặc bus lỗi
+inline bool aht21WaitReady(I2cBus &bus, uint8_t &status)
+{
+  for (uint32_t waited = 0;; waited += AHT21_POLL_MS)
+  {
+    if (!bus.read(AHT21_ADDR, &status, 1))
+    {
+      return false;
+    }
+    if (!(status & AHT21_STATUS_BUSY))
+    {
+      return true;
+    }
+    if (waited >= AHT21_TIMEOUT_MS)
+    {
+      return false;
+    }
+    bus.delayMs(AHT21_POLL_MS);
+  }
+}
+
+inline bool aht21Begin(I2cBus &bus)
+{
+  const uint8_t reset = AHT21_CMD_RESET;
+  if (!bus.write(AHT21_ADDR, &reset, 1))
+  {
+    return false;
+  }
+  bus.delayMs(AHT21_RESET_MS);
+  uint8_t status;
+  if (!aht21WaitReady(bus, status))
+  {
+    return false;
+  }
+  if (!(status & AHT21_STATUS_CALIBRATED))
+  {
+    const uint8_t init[] = {AHT21_CMD_INIT, 0x08, 0x00};
+    if (!bus.write(AHT21_ADDR, init, sizeof(init)) || !aht21WaitReady(bus, status))
+    {
+      return false;
+    }
+  }
+  return status & AHT21_STATUS_CALIBRATED;
+}
+
+// v / 2^20 làm tròn như printf("%.2f") của sketch cũ: về số gần nhất, đúng
+// nửa thì về số chẵn, đối xứng quanh 0
+inline int32_t aht21Round(int64_t v)
+{
+  uint64_t mag = v < 0 ? -v : v;
+  uint64_t q = mag >> 20, rem = mag & 0xFFFFF;
+  if (rem > (1 << 19) || (rem == (1 << 19) && (q & 1)))
+  {
+    q++;
+  }
+  return v < 0 ? -(int32_t)q : (int32_t)q;
+}
+
+// Đổi giá trị thô 20 bit sang x100 bằng số nguyên: RH = raw / 2^20 x 100,
+// T = raw / 2^20 x 200 - 50
+inline void aht21Centi(uint32_t hum, uint32_t temp, int32_t &tempCenti, int32_t &humCenti)
+{
+  humCenti = aht21Round((int64_t)hum * 10000);
+  tempCenti = aht21Round((int64_t)temp * 20000 - (5000LL << 20));
+}
+
+// Một phép đo, đổi thẳng sang x100
+inline bool aht21Measure(I2cBus &bus, int32_t &tempCenti, int32_t &humCenti)
+{
+  const uint8_t trigger[] = {AHT21_CMD_TRIGGER, 0x33, 0x00};
+  if (!bus.write(AHT21_ADDR, trigger, sizeof(trigger)))
+  {
+    return false;
+  }
+  bus.delayMs(AHT21_CONVERSION_MS);
+  // Status, 5 data bytes, CRC: poll with the full read while still busy
+  uint8_t d[7];
+  for (uint32_t waited = 0;; waited += AHT21_POLL_MS)
+  {
+    if (!bus.read(AHT21_ADDR, d, sizeof(d)))
+    {
+      return false;
+    }
+    if (!(d[0] & AHT21_STATUS_BUSY))
+    {
+      break;
+    }
+    if (waited >= AHT21_TIMEOUT_MS)
+    {
+      return false;
+    }
+    bus.delayMs(AHT21_POLL_MS);
+  }
+  if (aht21Crc(d, 6) != d[6])
+  {
+    return false;
+  }
+  uint32_t hum = (uint32_t)d[1] << 12 | (uint32_t)d[2] << 4 | d[3] >> 4;
+  uint32_t temp = (uint32_t)(d[3] & 0x0F) << 16 | (uint32_t)d[4] << 8 | d[5];
+  aht21Centi(hum, temp, tempCenti, humCenti);
+  return true;
+}
+
+inline void sensorsInit(RoomSensors &s, I2cBus &bus)
+{
+  s.bus = &bus;
+  s.failures = 0;
+  s.gasReady = false;
+  s.acquisitionUs = 0;
+}
+
+inline bool sensorsBeginAht21(RoomSensors &s)
+{
+  return aht21Begin(*s.bus);
+}
+
+inline bool sensorsBeginEns160(RoomSensors &s)
+{
+  s.gasReady = false;
+  return ens160Begin(*s.bus);
+}
+
+// Đọc AHT21 rồi ENS160 (đã bù nhiệt độ/độ ẩm), false khi bus I2C lỗi, ENS160
+// báo dữ liệu không hợp lệ hoặc chưa có mẫu nào kể từ khi khởi tạo
+inline bool readSample(RoomSensors &s, Sample &sample)
+{
+  uint32_t start = s.bus->micros();
+  int32_t tempCenti, humCenti;
+  GasReading gas;
+  bool ok = aht21Measure(*s.bus, tempCenti, humCenti) &&
+            ens160SetEnv(*s.bus, tempCenti, humCenti) &&
+            ens160Read(*s.bus, gas);
+  if (ok)
+  {
+    s.gasReady |= gas.newData;
+    ok = s.gasReady && gas.validity != ENS160_INVALID_OUTPUT;
+  }
+  if (ok)
+  {
+    sample.status = gas.validity;
+    sample.aqi = gas.aqi;
+    sample.tvoc = gas.tvoc;
+    sample.eco2 = gas.eco2;
+    sample.tempCenti = (int16_t)tempCenti;
+    sample.humCenti = (uint16_t)humCenti;
+    s.failures = 0;
+  }
+  s.acquisitionUs = s.bus->micros() - start;
+  return ok;
+}
+
+// Bỏ qua slot lỗi; true khi đã đủ SENSOR_MAX_FAILURES lần liên tiếp và
+// cả hai cảm biến được khởi tạo lại (kết quả trong ahtOk/ensOk)
+inline bool sensorFailure(RoomSensors &s, bool &ahtOk, bool &ensOk)
+{
+  if (++s.failures < SENSOR_MAX_FAILURES)
+  {
+    return false;
+  }
+  ahtOk = sensorsBeginAht21(s);
+  ensOk = sensorsBeginEns160(s);
+  s.failures = 0;
+  return true;
+}
@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Compiled threshold evaluation for the alert stage.
+
+The threshold dicts of every room are compiled into a RuleTable: one flat
+array per threshold column, indexed by a dense room index. Alert cooldowns
+are kept struct-of-arrays style, one array of last-fired times per alert
+type. A RuleTable is immutable; updating a room's thresholds builds a new
+table and swaps the reference, so evaluation never takes a lock.
+"""
+
+import threading
+from array import array
+
+# Upper bounds of the five TVOC levels, in order
+TVOC_LEVELS = (
+    "tvoc_excellent",
+    "tvoc_good",
+    "tvoc_moderate",
+    "tvoc_poor",
+    "tvoc_unhealthy",
+)
+# TVOC levels from this index on raise an alert
+TVOC_ALERT_LEVEL = 2
+
+COLUMNS = TVOC_LEVELS + (
+    "temp_min",
+    "temp_max",
+    "humidity_min",
+    "humidity_max",
+    "eco2_min",
+    "eco2_max",
+)
+
+# Alert types that can fire and their cooldown in seconds
+ALERTS = (
+    ("tvoc_moderate", 300),
+    ("tvoc_poor", 300),
+    ("tvoc_unhealthy", 300),
+    ("temp_high", 600),
+    ("temp_low", 600),
+    ("humidity_high", 600),
+    ("humidity_low", 600),
+    ("eco2_high", 600),
+    ("eco2_low", 600),
+)
+ALERT_INDEX = {key: i for i, (key, _) in enumerate(ALERTS)}
+
+# (alert for value above max, alert for value below min, min column, max column)
+_RANGE_RULES = (
+    ("temp_high", "temp_low", "temp_min", "temp_max"),
+    ("humidity_high", "humidity_low", "humidity_min", "humidity_max"),
+    ("eco2_high", "eco2_low", "eco2_min", "eco2_max"),
+)
+
+
+class RuleTable:
+    """Immutable compiled thresholds, one array per column indexed by room"""
+
+    __slots__ = ("columns", "size")
+
+    def __init__(self, columns, size):
+        self.columns = columns
+        self.size = size
+
+    @classmethod
+    def empty(cls):
+        return cls({name: array("d") for name in COLUMNS}, 0)
+
+    def with_room(self, index, thresholds):
+        """Copy of the table with one room's row replaced or appended"""
+        columns = {}
+        for name in COLUMNS:
+            column = array("d", self.columns[name])
+            value = float(thresholds[name])
+            if index < len(column):
+                column[index] = value
+            else:
+                column.append(value)
+            columns[name] = column
+        return RuleTable(columns, max(self.size, index + 1))
+
+
+class RuleEngine:
+    """Batch threshold evaluation over dense room indices"""
+
+    def __init__(self):
+        self.table = RuleTable.empty()
+        self.last_fired = [array("d") for _ in ALERTS]
+        self.write_lock = threading.Lock()
+
+    def set_thresholds(self, index, thresholds):
+        """Compile a room's thresholds and publish them to readers"""
+        with self.write_lock:
+            if index > self.table.size:
+                raise ValueError(f"Room index {index} is not the next index")
+            if index == self.table.size:
+                for column in self.last_fired:
+                    column.append(float("-inf"))
+            self.table = self.table.with_room(index, thresholds)
+
+    def evaluate(self, rooms, tvoc, temperature, humidity, eco2, now):
+        """
+        Evaluate a batch of samples given as parallel sequences. Returns the
+        alerts that fired and were not cooling down, as
+        (room index, alert type, value, threshold) tuples.
+        """
+        table = self.table  # One consistent snapshot for the whole batch
+        columns = table.columns
+        tvoc_bounds = [columns[name] for name in TVOC_LEVELS]
+        last_fired = self.last_fired
+        fired = []
+
+        def fire(room, key, value, threshold):
+            i = ALERT_INDEX[key]
+            if now - last_fired[i][room] > ALERTS[i][1]:
+                last_fired[i][room] = now
+                fired.append((room, key, value, threshold))
+
+        for n, room in enumerate(rooms):
+            if room >= table.size:
+                continue
+            value = tvoc[n]
+            level = len(TVOC_LEVELS) - 1
+            for i, bounds in enumerate(tvoc_bounds):
+                if value < bounds[room]:
+                    level = i
+                    break
+            if level >= TVOC_ALERT_LEVEL:
+                key = TVOC_LEVELS[level]
+                fire(room, key, value, tvoc_bounds[level][room])
+
+            for values, (high, low, min_name, max_name) in zip(
+                (temperature, humidity, eco2), _RANGE_RULES
+            ):
+                value = values[n]
+                upper = columns[max_name][room]
+                lower = columns[min_name][room]
+                if value > upper:
+                    fire(room, high, value, upper)
+                elif value < lower:
+                    fire(room, low, value, lower)
+        return fired
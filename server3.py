@@ -2,37 +2,75 @@
 # -*- coding: utf-8 -*-
 """
 TVOC Monitoring Server for Raspberry Pi 5
-Handles MQTT, Database, Telegram alerts, and Web Dashboard for Bedroom and Workingroom
+Handles MQTT, Database, Telegram alerts, and Web Dashboard for every registered room
 """
 
+import functools
 import json
 import logging
 import os
+import queue
+import struct
 import threading
 import time
+from collections import OrderedDict, deque, namedtuple
 from datetime import datetime, timedelta
 
 import mariadb
 import paho.mqtt.client as mqtt
 import requests
 from dotenv import load_dotenv
-from flask import Flask, jsonify, render_template_string, request
+from flask import Flask, Response, jsonify, render_template_string, request
 from flask_socketio import SocketIO, emit
 
 from config import (
+    BACKTEST_MAX_HOURS,
+    COMPACTION_KB_S,
+    DB_BATCH_DELAY_MS,
+    DB_BATCH_SIZE,
+    DB_DURABILITY,
     DB_HOST,
     DB_NAME,
     DB_PASSWORD,
     DB_PORT,
+    DB_RETENTION_DAYS,
     DB_USER,
     FLASK_SECRET_KEY,
+    HISTORY_ARCHIVE_DAYS,
+    HISTORY_DIR,
+    HISTORY_RAW_DAYS,
+    HOT_WINDOW_SAMPLES,
+    INGEST_SHARDS,
+    MAX_DEVICES_PER_ROOM,
+    MAX_ROOMS,
     MQTT_BROKER,
     MQTT_PORT,
+    MQTT_SITE,
+    MQTT_SLOT_PERIOD_MS,
     MQTT_TOPIC_BEDROOM,
+    MQTT_TOPIC_ROOT,
     MQTT_TOPIC_WORKINGROOM,
+    ROOMS,
+    ROOMS_AUTO,
+    TELEGRAM_API_URL,
     TELEGRAM_BOT_TOKEN,
     TELEGRAM_CHAT_ID,
+    TELEGRAM_RATE_PER_MIN,
+    WAL_DIR,
+    WAL_MAX_MB,
+    WAL_SEGMENT_MB,
+    WAL_SYNC_MS,
 )
+from backtest import replay
+from compaction import Compactor
+from downsample import decimate_rows
+from hotcache import HotWindow
+from livepush import LivePush, encode_frame
+from registry import Registry
+from rules import RuleEngine
+from shards import ShardPool
+from tsstore import METRICS, ROW, ArchiveFile, TimeSeriesStore, pick_tier
+from wal import WalReader, WriteAheadLog
 
 # Load .env file
 load_dotenv()
@@ -70,29 +108,26 @@ DEFAULT_THRESHOLDS = {
     "eco2_max": 1000,  # ppm
 }
 
-# Global variables for data storage
-current_data_bedroom = {
-    "tvoc": 0,
-    "temperature": 0,
-    "humidity": 0,
-    "eco2": 0,
-    "aqi": 1,
-    "timestamp": datetime.now(),
-}
+# Latest reading and recent samples per room, readable without locks
+hot_window = HotWindow(HOT_WINDOW_SAMPLES)
+
+# Threshold dict of every room, indexed by room id
+room_thresholds = []
+
+# The two original rooms keep their tables, every other room shares one
+LEGACY_TABLES = {"bedroom": "sensor_data", "workingroom": "sensor_data1"}
+SHARED_TABLE = "sensor_readings"
 
-current_data_workingroom = {
-    "tvoc": 0,
-    "temperature": 0,
-    "humidity": 0,
-    "eco2": 0,
-    "aqi": 1,
-    "timestamp": datetime.now(),
-}
 
-thresholds_bedroom = DEFAULT_THRESHOLDS.copy()
-thresholds_workingroom = DEFAULT_THRESHOLDS.copy()
-last_alert_time_bedroom = {}
-last_alert_time_workingroom = {}
+def synchronized(method):
+    """Serialize access to the shared database connection"""
+
+    @functools.wraps(method)
+    def wrapper(self, *args, **kwargs):
+        with self.lock:
+            return method(self, *args, **kwargs)
+
+    return wrapper
 
 
 class DatabaseManager:
@@ -100,6 +135,8 @@ class DatabaseManager:
 
     def __init__(self):
         self.connection = None
+        # One connection shared by the pipeline stages and the Flask threads
+        self.lock = threading.RLock()
         self.connect()
         self.create_tables()
 
@@ -146,6 +183,24 @@ class DatabaseManager:
             """
             )
 
+            # Sensor data table for every other room
+            cursor.execute(
+                """
+                CREATE TABLE IF NOT EXISTS sensor_readings (
+                    id INT AUTO_INCREMENT PRIMARY KEY,
+                    room VARCHAR(20) NOT NULL,
+                    device INT NOT NULL,
+                    tvoc FLOAT NOT NULL,
+                    temperature FLOAT NOT NULL,
+                    humidity FLOAT NOT NULL,
+                    eco2 FLOAT NOT NULL,
+                    aqi INT NOT NULL,
+                    timestamp DATETIME DEFAULT CURRENT_TIMESTAMP,
+                    INDEX room_time (room, timestamp)
+                )
+            """
+            )
+
             # Thresholds table
             cursor.execute(
                 """
@@ -164,6 +219,29 @@ class DatabaseManager:
             """
             )
 
+            # Write-ahead log position committed together with the samples
+            cursor.execute(
+                """
+                CREATE TABLE IF NOT EXISTS ingest_checkpoint (
+                    id INT PRIMARY KEY,
+                    lsn BIGINT NOT NULL
+                )
+            """
+            )
+            cursor.execute(
+                "INSERT IGNORE INTO ingest_checkpoint (id, lsn) VALUES (1, 0)"
+            )
+
+            # Per room, the end of the history archives already purged
+            cursor.execute(
+                """
+                CREATE TABLE IF NOT EXISTS retention_state (
+                    room VARCHAR(20) PRIMARY KEY,
+                    purged_until BIGINT NOT NULL
+                )
+            """
+            )
+
             # Alert history table
             cursor.execute(
                 """
@@ -179,40 +257,163 @@ class DatabaseManager:
             """
             )
 
+            # Time indexes for range reads and the retention purge of the legacy tables
+            for table in ("sensor_data", "sensor_data1", "alert_history"):
+                cursor.execute(
+                    f"CREATE INDEX IF NOT EXISTS {table}_time ON {table} (timestamp)"
+                )
+
             self.connection.commit()
             logger.info("Database tables created successfully")
 
         except Exception as e:
             logger.error(f"Error creating tables: {e}")
 
-    def insert_sensor_data(self, room, tvoc, temperature, humidity, eco2, aqi):
+    @synchronized
+    def insert_sensor_data(
+        self, room, tvoc, temperature, humidity, eco2, aqi, device=0
+    ):
         """Insert sensor data into database"""
         try:
             cursor = self.connection.cursor()
-            table = "sensor_data" if room == "bedroom" else "sensor_data1"
-            cursor.execute(
-                f"INSERT INTO {table} (tvoc, temperature, humidity, eco2, aqi) VALUES (?, ?, ?, ?, ?)",
-                (tvoc, temperature, humidity, eco2, aqi),
-            )
+            table = LEGACY_TABLES.get(room)
+            if table:
+                cursor.execute(
+                    f"INSERT INTO {table} (tvoc, temperature, humidity, eco2, aqi) VALUES (?, ?, ?, ?, ?)",
+                    (tvoc, temperature, humidity, eco2, aqi),
+                )
+            else:
+                cursor.execute(
+                    f"INSERT INTO {SHARED_TABLE} (room, device, tvoc, temperature, humidity, eco2, aqi) VALUES (?, ?, ?, ?, ?, ?, ?)",
+                    (room, device, tvoc, temperature, humidity, eco2, aqi),
+                )
             self.connection.commit()
         except Exception as e:
             logger.error(f"Error saving data for {room}: {e}")
             self.connect()  # Try to reconnect
 
+    @synchronized
+    def insert_sensor_batch(self, samples, lsn=None):
+        """
+        Insert a batch of samples with one multi-row insert per table and a
+        single commit, which also moves the ingest checkpoint to lsn
+        """
+        rows = {}
+        for sample in samples:
+            values = (
+                sample.tvoc,
+                sample.temperature,
+                sample.humidity,
+                sample.eco2,
+                sample.aqi,
+                sample.timestamp,
+            )
+            table = LEGACY_TABLES.get(sample.room)
+            if table is None:
+                table = SHARED_TABLE
+                values = (sample.room, sample.device) + values
+            rows.setdefault(table, []).append(values)
+        cursor = self.connection.cursor()
+        for table, values in rows.items():
+            if table == SHARED_TABLE:
+                cursor.executemany(
+                    f"INSERT INTO {table} (room, device, tvoc, temperature, humidity, eco2, aqi, timestamp) VALUES (?, ?, ?, ?, ?, ?, ?, ?)",
+                    values,
+                )
+            else:
+                cursor.executemany(
+                    f"INSERT INTO {table} (tvoc, temperature, humidity, eco2, aqi, timestamp) VALUES (?, ?, ?, ?, ?, ?)",
+                    values,
+                )
+        if lsn is not None:
+            cursor.execute("UPDATE ingest_checkpoint SET lsn = ? WHERE id = 1", (lsn,))
+        self.connection.commit()
+
+    @synchronized
+    def get_checkpoint(self):
+        """Write-ahead log position up to which samples are committed"""
+        cursor = self.connection.cursor()
+        cursor.execute("SELECT lsn FROM ingest_checkpoint WHERE id = 1")
+        row = cursor.fetchone()
+        return row[0] if row else 0
+
+    @staticmethod
+    def _room_range(room, start, end):
+        """
+        Table and WHERE clause of a room's rows in [start, end] (epoch
+        seconds), matched on the indexes: room_time of the shared table,
+        the time index of a legacy table
+        """
+        table = LEGACY_TABLES.get(room)
+        params = (datetime.fromtimestamp(start), datetime.fromtimestamp(end + 1))
+        if table:
+            return table, "timestamp >= ? AND timestamp < ?", params
+        return SHARED_TABLE, "room = ? AND timestamp >= ? AND timestamp < ?", (
+            room,
+        ) + params
+
+    @synchronized
+    def purged_until(self, room):
+        """End of the history range whose rows were purged for a room, 0 if none"""
+        cursor = self.connection.cursor()
+        cursor.execute("SELECT purged_until FROM retention_state WHERE room = ?", (room,))
+        row = cursor.fetchone()
+        return row[0] if row else 0
+
+    @synchronized
+    def count_range(self, room, start, end):
+        """Number of a room's rows in [start, end]"""
+        table, where, params = self._room_range(room, start, end)
+        cursor = self.connection.cursor()
+        cursor.execute(f"SELECT COUNT(*) FROM {table} WHERE {where}", params)
+        return cursor.fetchone()[0]
+
+    @synchronized
+    def purge_range(self, room, start, end, limit):
+        """
+        Delete up to limit of a room's rows in [start, end], returns the
+        count. The commit that leaves none behind also records end in
+        retention_state.
+        """
+        table, where, params = self._room_range(room, start, end)
+        cursor = self.connection.cursor()
+        cursor.execute(f"DELETE FROM {table} WHERE {where} LIMIT ?", params + (limit,))
+        deleted = cursor.rowcount
+        if deleted < limit:
+            cursor.execute(
+                "INSERT INTO retention_state (room, purged_until) VALUES (?, ?) "
+                "ON DUPLICATE KEY UPDATE purged_until = VALUES(purged_until)",
+                (room, end),
+            )
+        self.connection.commit()
+        return deleted
+
+    @synchronized
     def get_recent_data(self, room, hours=24):
         """Get recent sensor data from database"""
         try:
             cursor = self.connection.cursor()
-            table = "sensor_data" if room == "bedroom" else "sensor_data1"
-            cursor.execute(
-                f"""
-                SELECT tvoc, temperature, humidity, eco2, aqi, timestamp 
-                FROM {table} 
-                WHERE timestamp >= NOW() - INTERVAL ? HOUR 
-                ORDER BY timestamp ASC
-            """,
-                (hours,),
-            )
+            table = LEGACY_TABLES.get(room)
+            if table:
+                cursor.execute(
+                    f"""
+                    SELECT tvoc, temperature, humidity, eco2, aqi, timestamp 
+                    FROM {table} 
+                    WHERE timestamp >= NOW() - INTERVAL ? HOUR 
+                    ORDER BY timestamp ASC
+                """,
+                    (hours,),
+                )
+            else:
+                cursor.execute(
+                    f"""
+                    SELECT tvoc, temperature, humidity, eco2, aqi, timestamp 
+                    FROM {SHARED_TABLE} 
+                    WHERE room = ? AND timestamp >= NOW() - INTERVAL ? HOUR 
+                    ORDER BY timestamp ASC
+                """,
+                    (room, hours),
+                )
 
             data = []
             for row in cursor.fetchall():
@@ -231,6 +432,7 @@ class DatabaseManager:
             logger.error(f"Error reading data for {room}: {e}")
             return []
 
+    @synchronized
     def update_thresholds(self, room, new_thresholds):
         """Update threshold values in database"""
         try:
@@ -290,6 +492,7 @@ class DatabaseManager:
         except Exception as e:
             logger.error(f"Error updating thresholds for {room}: {e}")
 
+    @synchronized
     def log_alert(self, room, alert_type, message, value, threshold_value):
         """Log alert to database"""
         try:
@@ -309,11 +512,16 @@ class DatabaseManager:
 # Initialize Database Manager
 db = DatabaseManager()
 
+# Block-file history, serves /api/history without a SQL round trip
+history_store = TimeSeriesStore(HISTORY_DIR)
+# Default point budget of /api/history, longer ranges are served from rollups
+MAX_HISTORY_POINTS = 2000
+
 
 def send_telegram_alert(room, message):
-    """Send alert via Telegram"""
+    """Send alert via Telegram, returns True on success"""
     try:
-        url = f"https://api.telegram.org/bot{TELEGRAM_BOT_TOKEN}/sendMessage"
+        url = f"{TELEGRAM_API_URL}/bot{TELEGRAM_BOT_TOKEN}/sendMessage"
         data = {
             "chat_id": TELEGRAM_CHAT_ID,
             "text": f"🚨 ALERT from {room.capitalize()} 🚨\n\n{message}",
@@ -322,181 +530,231 @@ def send_telegram_alert(room, message):
         response = requests.post(url, data=data, timeout=10)
         if response.status_code == 200:
             logger.info(f"Telegram message sent successfully for {room}")
-        else:
-            logger.error(f"Telegram error for {room}: {response.status_code}")
+            return True
+        logger.error(f"Telegram error for {room}: {response.status_code}")
     except Exception as e:
         logger.error(f"Telegram error for {room}: {e}")
+    return False
+
+
+# Alert type carrying the AQI summary line, sent but not logged
+AQI_ALERT_KEY = "aqi_level"
+# Alerts about the server itself, sent for this pseudo-room
+SERVER_ALERT_ROOM = "server"
+SERVER_ALERT_KEY = "server"
+RECOMMENDATION = "\n💨 Recommendation: Open windows or increase ventilation!"
+
+
+class AlertDispatcher:
+    """
+    Sends Telegram alerts from its own thread so a slow Telegram API never
+    reaches ingestion. Pending alerts are coalesced per room and alert type,
+    outbound messages go through a token bucket and failed sends are retried
+    with exponential backoff.
+    """
+
+    def __init__(self, rate_per_minute, burst=5, max_pending=200, max_attempts=5):
+        self.name = "notify"
+        self.rate = rate_per_minute / 60.0
+        self.burst = burst
+        self.tokens = float(burst)
+        self.refilled = time.monotonic()
+        self.max_pending = max_pending
+        self.max_attempts = max_attempts
+        self.pending = OrderedDict()  # (room, alert type) -> message
+        self.attempts = {}  # room -> failed sends of its pending alerts
+        self.retry_at = {}  # room -> monotonic time of the next attempt
+        self.cond = threading.Condition()
+        self.processed = 0
+        self.coalesced = 0
+        self.dropped = 0
+        self.thread = threading.Thread(target=self._run, name="notify", daemon=True)
+
+    def start(self):
+        self.thread.start()
+
+    def submit(self, room, alerts):
+        """Queue (alert type, message) pairs for a room without blocking"""
+        with self.cond:
+            for alert_type, message in alerts:
+                key = (room, alert_type)
+                if key in self.pending:
+                    self.coalesced += 1
+                elif len(self.pending) >= self.max_pending:
+                    self.pending.popitem(last=False)
+                    self.dropped += 1
+                self.pending[key] = message  # Latest message wins
+            self.cond.notify()
+
+    def stats(self):
+        with self.cond:
+            return {
+                "queued": len(self.pending),
+                "processed": self.processed,
+                "coalesced": self.coalesced,
+                "dropped": self.dropped,
+            }
+
+    def _take_tokens(self):
+        """Seconds to wait for the next token, 0 when one was taken"""
+        now = time.monotonic()
+        self.tokens = min(self.burst, self.tokens + (now - self.refilled) * self.rate)
+        self.refilled = now
+        if self.tokens >= 1:
+            self.tokens -= 1
+            return 0
+        return (1 - self.tokens) / self.rate
+
+    def _next_room(self):
+        """Oldest room with pending alerts that is not backing off, and the wait otherwise"""
+        now = time.monotonic()
+        wait = None
+        for room, _ in self.pending:
+            delay = self.retry_at.get(room, 0) - now
+            if delay <= 0:
+                return room, 0
+            wait = delay if wait is None else min(wait, delay)
+        return None, wait
+
+    def _run(self):
+        while True:
+            with self.cond:
+                room, wait = self._next_room()
+                while room is None:
+                    self.cond.wait(wait)
+                    room, wait = self._next_room()
+                wait = self._take_tokens()
+                if wait:
+                    self.cond.wait(wait)
+                    continue
+                alerts = [(k[1], m) for k, m in self.pending.items() if k[0] == room]
+                for alert_type, _ in alerts:
+                    del self.pending[(room, alert_type)]
+
+            # Order as evaluated, AQI summary last
+            alerts.sort(key=lambda a: a[0] == AQI_ALERT_KEY)
+            message = "\n".join(m for _, m in alerts)
+            if room != SERVER_ALERT_ROOM:
+                message += RECOMMENDATION
+            if send_telegram_alert(room, message):
+                self._done(room, alerts)
+            else:
+                self._retry(room, alerts)
+
+    def _done(self, room, alerts):
+        with self.cond:
+            self.attempts.pop(room, None)
+            self.retry_at.pop(room, None)
+            self.processed += 1
+        for alert_type, message in alerts:
+            if alert_type == SERVER_ALERT_KEY:
+                db.log_alert(room, "server_alert", message, 0, 0)
+            elif alert_type != AQI_ALERT_KEY:
+                db.log_alert(room, "environmental_alert", message, 0, 0)
+
+    def _retry(self, room, alerts):
+        with self.cond:
+            attempts = self.attempts.get(room, 0) + 1
+            if attempts >= self.max_attempts:
+                logger.error(f"Giving up on {len(alerts)} alerts for {room}")
+                self.attempts.pop(room, None)
+                self.retry_at.pop(room, None)
+                self.dropped += len(alerts)
+                return
+            self.attempts[room] = attempts
+            self.retry_at[room] = time.monotonic() + min(2**attempts, 60)
+            for alert_type, message in alerts:
+                # Keep anything newer that arrived while sending
+                self.pending.setdefault((room, alert_type), message)
+
+
+# Telegram text, dashboard text, dashboard severity and level of every alert type
+ALERT_FORMATS = {
+    "tvoc_moderate": (
+        "⚡ TVOC moderate: {value:.2f} ppb",
+        "TVOC Level: {value:.2f} ppb",
+        "warning",
+        "moderate",
+    ),
+    "tvoc_poor": (
+        "⚠️ TVOC poor: {value:.2f} ppb",
+        "TVOC Level: {value:.2f} ppb",
+        "danger",
+        "poor",
+    ),
+    "tvoc_unhealthy": (
+        "🚨 TVOC unhealthy: {value:.2f} ppb",
+        "TVOC Level: {value:.2f} ppb",
+        "danger",
+        "unhealthy",
+    ),
+    "temp_high": (
+        "🥵 Temperature HIGH: {value}°C (Above {threshold:g}°C)",
+        "Temperature: {value}°C",
+        "high",
+        "high",
+    ),
+    "temp_low": (
+        "🥶 Temperature LOW: {value}°C (Below {threshold:g}°C)",
+        "Temperature: {value}°C",
+        "low",
+        "low",
+    ),
+    "humidity_high": (
+        "💧 Humidity HIGH: {value}% (Above {threshold:g}%)",
+        "Humidity: {value}%",
+        "high",
+        "high",
+    ),
+    "humidity_low": (
+        "🏜️ Humidity LOW: {value}% (Below {threshold:g}%)",
+        "Humidity: {value}%",
+        "low",
+        "low",
+    ),
+    "eco2_high": (
+        "⚠️ CO2 level HIGH: {value} ppm (Above {threshold:g} ppm)",
+        "CO2 level: {value} ppm",
+        "high",
+        "high",
+    ),
+    "eco2_low": (
+        "🌿 CO2 level LOW: {value} ppm (Below {threshold:g} ppm)",
+        "CO2 level: {value} ppm",
+        "low",
+        "low",
+    ),
+}
 
+# Compiled thresholds, indexed by room id like room_thresholds
+rule_engine = RuleEngine()
 
-def check_thresholds_and_alert(room, tvoc, temperature, humidity, eco2):
+
+def check_thresholds_and_alert(room_id, tvoc, temperature, humidity, eco2):
     """Check thresholds and send alerts for TVOC, temperature, humidity and eCO2"""
-    thresholds = thresholds_bedroom if room == "bedroom" else thresholds_workingroom
-    last_alert_time = (
-        last_alert_time_bedroom if room == "bedroom" else last_alert_time_workingroom
+    fired = rule_engine.evaluate(
+        [room_id],
+        [tvoc],
+        [temperature],
+        [humidity],
+        [eco2],
+        time.time(),
     )
-    current_time = datetime.now()
     alerts = []
     alert_messages = []
-    should_send_alert = False
 
     # TVOC 5 mức chỉ dùng cho cảnh báo, không thay đổi AQI
-    if tvoc < thresholds["tvoc_excellent"]:
-        alert_key = "tvoc_excellent"
-        alert_severity = "success"
-        alert_message = None
-    elif tvoc < thresholds["tvoc_good"]:
-        alert_key = "tvoc_good"
-        alert_severity = "info"
-        alert_message = None
-    elif tvoc < thresholds["tvoc_moderate"]:
-        alert_key = "tvoc_moderate"
-        alert_severity = "warning"
-        alert_message = f"⚡ TVOC moderate: {tvoc:.2f} ppb"
-    elif tvoc < thresholds["tvoc_poor"]:
-        alert_key = "tvoc_poor"
-        alert_severity = "danger"
-        alert_message = f"⚠️ TVOC poor: {tvoc:.2f} ppb"
-    elif tvoc < thresholds["tvoc_unhealthy"]:
-        alert_key = "tvoc_unhealthy"
-        alert_severity = "danger"
-        alert_message = f"🚨 TVOC unhealthy: {tvoc:.2f} ppb"
-    else:
-        alert_key = "tvoc_unhealthy"
-        alert_severity = "danger"
-        alert_message = f"🚨 TVOC unhealthy: {tvoc:.2f} ppb"
-
-    if alert_message and (
-        alert_key not in last_alert_time
-        or (current_time - last_alert_time[alert_key]).seconds > 300
-    ):
-        should_send_alert = True
-        last_alert_time[alert_key] = current_time
-        alert_messages.append(alert_message)
-        alerts.append(
-            {
-                "type": alert_key,
-                "message": f"TVOC Level: {tvoc:.2f} ppb",
-                "severity": alert_severity,
-                "level": alert_key.replace("tvoc_", ""),
-            }
-        )
-
-    # Check temperature with 3 levels: Low, Normal, High
-    if temperature > thresholds["temp_max"]:  # High
-        temp_status = "high"
-        alert_key = "temp_high"
-        alert_severity = "high"
-        alert_message = (
-            f"🥵 Temperature HIGH: {temperature}°C (Above {thresholds['temp_max']}°C)"
-        )
-    elif temperature < thresholds["temp_min"]:  # Low
-        temp_status = "low"
-        alert_key = "temp_low"
-        alert_severity = "low"
-        alert_message = (
-            f"🥶 Temperature LOW: {temperature}°C (Below {thresholds['temp_min']}°C)"
-        )
-    else:  # Normal
-        temp_status = "normal"
-        alert_key = "temp_normal"
-        alert_severity = "success"
-        alert_message = None
-
-    if alert_message and (
-        alert_key not in last_alert_time
-        or (current_time - last_alert_time[alert_key]).seconds > 600
-    ):  # 10 minutes
-        should_send_alert = True
-        last_alert_time[alert_key] = current_time
-        alert_messages.append(alert_message)
-        alerts.append(
-            {
-                "type": alert_key,
-                "message": f"Temperature: {temperature}°C",
-                "severity": alert_severity,
-                "level": temp_status,
-            }
-        )
-
-    # Check humidity with 3 levels: Low, Normal, High
-    if humidity > thresholds["humidity_max"]:  # High
-        humidity_status = "high"
-        alert_key = "humidity_high"
-        alert_severity = "high"
-        alert_message = (
-            f"💧 Humidity HIGH: {humidity}% (Above {thresholds['humidity_max']}%)"
-        )
-    elif humidity < thresholds["humidity_min"]:  # Low
-        humidity_status = "low"
-        alert_key = "humidity_low"
-        alert_severity = "low"
-        alert_message = (
-            f"🏜️ Humidity LOW: {humidity}% (Below {thresholds['humidity_min']}%)"
-        )
-    else:  # Normal
-        humidity_status = "normal"
-        alert_key = "humidity_normal"
-        alert_severity = "success"
-        alert_message = None
-
-    if alert_message and (
-        alert_key not in last_alert_time
-        or (current_time - last_alert_time[alert_key]).seconds > 600
-    ):  # 10 minutes
-        should_send_alert = True
-        last_alert_time[alert_key] = current_time
-        alert_messages.append(alert_message)
-        alerts.append(
-            {
-                "type": alert_key,
-                "message": f"Humidity: {humidity}%",
-                "severity": alert_severity,
-                "level": humidity_status,
-            }
+    for _, alert_key, value, threshold in fired:
+        telegram, dashboard, severity, level = ALERT_FORMATS[alert_key]
+        alert_messages.append(
+            (alert_key, telegram.format(value=value, threshold=threshold))
         )
         alerts.append(
             {
                 "type": alert_key,
-                "message": f"Humidity: {humidity}%",
-                "severity": alert_severity,
-                "level": humidity_status,
-            }
-        )
-
-    # Check eCO2 with 3 levels: Low, Normal, High
-    if eco2 > thresholds["eco2_max"]:  # High
-        eco2_status = "high"
-        alert_key = "eco2_high"
-        alert_severity = "high"
-        alert_message = (
-            f"⚠️ CO2 level HIGH: {eco2} ppm (Above {thresholds['eco2_max']} ppm)"
-        )
-    elif eco2 < thresholds["eco2_min"]:  # Low
-        eco2_status = "low"
-        alert_key = "eco2_low"
-        alert_severity = "low"
-        alert_message = (
-            f"🌿 CO2 level LOW: {eco2} ppm (Below {thresholds['eco2_min']} ppm)"
-        )
-    else:  # Normal
-        eco2_status = "normal"
-        alert_key = "eco2_normal"
-        alert_severity = "success"
-        alert_message = None
-
-    if alert_message and (
-        alert_key not in last_alert_time
-        or (current_time - last_alert_time[alert_key]).seconds > 600
-    ):  # 10 minutes
-        should_send_alert = True
-        last_alert_time[alert_key] = current_time
-        alert_messages.append(alert_message)
-        alerts.append(
-            {
-                "type": alert_key,
-                "message": f"CO2 level: {eco2} ppm",
-                "severity": alert_severity,
-                "level": eco2_status,
+                "message": dashboard.format(value=value),
+                "severity": severity,
+                "level": level,
             }
         )
 
@@ -508,43 +766,480 @@ def check_thresholds_and_alert(room, tvoc, temperature, humidity, eco2):
         4: "Poor",
         5: "Unhealthy",
     }
-    aqi = (current_data_bedroom if room == "bedroom" else current_data_workingroom).get(
-        "aqi", 1
-    )
+    aqi = hot_window.latest(room_id).get("aqi", 1)
     aqi_text = aqi_descriptions.get(aqi, "Undefined")
-    alert_messages.append(f"🌟 AQI Level: {aqi_text}")
+    alert_messages.append((AQI_ALERT_KEY, f"🌟 AQI Level: {aqi_text}"))
 
     # Send combined alert if there are any messages
-    if should_send_alert:
-        combined_message = "\n".join(alert_messages)
-        recommendations = "\n💨 Recommendation: Open windows or increase ventilation!"
-        send_telegram_alert(room, combined_message + recommendations)
-
-        # Log alerts to database
-        for message in alert_messages[:-1]:  # Exclude AQI message from logging
-            db.log_alert(room, "environmental_alert", message, 0, 0)
+    if fired:
+        # Telegram and alert logging run on the alert dispatcher
+        alert_dispatcher.submit(registry.room_names[room_id], alert_messages)
 
     return alerts
 
 
+# Ingest pipeline
+Sample = namedtuple(
+    "Sample", "room room_id device tvoc temperature humidity eco2 aqi timestamp"
+)
+
+
+class Stage:
+    """Worker thread draining a bounded queue, so one slow stage cannot stall the others"""
+
+    def __init__(self, name, handler, maxsize=1000):
+        self.name = name
+        self.handler = handler
+        self.queue = queue.Queue(maxsize=maxsize)
+        self.processed = 0
+        self.dropped = 0
+        self.thread = threading.Thread(target=self._run, name=name, daemon=True)
+
+    def start(self):
+        self.thread.start()
+
+    def put(self, item):
+        """Enqueue without blocking the caller, dropping the oldest item when full"""
+        while True:
+            try:
+                self.queue.put_nowait(item)
+                return
+            except queue.Full:
+                try:
+                    self.queue.get_nowait()
+                except queue.Empty:
+                    continue
+                self.dropped += 1
+                if self.dropped % 100 == 1:
+                    logger.warning(
+                        f"{self.name} stage full, dropped {self.dropped} items"
+                    )
+
+    def stats(self):
+        return {
+            "queued": self.queue.qsize(),
+            "processed": self.processed,
+            "dropped": self.dropped,
+        }
+
+    def _run(self):
+        while True:
+            item = self.queue.get()
+            try:
+                self.handler(item)
+            except Exception as e:
+                logger.error(f"{self.name} stage error: {e}")
+            self.processed += 1
+
+
+# Write-ahead log record of a sample, followed by the room name in UTF-8:
+# timestamp, device, aqi, tvoc, temperature, humidity, eco2
+SAMPLE_RECORD = struct.Struct("<dIHdddd")
+
+
+def encode_sample(sample):
+    return (
+        SAMPLE_RECORD.pack(
+            sample.timestamp.timestamp(),
+            sample.device,
+            sample.aqi,
+            sample.tvoc,
+            sample.temperature,
+            sample.humidity,
+            sample.eco2,
+        )
+        + sample.room.encode()
+    )
+
+
+def decode_sample(record):
+    ts, device, aqi, tvoc, temperature, humidity, eco2 = SAMPLE_RECORD.unpack_from(
+        record
+    )
+    room = record[SAMPLE_RECORD.size :].decode()
+    return Sample(
+        room,
+        registry.room_id(room),
+        device,
+        tvoc,
+        temperature,
+        humidity,
+        eco2,
+        aqi,
+        datetime.fromtimestamp(ts),
+    )
+
+
+class BatchWriter:
+    """
+    Storage stage. Samples are appended to the write-ahead log; the writer
+    thread reads them back from there and group-commits them, flushing on
+    batch size or latency deadline. Each commit also stores the log position
+    it reached, so after a restart or a database outage the writer resumes
+    from exactly that point and nothing is lost or stored twice.
+    """
+
+    def __init__(self, wal, max_batch, max_delay, durability):
+        self.name = "storage"
+        self.wal = wal
+        # "sync" keeps the old one-commit-per-sample behaviour
+        self.max_batch = 1 if durability == "sync" else max_batch
+        self.max_delay = max_delay
+        self.position = None  # Log position committed to the database
+        self.processed = 0
+        self.replayed = 0
+        self.failures = 0
+        self.batches = 0
+        self.latencies = deque(maxlen=1000)  # Ingest-to-durable seconds
+        self.thread = threading.Thread(target=self._run, name="storage", daemon=True)
+        wal.add_consumer(self.name)
+
+    def start(self):
+        self.thread.start()
+
+    def put(self, sample):
+        """Append to the log, the writer thread picks the sample up from there"""
+        self.wal.append(encode_sample(sample))
+
+    def stats(self):
+        latencies = sorted(self.latencies)
+        p99 = latencies[int(len(latencies) * 0.99)] if latencies else 0
+        position = self.wal.end_lsn if self.position is None else self.position
+        return {
+            "lag_bytes": self.wal.end_lsn - position,
+            "processed": self.processed,
+            "replayed": self.replayed,
+            "failures": self.failures,
+            "batches": self.batches,
+            "p99_durable_ms": round(p99 * 1000, 1),
+        }
+
+    def _checkpoint(self):
+        """Position to resume from, waiting for the database if it is down"""
+        delay = 1
+        while True:
+            try:
+                lsn = db.get_checkpoint()
+                break
+            except Exception as e:
+                logger.error(f"Error reading ingest checkpoint: {e}")
+                time.sleep(delay)
+                delay = min(delay * 2, 60)
+                db.connect()
+        if not self.wal.start_lsn <= lsn <= self.wal.end_lsn:
+            logger.warning(
+                f"Ingest checkpoint {lsn} is outside the write-ahead log "
+                f"({self.wal.start_lsn}-{self.wal.end_lsn}), resuming at its start"
+            )
+            lsn = self.wal.start_lsn
+        if lsn < self.wal.end_lsn:
+            logger.info(f"Replaying {self.wal.end_lsn - lsn} bytes of write-ahead log")
+        return lsn
+
+    def _run(self):
+        self.position = self._checkpoint()
+        replay_end = self.wal.end_lsn
+        reader = WalReader(self.wal, self.position)
+        while True:
+            self.wal.wait(reader.position, None)
+            deadline = time.monotonic() + self.max_delay
+            batch = reader.read(self.max_batch)
+            while len(batch) < self.max_batch:
+                timeout = deadline - time.monotonic()
+                if timeout <= 0 or not self.wal.wait(reader.position, timeout):
+                    break
+                batch += reader.read(self.max_batch - len(batch))
+            if not batch:
+                continue  # Only padding or a skipped segment tail
+            replaying = self.position < replay_end
+            self._flush([decode_sample(record) for record in batch], reader.position)
+            if replaying:
+                self.replayed += len(batch)
+
+    def _flush(self, batch, lsn):
+        """Commit until it succeeds; meanwhile the samples wait in the log"""
+        delay = 0.5
+        while True:
+            try:
+                db.insert_sensor_batch(batch, lsn)
+                break
+            except Exception as e:
+                self.failures += 1
+                logger.error(f"Error saving batch of {len(batch)} samples: {e}")
+                time.sleep(delay)
+                delay = min(delay * 2, 30)
+                # A new connection also discards the failed transaction
+                db.connect()
+        self.position = lsn
+        self.wal.release(self.name, lsn)
+        now = datetime.now()
+        self.latencies.append((now - batch[0].timestamp).total_seconds())
+        self.processed += len(batch)
+        self.batches += 1
+
+
+# Heads opened this long ago are sealed even if not full, so rooms that
+# publish rarely do not hold the log back
+HISTORY_SEAL_SECONDS = 3600
+# Seconds between history checkpoints
+HISTORY_CHECKPOINT_SECONDS = 5
+
+
+class HistoryWriter:
+    """
+    History stage. Reads samples back from the write-ahead log like the
+    storage stage and appends them to the block-file store. Rows are only
+    durable once their room's head is sealed into a block file, so the
+    checkpoint kept in HISTORY_DIR is the oldest log position still held in
+    an open head: after a restart everything from there is replayed, and
+    the store skips the rows its block files already hold.
+    """
+
+    def __init__(self, wal, store):
+        self.name = "history"
+        self.wal = wal
+        self.store = store
+        self.handler = self._append  # (lsn, sample)
+        self.position = None  # Log position read up to
+        self.checkpoint = None  # Log position saved in the store
+        self.processed = 0
+        self.replayed = 0
+        self.thread = threading.Thread(target=self._run, name="history", daemon=True)
+        wal.add_consumer(self.name)
+        sealed = store.sealed_lsn()
+        if wal.end_lsn < sealed:
+            # A new log would reuse positions the block files already claim
+            wal.restart_at(sealed)
+            if wal.end_lsn < sealed:
+                logger.error(
+                    f"Write-ahead log ends at {wal.end_lsn} but history holds "
+                    f"samples up to {sealed}, replayed samples may be skipped"
+                )
+
+    def start(self):
+        self.thread.start()
+
+    def stats(self):
+        position = self.wal.end_lsn if self.position is None else self.position
+        checkpoint = position if self.checkpoint is None else self.checkpoint
+        return {
+            "lag_bytes": self.wal.end_lsn - position,
+            "processed": self.processed,
+            "replayed": self.replayed,
+            "checkpoint_lag_bytes": position - checkpoint,
+        }
+
+    def _append(self, item):
+        lsn, sample = item
+        self.store.append(
+            sample.room, sample.timestamp.timestamp(), sample._asdict(), lsn
+        )
+
+    def _run(self):
+        lsn = self.store.read_checkpoint()
+        if not self.wal.start_lsn <= lsn <= self.wal.end_lsn:
+            logger.warning(
+                f"History checkpoint {lsn} is outside the write-ahead log "
+                f"({self.wal.start_lsn}-{self.wal.end_lsn}), resuming at its start"
+            )
+            lsn = self.wal.start_lsn
+        replay_end = self.wal.end_lsn
+        reader = WalReader(self.wal, lsn, with_lsn=True)
+        self.position = self.checkpoint = lsn
+        next_checkpoint = time.monotonic() + HISTORY_CHECKPOINT_SECONDS
+        while True:
+            timeout = next_checkpoint - time.monotonic()
+            if timeout > 0 and self.wal.wait(reader.position, timeout):
+                for item in reader.read(1000):
+                    lsn, record = item
+                    try:
+                        self.handler((lsn, decode_sample(record)))
+                    except Exception as e:
+                        logger.error(f"history stage error: {e}")
+                    if lsn < replay_end:
+                        self.replayed += 1
+                    self.processed += 1
+                self.position = reader.position
+                continue
+            next_checkpoint = time.monotonic() + HISTORY_CHECKPOINT_SECONDS
+            try:
+                self._checkpoint(reader.position)
+            except Exception as e:
+                logger.error(f"Error saving history checkpoint: {e}")
+
+    def _checkpoint(self, position):
+        """Seal idle heads, then save and release what no head holds any more"""
+        self.store.seal_idle(HISTORY_SEAL_SECONDS)
+        lsn = self.store.replay_from(position)
+        if lsn != self.checkpoint:
+            self.store.write_checkpoint(lsn)
+            self.checkpoint = lsn
+        self.wal.release(self.name, lsn)
+
+
+def evaluate_sample(sample):
+    """Evaluate thresholds on the owning shard, then hand the sample to live push"""
+    alerts = check_thresholds_and_alert(
+        sample.room_id, sample.tvoc, sample.temperature, sample.humidity, sample.eco2
+    )
+    push_stage.put((sample, alerts))
+
+
+class SkipSids(list):
+    """skip_sid list whose membership test, run per recipient, is a set lookup"""
+
+    def __init__(self, sids):
+        super().__init__(sids)
+        self.sids = frozenset(sids)
+
+    def __contains__(self, sid):
+        return sid in self.sids
+
+
+def send_live_frame(room, frame, skip):
+    # One packet, encoded once, for every client of the room but skip
+    socketio.emit(
+        "live", frame, namespace=f"/{room}", skip_sid=SkipSids(skip) if skip else []
+    )
+
+
+def live_queue(room, sid):
+    """
+    Packets queued on a dashboard's Engine.IO socket and not sent yet, which
+    is how far its connection has fallen behind
+    """
+    eio_sid = socketio.server.manager.eio_sid_from_sid(sid, f"/{room}")
+    socket = socketio.server.eio.sockets.get(eio_sid)
+    return socket.queue.queue if socket else ()
+
+
+live_push = LivePush(send_live_frame)
+
+
+def push_sample(item):
+    """Live push stage: send real-time data via WebSocket"""
+    sample, alerts = item
+    live_push.publish(sample.room, encode_frame(sample, bool(alerts)))
+    if alerts:
+        # Rare, so they stay JSON and reach every client uncoalesced
+        socketio.emit(f"alerts_{sample.room}", alerts, namespace=f"/{sample.room}")
+
+
+def wal_pressure(backlog, dropped):
+    """Write-ahead log near or over WAL_MAX_MB: the database is not keeping up"""
+    if dropped:
+        message = (
+            f"💾 Write-ahead log full ({WAL_MAX_MB} MB): {dropped >> 20} MB of "
+            "samples not yet in the database were dropped"
+        )
+        logger.error(message)
+    else:
+        message = (
+            f"💾 Write-ahead log at {backlog >> 20} of {WAL_MAX_MB} MB: "
+            "the database is not keeping up"
+        )
+        logger.warning(message)
+    alert_dispatcher.submit(SERVER_ALERT_ROOM, [(SERVER_ALERT_KEY, message)])
+
+
+# Every decoded sample is logged here before anything else stores it
+wal = WriteAheadLog(
+    WAL_DIR, WAL_SEGMENT_MB << 20, WAL_SYNC_MS / 1000, WAL_MAX_MB << 20, wal_pressure
+)
+storage_stage = BatchWriter(wal, DB_BATCH_SIZE, DB_BATCH_DELAY_MS / 1000, DB_DURABILITY)
+history_writer = HistoryWriter(wal, history_store)
+push_stage = Stage("push", push_sample)
+alert_dispatcher = AlertDispatcher(TELEGRAM_RATE_PER_MIN)
+
+
+# Retained "tvoc,eco2,aqi,temperature,humidity" published by the room nodes
+SNAPSHOT_SUFFIX = "/snapshot"
+# Snapshots are only wanted right after (re)connecting, while retained
+# messages are delivered; afterwards every reading would arrive twice
+SNAPSHOT_WINDOW_SECONDS = 10
+# Epoch of the current MQTT session, snapshots older than its stream are skipped
+mqtt_connected_at = 0.0
+# "offset_ms,period_ms" publish slot assignment consumed by the room nodes
+SLOT_SUFFIX = "/slot"
+SLOT_REFRESH_SECONDS = 300
+
+
 # MQTT Client functions
 def on_connect(client, userdata, flags, rc):
     """MQTT connection callback"""
+    global mqtt_connected_at
     if rc == 0:
         logger.info("MQTT connection successful")
-        client.subscribe([(MQTT_TOPIC_BEDROOM, 0), (MQTT_TOPIC_WORKINGROOM, 0)])
+        mqtt_connected_at = time.time()
+        snapshots = registry.subscriptions(SNAPSHOT_SUFFIX)
+        client.subscribe([(topic, 0) for topic in registry.subscriptions() + snapshots])
+        timer = threading.Timer(
+            SNAPSHOT_WINDOW_SECONDS, client.unsubscribe, [snapshots]
+        )
+        timer.daemon = True
+        timer.start()
     else:
         logger.error(f"MQTT connection error: {rc}")
 
 
+# A message as handed from the MQTT thread to the shard owning its room
+Received = namedtuple("Received", "device payload snapshot timestamp")
+
+
 def on_message(client, userdata, msg):
-    """MQTT message callback"""
+    """MQTT message callback: route to the shard that owns the device's room"""
+    snapshot = msg.topic.endswith(SNAPSHOT_SUFFIX)
+    topic = msg.topic[: -len(SNAPSHOT_SUFFIX)] if snapshot else msg.topic
+    device = registry.resolve(topic)
+    if device is None:
+        return  # Not a device topic
+    ingest.put(
+        registry.device_room[device],
+        Received(device, msg.payload, snapshot, datetime.now()),
+    )
+
+
+def handle_snapshot(item):
+    """Prime current data from a retained device snapshot after (re)connecting"""
+    if not item.payload:
+        return  # Cleared by the room node's last will
+    if registry.last_seen[item.device] >= mqtt_connected_at:
+        return  # The stream of this session already carries newer data
+    room_id = registry.device_room[item.device]
+    tvoc, eco2, aqi, temperature, humidity = item.payload.decode().split(",")
+    hot_window.publish(
+        room_id,
+        {
+            "tvoc": float(tvoc),
+            "temperature": float(temperature),
+            "humidity": float(humidity),
+            "eco2": float(eco2),
+            "aqi": int(aqi),
+            "timestamp": item.timestamp,
+        },
+    )
+    logger.info(
+        f"Primed {registry.room_names[room_id]} from snapshot: {item.payload.decode()}"
+    )
+
+
+def ingest_message(item):
+    """Shard worker: decode, update the room's hot window and evaluate alerts"""
     try:
-        data = json.loads(msg.payload.decode())
-        room = "bedroom" if msg.topic == MQTT_TOPIC_BEDROOM else "workingroom"
-        current_data = (
-            current_data_bedroom if room == "bedroom" else current_data_workingroom
-        )
+        if item.snapshot:
+            handle_snapshot(item)
+            return
+
+        device = item.device
+        data = json.loads(item.payload.decode())
+        number = data.get("device")
+        if number is not None and number != registry.device_number[device]:
+            logger.warning(
+                f"Device {number} published on {registry.device_topic[device]}, dropped"
+            )
+            return
+        room_id = registry.device_room[device]
+        room = registry.room_names[room_id]
 
         tvoc = float(data.get("tvoc", data.get("TVOC", 0)))
         temperature = float(data.get("temperature", data.get("Temperature", 0)))
@@ -553,37 +1248,36 @@ def on_message(client, userdata, msg):
         aqi = int(data.get("aqi", data.get("AQI", 1)))
 
         # Update current data
-        current_data.update(
-            {
-                "tvoc": tvoc,
-                "temperature": temperature,
-                "humidity": humidity,
-                "eco2": eco2,
-                "aqi": aqi,
-                "timestamp": datetime.now(),
-            }
+        sample = Sample(
+            room,
+            room_id,
+            registry.device_number[device],
+            tvoc,
+            temperature,
+            humidity,
+            eco2,
+            aqi,
+            item.timestamp,
         )
-
-        # Save to database
-        db.insert_sensor_data(room, tvoc, temperature, humidity, eco2, aqi)
-
-        # Check thresholds and alert
-        alerts = check_thresholds_and_alert(room, tvoc, temperature, humidity, eco2)
-
-        # Send real-time data via WebSocket
-        socketio.emit(
-            f"sensor_data_{room}",
+        ts = sample.timestamp.timestamp()
+        registry.last_seen[device] = ts
+        hot_window.publish(
+            room_id,
             {
                 "tvoc": tvoc,
                 "temperature": temperature,
                 "humidity": humidity,
                 "eco2": eco2,
                 "aqi": aqi,
-                "timestamp": current_data["timestamp"].strftime("%H:%M:%S"),
-                "alerts": alerts,
+                "timestamp": sample.timestamp,
             },
-            namespace=f"/{room}",
         )
+        hot_window.append(room_id, (ts, tvoc, temperature, humidity, eco2, aqi))
+
+        # Storage and history read it back from the log; alert state is
+        # owned by this shard
+        storage_stage.put(sample)
+        evaluate_sample(sample)
 
         logger.info(
             f"Received data for {room}: TVOC={tvoc:.2f}ppb, T={temperature}°C, "
@@ -594,12 +1288,91 @@ def on_message(client, userdata, msg):
         logger.error(f"MQTT processing error: {e}")
 
 
+# Decoding, hot window and alerting, partitioned by room over INGEST_SHARDS workers
+ingest = ShardPool(INGEST_SHARDS, ingest_message)
+
+# Rows deleted per step of the retention purge
+PURGE_BATCH = 1000
+
+
+def purge_room(room, cutoff):
+    """
+    Compaction job: delete a room's rows older than cutoff, one batch per
+    step, but only the ranges of its history archives and only if the
+    database holds no more rows there than the archive does
+    """
+    done = db.purged_until(room)
+    for archive in history_store.files(room):
+        if (
+            not isinstance(archive, ArchiveFile)
+            or archive.t_max <= done
+            or archive.t_max >= cutoff
+        ):
+            continue
+        stored = db.count_range(room, archive.t_min, archive.t_max)
+        yield 100
+        if stored > archive.count:
+            logger.warning(
+                f"Keeping {stored} database rows of {room} that {archive.path} "
+                f"holds only {archive.count} of"
+            )
+            continue
+        while True:
+            deleted = db.purge_range(room, archive.t_min, archive.t_max, PURGE_BATCH)
+            yield deleted * 100  # Rough bytes per row, data and index
+            if deleted < PURGE_BATCH:
+                break
+
+
+def database_jobs(now):
+    if DB_RETENTION_DAYS:
+        cutoff = now - DB_RETENTION_DAYS * 86400
+        for room in list(history_store.rooms):
+            yield purge_room(room, cutoff)
+
+
+# Merges, archives and expires history on idle shards within COMPACTION_KB_S
+compactor = Compactor(
+    history_store,
+    ingest.background,
+    COMPACTION_KB_S * 1024,
+    HISTORY_RAW_DAYS,
+    HISTORY_ARCHIVE_DAYS,
+    database_jobs,
+)
+PIPELINE_STAGES = [
+    ingest,
+    wal,
+    storage_stage,
+    history_writer,
+    push_stage,
+    alert_dispatcher,
+    compactor,
+]
+
+
 # Initialize MQTT Client
 mqtt_client = mqtt.Client()
 mqtt_client.on_connect = on_connect
 mqtt_client.on_message = on_message
 
 
+def publish_slot_schedule():
+    """Spread the room nodes evenly over one publish period"""
+    topics = list(registry.device_topic)
+    for i, topic in enumerate(topics):
+        offset = i * MQTT_SLOT_PERIOD_MS // len(topics)
+        mqtt_client.publish(topic + SLOT_SUFFIX, f"{offset},{MQTT_SLOT_PERIOD_MS}")
+
+
+def slot_scheduler():
+    """Re-send slot assignments periodically so node clocks do not drift apart"""
+    while True:
+        if mqtt_client.is_connected():
+            publish_slot_schedule()
+        time.sleep(SLOT_REFRESH_SECONDS)
+
+
 def start_mqtt():
     """Start MQTT client"""
     try:
@@ -694,14 +1467,12 @@ MAIN_PAGE_TEMPLATE = """
             <p>Select a room to monitor indoor air quality</p>
         </div>
         <div class="grid">
-            <div class="card bedroom" onclick="window.location.href='/bedroom'">
-                <h2>Bedroom</h2>
-                <p>Monitor air quality in the bedroom</p>
-            </div>
-            <div class="card workingroom" onclick="window.location.href='/workingroom'">
-                <h2>Working Room</h2>
-                <p>Monitor air quality in the working room</p>
+            {% for room, title in rooms %}
+            <div class="card {{ room }}" onclick="window.location.href='/{{ room }}'">
+                <h2>{{ title }}</h2>
+                <p>Monitor air quality in the {{ title | lower }}</p>
             </div>
+            {% endfor %}
         </div>
     </div>
 </body>
@@ -1210,6 +1981,7 @@ DASHBOARD_TEMPLATE = """
     </div>
     <script>
         // Initialize global variables
+        const CHART_POINTS = 10; // Points kept on the live chart
         let socket;
         let sensorChart;
         let chartData = {
@@ -1251,12 +2023,42 @@ DASHBOARD_TEMPLATE = """
                 showAlerts(data.alerts || []);
             });
 
+            // Live samples arrive as binary frames, see livepush.py
+            socket.on("live", function (frame) {
+                const data = decodeLiveFrame(frame);
+                updateSensorDisplay(data);
+                updateChart(data);
+                if (!data.hasAlerts) {
+                    showAlerts([]);
+                }
+            });
+
+            socket.on("alerts_" + room, function (alerts) {
+                showAlerts(alerts);
+            });
+
             socket.on("thresholds_updated", function (thresholds) {
                 console.log("⚙️ Thresholds updated:", thresholds);
                 updateThresholdForm(thresholds);
             });
         }
 
+        // Layout of livepush.FRAME: "<IHhHHBB", little endian, in base64
+        function decodeLiveFrame(frame) {
+            const bytes = Uint8Array.from(atob(frame), (c) => c.charCodeAt(0));
+            const view = new DataView(bytes.buffer);
+            const time = new Date(view.getUint32(0, true) * 1000);
+            return {
+                timestamp: time.toLocaleTimeString("en-GB"),
+                tvoc: view.getUint16(4, true),
+                temperature: view.getInt16(6, true) / 100,
+                humidity: view.getUint16(8, true) / 100,
+                eco2: view.getUint16(10, true),
+                aqi: view.getUint8(12),
+                hasAlerts: (view.getUint8(13) & 1) !== 0,
+            };
+        }
+
         function updateConnectionStatus(connected) {
             const statusEl = document.getElementById("connectionStatus");
             if (connected) {
@@ -1546,7 +2348,7 @@ DASHBOARD_TEMPLATE = """
             chartData.tempData.push(data.temperature);
             chartData.humidityData.push(data.humidity);
             chartData.eco2Data.push(data.eco2);
-            if (chartData.labels.length > 10) {
+            if (chartData.labels.length > CHART_POINTS) {
                 console.log("Data limit reached, removing old point:", chartData.labels.length);
                 chartData.labels.shift();
                 chartData.tvocData.shift();
@@ -1589,7 +2391,7 @@ DASHBOARD_TEMPLATE = """
                 .catch((error) => {
                     console.error("❌ Error loading current data:", error);
                 });
-            fetch("/api/history/" + room + "?hours=1")
+            fetch("/api/history/" + room + "?hours=1&last=" + CHART_POINTS)
                 .then((response) => response.json())
                 .then((data) => {
                     console.log("📈 Historical data:", data);
@@ -1599,8 +2401,8 @@ DASHBOARD_TEMPLATE = """
                     chartData.humidityData = [];
                     chartData.eco2Data = [];
                     if (data && data.length > 0) {
-                        const recentData = data.slice(-5);
-                        recentData.forEach((item) => {
+                        // Last CHART_POINTS raw readings, as live updates append them
+                        data.forEach((item) => {
                             const time = new Date(item.timestamp).toLocaleTimeString();
                             chartData.labels.push(time);
                             chartData.tvocData.push(item.tvoc);
@@ -1717,34 +2519,36 @@ DASHBOARD_TEMPLATE = """
 """
 
 
+# Card titles that differ from the capitalized room name
+ROOM_TITLES = {"workingroom": "Working Room"}
+
+
 # Flask Routes
 @app.route("/")
 def main_page():
     """Main selection page"""
-    return render_template_string(MAIN_PAGE_TEMPLATE)
-
+    rooms = [
+        (room, ROOM_TITLES.get(room, room.capitalize())) for room in registry.room_names
+    ]
+    return render_template_string(MAIN_PAGE_TEMPLATE, rooms=rooms)
 
-@app.route("/bedroom")
-def bedroom_dashboard():
-    """Bedroom dashboard route"""
-    return render_template_string(DASHBOARD_TEMPLATE, room_name="Bedroom")
 
-
-@app.route("/workingroom")
-def workingroom_dashboard():
-    """Workingroom dashboard route"""
-    return render_template_string(DASHBOARD_TEMPLATE, room_name="Workingroom")
+@app.route("/<room>")
+def room_dashboard(room):
+    """Dashboard route of any registered room"""
+    if registry.room_id(room) is None:
+        return "Unknown room", 404
+    return render_template_string(DASHBOARD_TEMPLATE, room_name=room.capitalize())
 
 
 @app.route("/api/current-data/<room>")
 def api_current_data(room):
     """API endpoint for current sensor data"""
-    if room not in ["bedroom", "workingroom"]:
+    room_id = registry.room_id(room)
+    if room_id is None:
         return jsonify({"error": "Invalid room"}), 400
-    current_data = (
-        current_data_bedroom if room == "bedroom" else current_data_workingroom
-    )
-    thresholds = thresholds_bedroom if room == "bedroom" else thresholds_workingroom
+    current_data = hot_window.latest(room_id)
+    thresholds = room_thresholds[room_id]
     return jsonify(
         {
             "tvoc": current_data["tvoc"],
@@ -1758,22 +2562,142 @@ def api_current_data(room):
     )
 
 
+# One raw history row, byte for byte as jsonify() renders the row dicts
+HISTORY_ROW_JSON = (
+    '{"aqi":%d,"eco2":%r,"humidity":%r,"temperature":%r,'
+    '"timestamp":"%s:%02d:%02d","tvoc":%r}'
+)
+
+
+def stream_history(chunks):
+    """
+    Encode buffers of packed history rows as a JSON array, one piece per
+    buffer. The local "YYYY-mm-dd HH" prefix is formatted once per hour
+    instead of calling strftime for every row.
+    """
+    hour_start = hour_end = 0
+    prefix = ""
+    separator = "["
+    for chunk in chunks:
+        parts = []
+        for t, tvoc, temperature, humidity, eco2, aqi in ROW.iter_unpack(chunk):
+            if not hour_start <= t < hour_end:
+                local = time.localtime(t)
+                hour_start = t - local.tm_min * 60 - local.tm_sec
+                hour_end = hour_start + 3600
+                prefix = time.strftime("%Y-%m-%d %H", local)
+            offset = t - hour_start
+            parts.append(
+                HISTORY_ROW_JSON
+                % (
+                    aqi,
+                    eco2,
+                    humidity,
+                    temperature,
+                    prefix,
+                    offset // 60,
+                    offset % 60,
+                    tvoc,
+                )
+            )
+        if parts:
+            yield separator + ",".join(parts)
+            separator = ","
+    yield "[]" if separator == "[" else "]"
+
+
 @app.route("/api/history/<room>")
 def api_history(room):
     """API endpoint for historical data"""
-    if room not in ["bedroom", "workingroom"]:
+    room_id = registry.room_id(room)
+    if room_id is None:
         return jsonify({"error": "Invalid room"}), 400
     hours = request.args.get("hours", 24, type=int)
-    data = db.get_recent_data(room, hours)
+    points = request.args.get("points", MAX_HISTORY_POINTS, type=int)
+    mode = request.args.get("mode", "lttb")
+    end = time.time()
+    start = end - hours * 3600
+    metric = request.args.get("metric")
+    above = request.args.get("above", type=float)
+    if metric in METRICS and above is not None:
+        # Threshold query: the raw rows with metric > above, not decimated;
+        # block files whose min/max index rules them out are not read
+        return Response(
+            stream_history(history_store.scan_above(room, start, end, metric, above)),
+            mimetype="application/json",
+        )
+    # Rows are (timestamp, tvoc, temperature, humidity, eco2, aqi, rollup)
+    last = request.args.get("last", 0, type=int)
+    tier = pick_tier(hours * 3600 / max(points, 1))
+    if last > 0:
+        recent = hot_window.tail(room_id, start, end, last)
+    else:
+        recent = hot_window.query(room_id, start, end)
+    if last > 0:
+        # Live chart seed: the newest raw rows of the range, one per label of
+        # its category axis, never decimated
+        if recent is None and not history_store.covers(room, start):
+            return jsonify(db.get_recent_data(room, hours)[-last:])
+        if recent is None:
+            recent = history_store.query(room, start, end)[-last:]
+        rows = [row + (None,) for row in recent]
+        mode = "raw"
+    elif recent is not None:
+        # Short ranges are served from memory, decimated from the raw rows
+        # even where the store would answer from a rollup tier
+        rows = [row + (None,) for row in recent]
+    elif not history_store.covers(room, start):
+        # Store does not reach back that far yet
+        return jsonify(db.get_recent_data(room, hours))
+    elif tier is None:
+        if mode not in ("lttb", "minmax") or (
+            history_store.count(room, start, end) <= points
+        ):
+            # Nothing to decimate: stream straight from the mapped block files
+            return Response(
+                stream_history(history_store.scan(room, start, end)),
+                mimetype="application/json",
+            )
+        rows = [row + (None,) for row in history_store.query(room, start, end)]
+    else:
+        rows = [
+            (bucket, *avgs, (count, mins, maxs))
+            for bucket, count, mins, maxs, avgs in history_store.query_rollup(
+                room, start, end, tier
+            )
+        ]
+    if mode in ("lttb", "minmax"):
+        rows = decimate_rows(rows, points, range(1, len(METRICS) + 1), mode=mode)
+
+    data = []
+    for t, tvoc, temperature, humidity, eco2, aqi, rollup in rows:
+        row = {
+            "tvoc": tvoc,
+            "temperature": temperature,
+            "humidity": humidity,
+            "eco2": eco2,
+            "aqi": int(aqi) if rollup is None else aqi,
+            "timestamp": datetime.fromtimestamp(t).strftime("%Y-%m-%d %H:%M:%S"),
+        }
+        if rollup is not None:
+            # Rollup buckets: averages under the usual keys plus min/max and count
+            count, mins, maxs = rollup
+            row["count"] = count
+            for i, metric in enumerate(METRICS):
+                row[metric] = round(row[metric], 2)
+                row[f"{metric}_min"] = mins[i]
+                row[f"{metric}_max"] = maxs[i]
+        data.append(row)
     return jsonify(data)
 
 
 @app.route("/api/thresholds/<room>", methods=["GET", "POST"])
 def api_thresholds(room):
     """API endpoint for threshold management"""
-    if room not in ["bedroom", "workingroom"]:
+    room_id = registry.room_id(room)
+    if room_id is None:
         return jsonify({"error": "Invalid room"}), 400
-    thresholds = thresholds_bedroom if room == "bedroom" else thresholds_workingroom
+    thresholds = room_thresholds[room_id]
     if request.method == "POST":
         try:
             new_thresholds = request.get_json()
@@ -1819,6 +2743,7 @@ def api_thresholds(room):
                     400,
                 )
             db.update_thresholds(room, thresholds)
+            rule_engine.set_thresholds(room_id, thresholds)
             socketio.emit("thresholds_updated", thresholds, namespace=f"/{room}")
             logger.info(f"Thresholds updated successfully for {room}: {thresholds}")
             return jsonify({"success": True, "thresholds": thresholds})
@@ -1828,74 +2753,168 @@ def api_thresholds(room):
     return jsonify(thresholds)
 
 
+@app.route("/api/backtest/<room>", methods=["POST"])
+def api_backtest(room):
+    """Replay stored history against candidate thresholds"""
+    room_id = registry.room_id(room)
+    if room_id is None:
+        return jsonify({"error": "Invalid room"}), 400
+    body = request.get_json() or {}
+    thresholds = room_thresholds[room_id]
+    # Candidates only need the keys they change
+    candidates = [
+        {**thresholds, **candidate} for candidate in body.get("candidates", [{}])
+    ]
+    try:
+        hours = float(body.get("hours", 24))
+    except (TypeError, ValueError):
+        return jsonify({"error": "Invalid hours"}), 400
+    # The whole range is held in memory during the replay
+    if not 0 < hours <= BACKTEST_MAX_HOURS:
+        return jsonify({"error": f"hours must be in (0, {BACKTEST_MAX_HOURS}]"}), 400
+    try:
+        end = time.time()
+        started = time.perf_counter()
+        times, values = history_store.query_columns(room, end - hours * 3600, end)
+        results = replay(times, *values, candidates)
+    except (KeyError, TypeError, ValueError) as e:
+        return jsonify({"error": f"Invalid candidate: {e}"}), 400
+    return jsonify(
+        {
+            "samples": len(times),
+            "from": (
+                datetime.fromtimestamp(times[0]).strftime("%Y-%m-%d %H:%M:%S")
+                if times
+                else None
+            ),
+            "elapsed_ms": round((time.perf_counter() - started) * 1000, 1),
+            "results": results,
+        }
+    )
+
+
 @app.route("/api/test-alert/<room>")
 def test_alert(room):
     """API for testing alert system"""
-    if room not in ["bedroom", "workingroom"]:
+    if registry.room_id(room) is None:
         return jsonify({"error": "Invalid room"}), 400
     message = f"🧪 TEST ALERT from {room.capitalize()} - System is working normally!"
     send_telegram_alert(room, message)
     return jsonify({"message": f"Test alert sent for {room}"})
 
 
+@app.route("/api/pipeline-stats")
+def api_pipeline_stats():
+    """API endpoint for ingest pipeline queue depth and drop counters"""
+    stats = {stage.name: stage.stats() for stage in PIPELINE_STAGES}
+    stats["history_store"] = history_store.stats()
+    stats["hot_window"] = hot_window.stats()
+    stats["live_push"] = live_push.stats()
+    stats["registry"] = registry.stats()
+    return jsonify(stats)
+
+
+@app.route("/api/rooms")
+def api_rooms():
+    """API endpoint listing the registered rooms and their devices"""
+    rooms = []
+    for room_id, room in enumerate(registry.room_names):
+        devices = []
+        for device in registry.room_devices[room_id]:
+            seen = registry.last_seen[device]
+            devices.append(
+                {
+                    "device": registry.device_number[device],
+                    "topic": registry.device_topic[device],
+                    "last_seen": (
+                        datetime.fromtimestamp(seen).strftime("%Y-%m-%d %H:%M:%S")
+                        if seen
+                        else None
+                    ),
+                }
+            )
+        rooms.append({"room": room, "devices": devices})
+    return jsonify(rooms)
+
+
 # SocketIO Events
-@socketio.on("connect", namespace="/bedroom")
-def on_socketio_connect_bedroom():
-    """Handle SocketIO client connection for bedroom"""
-    logger.info(f"SocketIO client connected to bedroom: {request.sid}")
-    emit(
-        "sensor_data_bedroom",
-        {
-            "tvoc": current_data_bedroom["tvoc"],
-            "temperature": current_data_bedroom["temperature"],
-            "humidity": current_data_bedroom["humidity"],
-            "eco2": current_data_bedroom["eco2"],
-            "aqi": current_data_bedroom["aqi"],
-            "timestamp": current_data_bedroom["timestamp"].strftime("%H:%M:%S"),
-            "alerts": [],
-        },
-        namespace="/bedroom",
-    )
+def register_room_namespace(room_id, room):
+    """Socket.IO handlers for the /<room> namespace of a new room"""
+    namespace = f"/{room}"
+
+    def on_connect():
+        logger.info(f"SocketIO client connected to {room}: {request.sid}")
+        live_push.join(room, request.sid, live_queue(room, request.sid))
+        current_data = hot_window.latest(room_id)
+        emit(
+            f"sensor_data_{room}",
+            {
+                "tvoc": current_data["tvoc"],
+                "temperature": current_data["temperature"],
+                "humidity": current_data["humidity"],
+                "eco2": current_data["eco2"],
+                "aqi": current_data["aqi"],
+                "timestamp": current_data["timestamp"].strftime("%H:%M:%S"),
+                "alerts": [],
+            },
+            namespace=namespace,
+        )
 
+    def on_disconnect():
+        logger.info(f"SocketIO client disconnected from {room}: {request.sid}")
+        live_push.leave(room, request.sid)
 
-@socketio.on("connect", namespace="/workingroom")
-def on_socketio_connect_workingroom():
-    """Handle SocketIO client connection for workingroom"""
-    logger.info(f"SocketIO client connected to workingroom: {request.sid}")
-    emit(
-        "sensor_data_workingroom",
-        {
-            "tvoc": current_data_workingroom["tvoc"],
-            "temperature": current_data_workingroom["temperature"],
-            "humidity": current_data_workingroom["humidity"],
-            "eco2": current_data_workingroom["eco2"],
-            "aqi": current_data_workingroom["aqi"],
-            "timestamp": current_data_workingroom["timestamp"].strftime("%H:%M:%S"),
-            "alerts": [],
-        },
-        namespace="/workingroom",
-    )
+    socketio.on_event("connect", on_connect, namespace=namespace)
+    socketio.on_event("disconnect", on_disconnect, namespace=namespace)
 
 
-@socketio.on("disconnect", namespace="/bedroom")
-def on_socketio_disconnect_bedroom():
-    """Handle SocketIO client disconnection for bedroom"""
-    logger.info(f"SocketIO client disconnected from bedroom: {request.sid}")
+def add_room_state(room_id, room):
+    """Registry hook: give a new room its slot in every per-room structure"""
+    room_thresholds.append(DEFAULT_THRESHOLDS.copy())
+    hot_window.add_room(room_id)
+    rule_engine.set_thresholds(room_id, room_thresholds[room_id])
+    register_room_namespace(room_id, room)
+    logger.info(f"Registered room {room} (id {room_id})")
 
 
-@socketio.on("disconnect", namespace="/workingroom")
-def on_socketio_disconnect_workingroom():
-    """Handle SocketIO client disconnection for workingroom"""
-    logger.info(f"SocketIO client disconnected from workingroom: {request.sid}")
+# Rooms and devices by dense id, resolved from <root>/<site>/<room>/<device>
+# Topics only register rooms matching ROOMS_AUTO, up to the configured caps
+registry = Registry(
+    MQTT_TOPIC_ROOT,
+    MQTT_SITE,
+    add_room_state,
+    auto_rooms=ROOMS_AUTO,
+    max_rooms=MAX_ROOMS,
+    max_devices_per_room=MAX_DEVICES_PER_ROOM,
+)
+for room in ROOMS:
+    registry.add_room(room)
+# Nodes still running the one-topic-per-room firmware
+for topic, room in (
+    (MQTT_TOPIC_BEDROOM, "bedroom"),
+    (MQTT_TOPIC_WORKINGROOM, "workingroom"),
+):
+    if topic:
+        registry.alias(topic, room)
 
 
 if __name__ == "__main__":
+    # Start ingest pipeline stages before any message can arrive
+    for stage in PIPELINE_STAGES:
+        stage.start()
+
     # Run MQTT in separate thread
     mqtt_thread = threading.Thread(target=start_mqtt)
     mqtt_thread.daemon = True
     mqtt_thread.start()
 
+    # Optional server-assigned publish slots for the room nodes
+    if MQTT_SLOT_PERIOD_MS > 0:
+        slot_thread = threading.Thread(target=slot_scheduler)
+        slot_thread.daemon = True
+        slot_thread.start()
+
     logger.info("🚀 Starting TVOC Monitoring Server...")
     logger.info("📊 Main Page: http://localhost:5000")
-    logger.info("📡 MQTT Topics: " + MQTT_TOPIC_BEDROOM + ", " + MQTT_TOPIC_WORKINGROOM)
+    logger.info("📡 MQTT Topics: " + ", ".join(registry.subscriptions()))
     socketio.run(app, host="0.0.0.0", port=5000, debug=False)
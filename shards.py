@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Sharded ingest workers.
+
+Incoming messages are partitioned by room id over a fixed set of worker
+threads. A room, and with it every device in it, always lands on the same
+worker and each worker drains its queue in arrival order, so per-device
+ordering is preserved. A worker is the only writer of its rooms' hot window
+slots, alert state and device last-seen times, which is what lets those
+structures go without locks.
+
+The MQTT network thread never waits on a shard: a full shard queue drops
+its oldest message and counts it.
+
+Work that belongs to no room (compaction and other housekeeping) is queued
+on the pool and picked up by whichever worker is idle, never ahead of
+ingest. If no worker is idle for BACKGROUND_WAIT, the submitting thread
+runs it itself, so sustained ingest cannot starve it.
+"""
+
+import logging
+import queue
+import threading
+from collections import deque
+
+logger = logging.getLogger(__name__)
+
+# Seconds an idle worker waits on its own queue before looking for background work
+BACKGROUND_POLL = 0.1
+# Seconds background work waits for an idle worker before its submitter runs it
+BACKGROUND_WAIT = 0.5
+
+
+class Shard:
+    """One worker thread and the queue of the rooms it owns"""
+
+    def __init__(self, index, pool, maxsize):
+        self.index = index
+        self.pool = pool
+        self.queue = queue.Queue(maxsize=maxsize)
+        self.processed = 0
+        self.dropped = 0
+        self.thread = threading.Thread(
+            target=self._run, name=f"shard-{index}", daemon=True
+        )
+
+    def _run(self):
+        while True:
+            try:
+                item = self.queue.get(timeout=BACKGROUND_POLL)
+            except queue.Empty:
+                self.pool.run_background()
+                continue
+            try:
+                self.pool.handler(item)
+            except Exception as e:
+                logger.error(f"Shard {self.index} error: {e}")
+            self.processed += 1
+
+
+class ShardPool:
+    """Fixed set of shards, items are routed by key modulo the shard count"""
+
+    def __init__(self, count, handler, maxsize=10000):
+        self.name = "ingest"
+        self.handler = handler
+        self.shards = [Shard(i, self, maxsize) for i in range(count)]
+        self.tasks = deque()  # (task, done event) of background work, taken by idle shards
+        self.tasks_lock = threading.Lock()
+        self.dropped = 0
+        self.background_done = 0
+        self.background_inline = 0  # Run by the submitter, no shard was idle
+
+    def start(self):
+        for shard in self.shards:
+            shard.thread.start()
+
+    def put(self, key, item):
+        """
+        Enqueue without blocking the producer (the MQTT network thread),
+        dropping the oldest item of a full shard; the rest keep their order
+        """
+        shard = self.shards[key % len(self.shards)]
+        while True:
+            try:
+                shard.queue.put_nowait(item)
+                return
+            except queue.Full:
+                try:
+                    shard.queue.get_nowait()
+                except queue.Empty:
+                    continue
+                shard.dropped += 1
+                self.dropped += 1
+                if self.dropped % 100 == 1:
+                    logger.warning(
+                        f"Ingest shard {shard.index} full, "
+                        f"dropped {self.dropped} messages"
+                    )
+
+    def background(self, task, timeout=BACKGROUND_WAIT):
+        """
+        Run task() on the next idle shard and wait until it is done, or run
+        it on the calling thread if no shard took it within timeout
+        """
+        entry = (task, threading.Event())
+        with self.tasks_lock:
+            self.tasks.append(entry)
+        if entry[1].wait(timeout):
+            return
+        with self.tasks_lock:
+            try:
+                self.tasks.remove(entry)
+                taken = False
+            except ValueError:
+                taken = True
+        if taken:
+            entry[1].wait()  # A shard is running it, a bounded step
+            return
+        self._run_task(task)
+        self.background_inline += 1
+
+    def run_background(self):
+        with self.tasks_lock:
+            if not self.tasks:
+                return
+            task, done = self.tasks.popleft()
+        self._run_task(task)
+        done.set()
+
+    def _run_task(self, task):
+        try:
+            task()
+        except Exception as e:
+            logger.error(f"Background task error: {e}")
+        self.background_done += 1
+
+    def stats(self):
+        return {
+            "shards": len(self.shards),
+            "queued": [shard.queue.qsize() for shard in self.shards],
+            "processed": sum(shard.processed for shard in self.shards),
+            "dropped": self.dropped,
+            "dropped_per_shard": [shard.dropped for shard in self.shards],
+            "background_queued": len(self.tasks),
+            "background_done": self.background_done,
+            "background_inline": self.background_inline,
+        }
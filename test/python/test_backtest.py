@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Tests of the threshold replay (backtest.py, host/backtest.cpp) against the
+alert stage's own RuleEngine, fed the same samples one at a time.
+
+    python3 -m unittest discover -s test/python
+"""
+
+import os
+import random
+import sys
+import unittest
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), "..", ".."))
+
+from backtest import replay  # noqa: E402
+from rules import ALERTS, RuleEngine  # noqa: E402
+
+THRESHOLDS = {
+    "tvoc_excellent": 65,
+    "tvoc_good": 220,
+    "tvoc_moderate": 650,
+    "tvoc_poor": 2200,
+    "tvoc_unhealthy": 5500,
+    "temp_min": 18,
+    "temp_max": 35,
+    "humidity_min": 30,
+    "humidity_max": 70,
+    "eco2_min": 400,
+    "eco2_max": 1000,
+}
+
+
+def history(n, seed=1):
+    rng = random.Random(seed)
+    times, t = [], 1700000000
+    for _ in range(n):
+        t += rng.choice((5, 5, 5, 4, 6, 300))  # Gaps now and then
+        times.append(t)
+    return times, [
+        [rng.uniform(0, 7000) for _ in range(n)],
+        [rng.uniform(10, 40) for _ in range(n)],
+        [rng.uniform(20, 90) for _ in range(n)],
+        [rng.uniform(300, 2000) for _ in range(n)],
+        [float(rng.randint(1, 5)) for _ in range(n)],
+    ]
+
+
+def rule_engine_alerts(times, columns, thresholds):
+    engine = RuleEngine()
+    engine.set_thresholds(0, thresholds)
+    counts = {key: 0 for key, _ in ALERTS}
+    tvoc, temperature, humidity, eco2, _ = columns
+    for i, t in enumerate(times):
+        for _, key, _, _ in engine.evaluate(
+            [0], [tvoc[i]], [temperature[i]], [humidity[i]], [eco2[i]], t
+        ):
+            counts[key] += 1
+    return counts
+
+
+class BacktestTest(unittest.TestCase):
+    def test_alerts_match_rule_engine(self):
+        times, columns = history(5000)
+        candidates = [
+            THRESHOLDS,
+            {**THRESHOLDS, "eco2_max": 1500, "temp_max": 30},
+            # Inverted range: low only counts when not high
+            {**THRESHOLDS, "humidity_min": 80, "humidity_max": 40},
+        ]
+        results = replay(times, *columns, candidates)
+        for candidate, result in zip(candidates, results):
+            self.assertEqual(
+                result["alerts"], rule_engine_alerts(times, columns, candidate)
+            )
+
+    def test_seconds_and_fan_duty(self):
+        times = [0, 5, 10, 100, 105]
+        tvoc = [100.0, 100.0, 100.0, 100.0, 100.0]
+        temperature = [40.0, 40.0, 20.0, 40.0, 20.0]
+        humidity = [50.0] * 5
+        eco2 = [500.0, 900.0, 900.0, 500.0, 500.0]
+        aqi = [1.0] * 5
+        (result,) = replay(times, tvoc, temperature, humidity, eco2, aqi, [THRESHOLDS])
+        # The 90 s gap counts as 60 s; the last sample has no duration
+        self.assertEqual(result["seconds"]["temp_high"], 5 + 5 + 5)
+        self.assertEqual(result["alerts"]["temp_high"], 1)
+        self.assertEqual(result["fan_duty"], round((5 + 60) / 75, 4))
+
+    def test_empty_history(self):
+        (result,) = replay([], [], [], [], [], [], [THRESHOLDS])
+        self.assertEqual(result["samples"], 0)
+
+
+if __name__ == "__main__":
+    unittest.main()
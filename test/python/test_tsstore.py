@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Tests of the history store (tsstore.py): the Gorilla block files, threshold
+queries skipping blocks by their min/max index, reading archives and block
+files written by older versions, and the order of the open head.
+
+    python3 -m unittest discover -s test/python
+"""
+
+import os
+import random
+import shutil
+import struct
+import sys
+import tempfile
+import unittest
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), "..", ".."))
+
+import tsstore  # noqa: E402
+from tsstore import BLOCK_SAMPLES, ROW, TimeSeriesStore  # noqa: E402
+
+T0 = 1700000000
+
+# Version 2 archive of LEGACY_ROWS in two groups (4 + 2 rows), as written by
+# the Gorilla ArchiveWriter before version 3
+LEGACY_ARCHIVE = bytes.fromhex(
+    "41515241020002000600000000f153650000000019f153650000000000000000"
+    "000000000000000000f153650000000010f15365000000000400000045010000"
+    "00f153650000000010f153650000000004000000000000000000794000000000"
+    "0018794017000000000000006553f100407900000000000082f402e60f019000"
+    "f153650000000010f153650000000004000000b81e85eb517836400000000000"
+    "80364027000000000000006553f100403680000000000082f0bff5c28f5c28f5"
+    "03c8f23c8f2340602b0ac2b0ac3000f153650000000010f15365000000000400"
+    "00000000000000004940000000000000494013000000000000006553f1004049"
+    "00000000000082880800f153650000000010f153650000000004000000000000"
+    "0000a079400000000000d0794017000000000000006553f1004079a000000000"
+    "0082f302e21780c400f153650000000010f15365000000000400000000000000"
+    "00000040000000000000084015000000000000006553f1004000000000000000"
+    "82ec02b01a14f153650000000019f1536500000000020000002c01000014f153"
+    "650000000019f153650000000002000000000000000020794000000000002879"
+    "4013000000000000006553f114407920000000000082f40214f1536500000000"
+    "19f1536500000000020000003333333333733640f6285c8fc275364019000000"
+    "000000006553f114403675c28f5c28f682f5ab78de378de28014f15365000000"
+    "0019f15365000000000200000000000000000049400000000000004940120000"
+    "00000000006553f1144049000000000000828014f153650000000019f1536500"
+    "000000020000000000000000e079400000000000f07940130000000000000065"
+    "53f1144079e0000000000082f30214f153650000000019f15365000000000200"
+    "00000000000000000040000000000000084013000000000000006553f1144000"
+    "00000000000082ec02"
+)
+LEGACY_ROWS = [
+    (T0, 400.0, 22.5, 50.0, 410.0, 2.0),
+    (T0 + 5, 400.5, 22.49, 50.0, 411.0, 3.0),
+    (T0 + 10, 401.0, 22.48, 50.0, 412.0, 2.0),
+    (T0 + 16, 401.5, 22.47, 50.0, 413.0, 3.0),
+    (T0 + 20, 402.0, 22.46, 50.0, 414.0, 2.0),
+    (T0 + 25, 402.5, 22.45, 50.0, 415.0, 3.0),
+]
+
+
+def sample(i, aqi=2.0):
+    return {
+        "tvoc": 100.0 + i % 37,
+        "temperature": round(22 + random.random(), 2),
+        "humidity": 55.5,
+        "eco2": 400.0 + i,
+        "aqi": aqi,
+    }
+
+
+class StoreTest(unittest.TestCase):
+    def setUp(self):
+        self.path = tempfile.mkdtemp()
+        self.store = TimeSeriesStore(self.path)
+
+    def tearDown(self):
+        shutil.rmtree(self.path)
+
+    def test_block_round_trip(self):
+        rows = [
+            (
+                T0 + 5 * i + (i % 7 == 0),
+                random.uniform(-1e6, 1e6),
+                22.5,
+                0.0,
+                float(i),
+                float("inf") if i == 9 else -0.0,
+            )
+            for i in range(BLOCK_SAMPLES)
+        ]
+        block = tsstore.BlockFile.write(self.path, rows)
+        opened = tsstore.BlockFile.open(block.path)
+        self.assertEqual(opened.size, os.path.getsize(block.path))
+        data = b"".join(opened.scan(T0, T0 + 10**6))
+        self.assertEqual(list(ROW.iter_unpack(data)), rows)
+        self.assertEqual(opened.count_range(T0 + 10, T0 + 99), 18)
+        self.assertEqual(opened.ranges[3], (0.0, float(BLOCK_SAMPLES - 1)))
+
+    def test_threshold_query_skips_blocks_by_min_max(self):
+        # Three sealed blocks, only the second with aqi above 3
+        for i in range(3 * BLOCK_SAMPLES + 5):
+            aqi = 4.0 if BLOCK_SAMPLES <= i < BLOCK_SAMPLES + 10 else 2.0
+            self.store.append("room", T0 + 5 * i, sample(i, aqi))
+        found = [
+            row
+            for chunk in self.store.scan_above("room", T0, T0 + 10**6, "aqi", 3)
+            for row in ROW.iter_unpack(chunk)
+        ]
+        self.assertEqual(len(found), 10)
+        self.assertTrue(all(row[5] == 4.0 for row in found))
+        stats = self.store.stats()
+        self.assertEqual(stats["threshold_blocks_skipped"], 2)
+        self.assertEqual(stats["threshold_blocks_scanned"], 1)
+
+    def test_compresses_below_fixed_rows(self):
+        for i in range(2 * BLOCK_SAMPLES):
+            self.store.append("room", T0 + 5 * i, sample(i))
+        self.assertLess(self.store.stats()["bytes_per_point"], ROW.size / 2)
+
+    def test_head_rows_in_time_order(self):
+        # Two devices of one room publishing with a small offset
+        for t in (T0 + 10, T0 + 5, T0 + 15, T0 + 12):
+            self.store.append("room", t, sample(0))
+        times = [row[0] for row in self.store.query("room", T0, T0 + 100)]
+        self.assertEqual(times, [T0 + 5, T0 + 10, T0 + 12, T0 + 15])
+
+    def test_reads_version_2_archive(self):
+        os.makedirs(os.path.join(self.path, "room"))
+        name = f"{T0:010d}-{T0 + 25:010d}" + tsstore.ARCHIVE_SUFFIX
+        with open(os.path.join(self.path, "room", name), "wb") as f:
+            f.write(LEGACY_ARCHIVE)
+        store = TimeSeriesStore(self.path)
+        self.assertEqual(store.query("room", T0, T0 + 100), LEGACY_ROWS)
+        self.assertEqual(store.query("room", T0 + 6, T0 + 20), LEGACY_ROWS[2:5])
+        times, values = store.query_columns("room", T0 + 6, T0 + 100)
+        self.assertEqual(list(values[1]), [22.48, 22.47, 22.46, 22.45])
+
+    def test_reads_version_2_block_file(self):
+        os.makedirs(os.path.join(self.path, "room"))
+        header = tsstore.BLOCK_FILE_HEADER.pack(
+            tsstore.BLOCK_FILE_MAGIC, 2, ROW.size, 6, T0, T0 + 25, 0
+        )
+        name = f"{T0:010d}-{T0 + 25:010d}" + tsstore.BLOCK_FILE_SUFFIX
+        with open(os.path.join(self.path, "room", name), "wb") as f:
+            f.write(header + b"".join(ROW.pack(*row) for row in LEGACY_ROWS))
+        store = TimeSeriesStore(self.path)
+        self.assertEqual(store.query("room", T0 + 6, T0 + 20), LEGACY_ROWS[2:5])
+        found = b"".join(store.scan_above("room", T0, T0 + 100, "aqi", 2.5))
+        self.assertEqual(list(ROW.iter_unpack(found)), LEGACY_ROWS[1::2])
+
+    def test_rejects_unknown_versions(self):
+        os.makedirs(os.path.join(self.path, "room"))
+        name = f"{T0:010d}-{T0 + 25:010d}" + tsstore.ARCHIVE_SUFFIX
+        with open(os.path.join(self.path, "room", name), "wb") as f:
+            f.write(tsstore.ARCHIVE_MAGIC + struct.pack("<H", 9) + bytes(40))
+        with self.assertLogs("tsstore", "ERROR"):
+            store = TimeSeriesStore(self.path)
+        self.assertEqual(store.query("room", T0, T0 + 100), [])
+
+
+if __name__ == "__main__":
+    unittest.main()
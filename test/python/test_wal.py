@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Tests of the write-ahead log (wal.py): a log reopened with a different
+segment size keeps the size its LSNs were computed with.
+
+    python3 -m unittest discover -s test/python
+"""
+
+import os
+import shutil
+import sys
+import tempfile
+import unittest
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), "..", ".."))
+
+import wal  # noqa: E402
+from wal import WalReader, WriteAheadLog  # noqa: E402
+
+SEGMENT = 4096
+RECORDS = [b"sample %04d" % i for i in range(500)]  # Spans several segments
+
+
+class WalSegmentSizeTest(unittest.TestCase):
+    def setUp(self):
+        self.path = tempfile.mkdtemp(prefix="wal-test-")
+
+    def tearDown(self):
+        shutil.rmtree(self.path)
+
+    def write(self):
+        log = WriteAheadLog(self.path, SEGMENT, 1.0)
+        lsns = [log.append(record) for record in RECORDS]
+        self.assertGreater(len(log.segments()), 2)
+        return lsns, log.end_lsn
+
+    def replay(self, log, lsn):
+        reader = WalReader(log, lsn)
+        records = reader.read(len(RECORDS) + 1)
+        reader.close()
+        self.assertEqual(reader.skipped, 0)
+        return records
+
+    def test_reopen_with_other_size(self):
+        lsns, end = self.write()
+        log = WriteAheadLog(self.path, 4 * SEGMENT, 1.0)
+        self.assertEqual(log.segment_bytes, SEGMENT)
+        self.assertEqual(log.end_lsn, end)
+        self.assertEqual(self.replay(log, 0), RECORDS)
+        self.assertEqual(self.replay(log, lsns[300]), RECORDS[300:])
+
+    def test_log_without_size_file(self):
+        # Written before the segment size was recorded
+        lsns, end = self.write()
+        os.remove(os.path.join(self.path, wal.SEGMENT_SIZE_FILE))
+        log = WriteAheadLog(self.path, 4 * SEGMENT, 1.0)
+        self.assertEqual(log.segment_bytes, SEGMENT)
+        self.assertEqual(log.end_lsn, end)
+        self.assertEqual(self.replay(log, lsns[123]), RECORDS[123:])
+
+    def test_new_log_takes_configured_size(self):
+        self.write()
+        shutil.rmtree(self.path)
+        log = WriteAheadLog(self.path, 4 * SEGMENT, 1.0)
+        self.assertEqual(log.segment_bytes, 4 * SEGMENT)
+        log.append(RECORDS[0])
+        reopened = WriteAheadLog(self.path, SEGMENT, 1.0)
+        self.assertEqual(reopened.segment_bytes, 4 * SEGMENT)
+
+
+if __name__ == "__main__":
+    unittest.main()
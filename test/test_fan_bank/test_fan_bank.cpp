@@ -0,0 +1,210 @@
+// Kiểm thử bộ lập lịch quạt trên máy host, thời gian do test điều khiển:
+// pio test -e native
+#include <unity.h>
+#include "fan_bank.h"
+
+// Relay changes in the order the scheduler made them
+struct Switch
+{
+  uint8_t idx;
+  bool on;
+};
+
+Switch switches[32];
+uint8_t switchCount;
+FanBank bank;
+
+void recordOutput(uint8_t idx, bool on)
+{
+  if (switchCount < sizeof(switches) / sizeof(switches[0]))
+  {
+    switches[switchCount].idx = idx;
+    switches[switchCount].on = on;
+  }
+  switchCount++;
+}
+
+void setUp()
+{
+  switchCount = 0;
+  fanBankInit(bank, 0);
+}
+
+void tearDown() {}
+
+void setRuntime(uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+{
+  bank.runtimeS[0] = a;
+  bank.runtimeS[1] = b;
+  bank.runtimeS[2] = c;
+  bank.runtimeS[3] = d;
+}
+
+void test_first_fan_starts_immediately()
+{
+  fanBankSetTarget(bank, 1);
+  fanBankStep(bank, 0, recordOutput);
+  TEST_ASSERT_EQUAL(1, switchCount);
+  TEST_ASSERT_TRUE(switches[0].on);
+  TEST_ASSERT_EQUAL(1, fanActiveCount(bank));
+}
+
+void test_starts_are_staggered()
+{
+  fanBankSetTarget(bank, 3);
+  for (unsigned long now = 0; now < 3 * FAN_STAGGER_MS; now += 100)
+  {
+    fanBankStep(bank, now, recordOutput);
+    // At most one relay closure per FAN_STAGGER_MS
+    TEST_ASSERT_EQUAL(now / FAN_STAGGER_MS + 1, fanActiveCount(bank));
+  }
+  TEST_ASSERT_EQUAL(3, switchCount);
+}
+
+void test_least_used_fans_start_first()
+{
+  setRuntime(300, 100, 400, 200);
+  fanBankSetTarget(bank, 4);
+  for (unsigned long now = 0; now <= 3 * FAN_STAGGER_MS; now += FAN_STAGGER_MS)
+  {
+    fanBankStep(bank, now, recordOutput);
+  }
+  TEST_ASSERT_EQUAL(4, switchCount);
+  TEST_ASSERT_EQUAL(1, switches[0].idx);
+  TEST_ASSERT_EQUAL(3, switches[1].idx);
+  TEST_ASSERT_EQUAL(0, switches[2].idx);
+  TEST_ASSERT_EQUAL(2, switches[3].idx);
+}
+
+void test_target_is_clamped_to_bank_size()
+{
+  fanBankSetTarget(bank, FAN_COUNT + 5);
+  TEST_ASSERT_EQUAL(FAN_COUNT, bank.target);
+}
+
+void test_shedding_is_immediate_and_most_worn_first()
+{
+  setRuntime(10, 40, 20, 30);
+  fanBankSetTarget(bank, 4);
+  for (unsigned long now = 0; now <= 3 * FAN_STAGGER_MS; now += FAN_STAGGER_MS)
+  {
+    fanBankStep(bank, now, recordOutput);
+  }
+  switchCount = 0;
+
+  // Turning off needs no stagger: all surplus outputs go in one step
+  fanBankSetTarget(bank, 1);
+  fanBankStep(bank, 3 * FAN_STAGGER_MS + 1, recordOutput);
+  TEST_ASSERT_EQUAL(3, switchCount);
+  TEST_ASSERT_EQUAL(1, switches[0].idx);
+  TEST_ASSERT_EQUAL(3, switches[1].idx);
+  TEST_ASSERT_EQUAL(2, switches[2].idx);
+  TEST_ASSERT_FALSE(switches[0].on || switches[1].on || switches[2].on);
+  TEST_ASSERT_TRUE(bank.on[0]);
+}
+
+void test_shedding_to_zero()
+{
+  fanBankSetTarget(bank, 2);
+  fanBankStep(bank, 0, recordOutput);
+  fanBankStep(bank, FAN_STAGGER_MS, recordOutput);
+  fanBankSetTarget(bank, 0);
+  fanBankStep(bank, FAN_STAGGER_MS + 1, recordOutput);
+  TEST_ASSERT_EQUAL(0, fanActiveCount(bank));
+}
+
+void test_runtime_keeps_partial_seconds()
+{
+  fanBankSetTarget(bank, 1);
+  fanBankStep(bank, 0, recordOutput);
+  uint8_t idx = switches[0].idx;
+  fanFoldRuntime(bank, idx, 2500);
+  TEST_ASSERT_EQUAL_UINT32(2, bank.runtimeS[idx]);
+  // The 500 ms left over counts towards the next fold
+  fanFoldRuntime(bank, idx, 3000);
+  TEST_ASSERT_EQUAL_UINT32(3, bank.runtimeS[idx]);
+}
+
+void test_idle_fans_accumulate_no_runtime()
+{
+  fanFoldRuntime(bank, 0, 100000);
+  TEST_ASSERT_EQUAL_UINT32(0, bank.runtimeS[0]);
+}
+
+void test_rotation_swaps_worn_for_fresh()
+{
+  setRuntime(0, FAN_ROTATE_MIN_DIFF_S, 2 * FAN_ROTATE_MIN_DIFF_S, 3 * FAN_ROTATE_MIN_DIFF_S);
+  fanBankSetTarget(bank, 2);
+  fanBankStep(bank, 0, recordOutput);
+  fanBankStep(bank, FAN_STAGGER_MS, recordOutput);
+  TEST_ASSERT_TRUE(bank.on[0] && bank.on[1]);
+  switchCount = 0;
+
+  fanBankStep(bank, FAN_ROTATE_INTERVAL_MS - 1, recordOutput);
+  TEST_ASSERT_EQUAL(0, switchCount);
+
+  // Fan 1 is now 1197 s ahead of idle fan 2: hand its load over
+  fanBankStep(bank, FAN_ROTATE_INTERVAL_MS, recordOutput);
+  TEST_ASSERT_EQUAL(2, switchCount);
+  TEST_ASSERT_EQUAL(2, switches[0].idx);
+  TEST_ASSERT_TRUE(switches[0].on);
+  TEST_ASSERT_EQUAL(1, switches[1].idx);
+  TEST_ASSERT_FALSE(switches[1].on);
+  TEST_ASSERT_EQUAL(2, fanActiveCount(bank));
+}
+
+void test_no_rotation_when_runtime_is_balanced()
+{
+  fanBankSetTarget(bank, 2);
+  fanBankStep(bank, 0, recordOutput);
+  fanBankStep(bank, FAN_STAGGER_MS, recordOutput);
+  // Idle fans are FAN_ROTATE_MIN_DIFF_S - 1 behind once the interval is folded
+  uint32_t behind = FAN_ROTATE_INTERVAL_MS / 1000 - FAN_ROTATE_MIN_DIFF_S + 1;
+  setRuntime(0, 0, behind, behind);
+  switchCount = 0;
+  fanBankStep(bank, FAN_ROTATE_INTERVAL_MS, recordOutput);
+  TEST_ASSERT_EQUAL(0, switchCount);
+  TEST_ASSERT_EQUAL(FAN_ROTATE_INTERVAL_MS, bank.lastRotate);
+}
+
+void test_no_rotation_when_all_fans_run()
+{
+  fanBankSetTarget(bank, FAN_COUNT);
+  for (unsigned long now = 0; now < FAN_COUNT * FAN_STAGGER_MS; now += FAN_STAGGER_MS)
+  {
+    fanBankStep(bank, now, recordOutput);
+  }
+  switchCount = 0;
+  fanBankStep(bank, 10 * FAN_ROTATE_INTERVAL_MS, recordOutput);
+  TEST_ASSERT_EQUAL(0, switchCount);
+}
+
+void test_stagger_survives_millis_wraparound()
+{
+  unsigned long start = (unsigned long)0 - FAN_STAGGER_MS / 2;
+  fanBankInit(bank, start);
+  fanBankSetTarget(bank, 2);
+  fanBankStep(bank, start, recordOutput);
+  fanBankStep(bank, start + FAN_STAGGER_MS - 1, recordOutput);
+  TEST_ASSERT_EQUAL(1, fanActiveCount(bank));
+  fanBankStep(bank, start + FAN_STAGGER_MS, recordOutput);
+  TEST_ASSERT_EQUAL(2, fanActiveCount(bank));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_first_fan_starts_immediately);
+  RUN_TEST(test_starts_are_staggered);
+  RUN_TEST(test_least_used_fans_start_first);
+  RUN_TEST(test_target_is_clamped_to_bank_size);
+  RUN_TEST(test_shedding_is_immediate_and_most_worn_first);
+  RUN_TEST(test_shedding_to_zero);
+  RUN_TEST(test_runtime_keeps_partial_seconds);
+  RUN_TEST(test_idle_fans_accumulate_no_runtime);
+  RUN_TEST(test_rotation_swaps_worn_for_fresh);
+  RUN_TEST(test_no_rotation_when_runtime_is_balanced);
+  RUN_TEST(test_no_rotation_when_all_fans_run);
+  RUN_TEST(test_stagger_survives_millis_wraparound);
+  return UNITY_END();
+}
@@ -0,0 +1,166 @@
+// Kiểm thử parse payload và mức thông gió của fan node trên máy host:
+// pio test -e native
+#include <unity.h>
+#include "fan_control.h"
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_parse_centi_rounds_to_hundredths()
+{
+  int32_t v;
+  TEST_ASSERT_NOT_NULL(parseCenti("23.456", v));
+  TEST_ASSERT_EQUAL_INT32(2346, v);
+  parseCenti("-0.004", v);
+  TEST_ASSERT_EQUAL_INT32(0, v);
+  parseCenti("-12.5", v);
+  TEST_ASSERT_EQUAL_INT32(-1250, v);
+  parseCenti("7", v);
+  TEST_ASSERT_EQUAL_INT32(700, v);
+}
+
+void test_parse_centi_ignores_digits_past_the_third()
+{
+  int32_t v;
+  const char *end = parseCenti("1.99499999,", v);
+  TEST_ASSERT_EQUAL_INT32(199, v);
+  TEST_ASSERT_EQUAL_CHAR(',', *end);
+}
+
+void test_parse_centi_rejects_non_numbers()
+{
+  int32_t v;
+  TEST_ASSERT_NULL(parseCenti("", v));
+  TEST_ASSERT_NULL(parseCenti("-", v));
+  TEST_ASSERT_NULL(parseCenti("null", v));
+}
+
+void test_parse_centi_rejects_overlong_numbers()
+{
+  int32_t v;
+  TEST_ASSERT_NOT_NULL(parseCenti("9999999.99", v));
+  TEST_ASSERT_EQUAL_INT32(999999999, v);
+  TEST_ASSERT_NULL(parseCenti("12345678", v));
+  TEST_ASSERT_NULL(parseCenti("-99999999999999999999", v));
+}
+
+void test_json_reading_of_the_room_node()
+{
+  Reading r;
+  TEST_ASSERT_TRUE(parseReadingJson(
+      "{\"device\":1,\"tvoc\":230,\"temperature\":24.51,\"humidity\":-1.00,\"eco2\":812,\"aqi\":2}", r));
+  TEST_ASSERT_EQUAL(230, r.tvoc);
+  TEST_ASSERT_EQUAL(2451, r.tempCenti);
+  TEST_ASSERT_EQUAL(-100, r.humCenti);
+  TEST_ASSERT_EQUAL(812, r.eco2);
+  TEST_ASSERT_EQUAL(2, r.aqi);
+}
+
+void test_json_rejects_missing_fields()
+{
+  Reading r;
+  TEST_ASSERT_FALSE(parseReadingJson("{\"tvoc\": 300}", r));
+  TEST_ASSERT_FALSE(parseReadingJson(
+      "{\"tvoc\":230,\"temperature\":24.51,\"humidity\":40.00,\"aqi\":2}", r));
+}
+
+void test_json_rejects_truncated_payloads()
+{
+  const char *full =
+      "{\"device\":1,\"tvoc\":230,\"temperature\":24.51,\"humidity\":40.00,\"eco2\":812,\"aqi\":2}";
+  char buf[128];
+  Reading r;
+  // Every proper prefix, as left by a cut-off publish
+  for (size_t n = 0; n < strlen(full); n++)
+  {
+    memcpy(buf, full, n);
+    buf[n] = '\0';
+    TEST_ASSERT_FALSE_MESSAGE(parseReadingJson(buf, r), buf);
+  }
+  TEST_ASSERT_TRUE(parseReadingJson(full, r));
+}
+
+void test_json_rejects_garbage()
+{
+  Reading r;
+  TEST_ASSERT_FALSE(parseReadingJson("", r));
+  TEST_ASSERT_FALSE(parseReadingJson("hello", r));
+  TEST_ASSERT_FALSE(parseReadingJson("230,24.51,40.00,812,2", r));
+  TEST_ASSERT_FALSE(parseReadingJson(
+      "{\"tvoc\":null,\"temperature\":24.51,\"humidity\":40.00,\"eco2\":812,\"aqi\":2}", r));
+  TEST_ASSERT_FALSE(parseReadingJson(
+      "{\"tvoc\":23x0,\"temperature\":24.51,\"humidity\":40.00,\"eco2\":812,\"aqi\":2}", r));
+  TEST_ASSERT_FALSE(parseReadingJson(
+      "{\"tvoc\":230,\"temperature\":24.51,\"humidity\":40.00,\"eco2\":81234567890,\"aqi\":2}", r));
+}
+
+void test_snapshot()
+{
+  Reading r;
+  TEST_ASSERT_TRUE(parseSnapshot("650,1000,3,-2.50,55.00", r));
+  TEST_ASSERT_EQUAL(650, r.tvoc);
+  TEST_ASSERT_EQUAL(1000, r.eco2);
+  TEST_ASSERT_EQUAL(3, r.aqi);
+  TEST_ASSERT_EQUAL(-250, r.tempCenti);
+  TEST_ASSERT_EQUAL(5500, r.humCenti);
+}
+
+void test_snapshot_rejects_malformed_payloads()
+{
+  Reading r;
+  TEST_ASSERT_FALSE(parseSnapshot("650,1000,3,-2.50", r));
+  TEST_ASSERT_FALSE(parseSnapshot("650,1000,3,-2.50,55.00,", r));
+  TEST_ASSERT_FALSE(parseSnapshot("650;1000;3;-2.50;55.00", r));
+  TEST_ASSERT_FALSE(parseSnapshot("", r));
+}
+
+void test_ventilation_level_takes_the_worst_index()
+{
+  TEST_ASSERT_EQUAL(0, ventilationLevel(TVOC_THRESHOLD - 1, eCO2_THRESHOLD - 1, AQI_THRESHOLD - 1));
+  TEST_ASSERT_EQUAL(1, ventilationLevel(TVOC_THRESHOLD, 0, 0));
+  TEST_ASSERT_EQUAL(2, ventilationLevel(TVOC_LEVEL2, eCO2_THRESHOLD, 0));
+  TEST_ASSERT_EQUAL(3, ventilationLevel(0, eCO2_LEVEL3, AQI_THRESHOLD));
+  TEST_ASSERT_EQUAL(2, ventilationLevel(0, 0, AQI_THRESHOLD + 1));
+  TEST_ASSERT_EQUAL(VENT_MAX_LEVEL, ventilationLevel(0, 0, 250));
+}
+
+void test_missing_readings_ventilate_nothing()
+{
+  TEST_ASSERT_EQUAL(0, ventilationLevel(-1, -1, -1));
+}
+
+void test_fans_for_level_rounds_up()
+{
+  TEST_ASSERT_EQUAL(0, fansForLevel(0));
+  TEST_ASSERT_EQUAL((FAN_COUNT + VENT_MAX_LEVEL - 1) / VENT_MAX_LEVEL, fansForLevel(1));
+  TEST_ASSERT_EQUAL(FAN_COUNT, fansForLevel(VENT_MAX_LEVEL));
+}
+
+void test_format_centi()
+{
+  char buf[12];
+  TEST_ASSERT_EQUAL_STRING("24.05", formatCenti(buf, sizeof(buf), 2405));
+  TEST_ASSERT_EQUAL_STRING("-0.50", formatCenti(buf, sizeof(buf), -50));
+  TEST_ASSERT_EQUAL_STRING("0.00", formatCenti(buf, sizeof(buf), 0));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_parse_centi_rounds_to_hundredths);
+  RUN_TEST(test_parse_centi_ignores_digits_past_the_third);
+  RUN_TEST(test_parse_centi_rejects_non_numbers);
+  RUN_TEST(test_parse_centi_rejects_overlong_numbers);
+  RUN_TEST(test_json_reading_of_the_room_node);
+  RUN_TEST(test_json_rejects_missing_fields);
+  RUN_TEST(test_json_rejects_truncated_payloads);
+  RUN_TEST(test_json_rejects_garbage);
+  RUN_TEST(test_snapshot);
+  RUN_TEST(test_snapshot_rejects_malformed_payloads);
+  RUN_TEST(test_ventilation_level_takes_the_worst_index);
+  RUN_TEST(test_missing_readings_ventilate_nothing);
+  RUN_TEST(test_fans_for_level_rounds_up);
+  RUN_TEST(test_format_centi);
+  return UNITY_END();
+}
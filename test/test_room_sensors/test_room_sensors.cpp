@@ -0,0 +1,247 @@
+// Kiểm thử đường thu thập dữ liệu của room node trên bus I2C giả lập:
+// pio test -e native
+#include <unity.h>
+#include "host/i2c_emulator.h"
+
+EmulatedBus *bus;
+Ens160Model *ens;
+Aht21Model *aht;
+RoomSensors sensors;
+
+void setUp()
+{
+  bus = new EmulatedBus();
+  ens = new Ens160Model();
+  aht = new Aht21Model();
+  ens->warmupMs = 0;
+  bus->attach(ENS160_ADDR, ens);
+  bus->attach(AHT21_ADDR, aht);
+  sensorsInit(sensors, *bus);
+}
+
+void tearDown()
+{
+  delete bus;
+  delete ens;
+  delete aht;
+}
+
+void beginBoth()
+{
+  TEST_ASSERT_TRUE(sensorsBeginAht21(sensors));
+  TEST_ASSERT_TRUE(sensorsBeginEns160(sensors));
+}
+
+void test_reading_follows_the_profiles()
+{
+  aht->temperature.at(0, 22.0).at(60000, 28.0);
+  aht->humidity = Profile(41.25);
+  ens->tvoc.at(0, 100).at(60000, 700);
+  ens->eco2 = Profile(900);
+  ens->aqi = Profile(3);
+  beginBoth();
+  bus->delayMs(30000 - bus->nowUs / 1000);
+
+  Sample s;
+  TEST_ASSERT_TRUE(readSample(sensors, s));
+  TEST_ASSERT_INT_WITHIN(1, 2500, s.tempCenti);
+  TEST_ASSERT_INT_WITHIN(1, 4125, s.humCenti);
+  TEST_ASSERT_INT_WITHIN(10, 400, s.tvoc);
+  TEST_ASSERT_EQUAL(900, s.eco2);
+  TEST_ASSERT_EQUAL(3, s.aqi);
+  TEST_ASSERT_EQUAL(0, s.status);
+}
+
+void test_negative_temperature_in_fixed_point()
+{
+  aht->temperature = Profile(-12.34);
+  aht->humidity = Profile(99.99);
+  beginBoth();
+  bus->delayMs(2000);
+  Sample s;
+  TEST_ASSERT_TRUE(readSample(sensors, s));
+  TEST_ASSERT_INT_WITHIN(1, -1234, s.tempCenti);
+  TEST_ASSERT_INT_WITHIN(1, 9999, s.humCenti);
+}
+
+void test_ens160_gets_compensation_from_aht21()
+{
+  aht->temperature = Profile(25.0);
+  aht->humidity = Profile(50.0);
+  beginBoth();
+  bus->delayMs(2000);
+  Sample s;
+  TEST_ASSERT_TRUE(readSample(sensors, s));
+  TEST_ASSERT_EQUAL(((2500 + 27315) * 64 + 50) / 100, ens->tempIn);
+  TEST_ASSERT_EQUAL(50 * 512, ens->rhIn);
+}
+
+void test_acquisition_waits_for_the_aht21_conversion()
+{
+  beginBoth();
+  bus->delayMs(2000);
+  Sample s;
+  TEST_ASSERT_TRUE(readSample(sensors, s));
+  TEST_ASSERT_TRUE(sensors.acquisitionUs >= AHT21_CONVERSION_MS * 1000UL);
+  TEST_ASSERT_TRUE(sensors.acquisitionUs < (AHT21_CONVERSION_MS + AHT21_POLL_MS) * 1000UL);
+
+  // A slower part is polled until it is ready
+  aht->conversionMs = 115;
+  TEST_ASSERT_TRUE(readSample(sensors, s));
+  TEST_ASSERT_TRUE(sensors.acquisitionUs >= 115000UL);
+}
+
+void test_no_gas_data_before_the_first_conversion()
+{
+  beginBoth();
+  Sample s;
+  // ENS160 has not finished its first conversion: registers still read 0
+  TEST_ASSERT_FALSE(readSample(sensors, s));
+  bus->delayMs(1000);
+  TEST_ASSERT_TRUE(readSample(sensors, s));
+  // NEWDAT is clear on the next read, the last sample stays usable
+  TEST_ASSERT_TRUE(readSample(sensors, s));
+}
+
+void test_warm_up_is_reported_not_rejected()
+{
+  ens->warmupMs = 180000;
+  beginBoth();
+  bus->delayMs(2000);
+  Sample s;
+  TEST_ASSERT_TRUE(readSample(sensors, s));
+  TEST_ASSERT_EQUAL(1, s.status);
+  bus->delayMs(180000);
+  TEST_ASSERT_TRUE(readSample(sensors, s));
+  TEST_ASSERT_EQUAL(0, s.status);
+}
+
+void test_invalid_output_is_rejected()
+{
+  beginBoth();
+  bus->delayMs(2000);
+  ens->invalidOutput = true;
+  Sample s;
+  TEST_ASSERT_FALSE(readSample(sensors, s));
+}
+
+void test_missing_aht21_fails_begin()
+{
+  bus->detach(AHT21_ADDR);
+  TEST_ASSERT_FALSE(sensorsBeginAht21(sensors));
+  TEST_ASSERT_TRUE(sensorsBeginEns160(sensors));
+}
+
+void test_wrong_ens160_part_id_fails_begin()
+{
+  ens->partId = 0x0161;
+  TEST_ASSERT_FALSE(sensorsBeginEns160(sensors));
+}
+
+void test_uncalibrated_aht21_is_initialized()
+{
+  aht->calibrated = false;
+  TEST_ASSERT_TRUE(sensorsBeginAht21(sensors));
+}
+
+void test_stuck_aht21_times_out()
+{
+  beginBoth();
+  bus->delayMs(2000);
+  aht->stuckBusy = true;
+  Sample s;
+  uint64_t start = bus->nowUs;
+  TEST_ASSERT_FALSE(readSample(sensors, s));
+  TEST_ASSERT_TRUE(bus->nowUs - start <= (AHT21_CONVERSION_MS + AHT21_TIMEOUT_MS + 2 * AHT21_POLL_MS) * 1000ULL);
+}
+
+void test_corrupted_aht21_frame_is_rejected()
+{
+  beginBoth();
+  bus->delayMs(2000);
+  bus->setErrorRates(0, 1.0, 7);
+  Sample s;
+  TEST_ASSERT_FALSE(readSample(sensors, s));
+}
+
+void test_single_nack_skips_one_slot()
+{
+  beginBoth();
+  bus->delayMs(2000);
+  bus->failNext(ENS160_ADDR, 1);
+  Sample s;
+  bool ahtOk, ensOk;
+  TEST_ASSERT_FALSE(readSample(sensors, s));
+  TEST_ASSERT_FALSE(sensorFailure(sensors, ahtOk, ensOk));
+  bus->delayMs(5000);
+  TEST_ASSERT_TRUE(readSample(sensors, s));
+  TEST_ASSERT_EQUAL(0, sensors.failures);
+}
+
+void test_consecutive_failures_reinitialize_both_sensors()
+{
+  beginBoth();
+  bus->delayMs(2000);
+  bus->detach(AHT21_ADDR);
+  Sample s;
+  bool ahtOk = true, ensOk = false;
+  for (int i = 1; i < SENSOR_MAX_FAILURES; i++)
+  {
+    TEST_ASSERT_FALSE(readSample(sensors, s));
+    TEST_ASSERT_FALSE(sensorFailure(sensors, ahtOk, ensOk));
+  }
+  bus->attach(AHT21_ADDR, aht);
+  aht->stuckBusy = true;
+  TEST_ASSERT_FALSE(readSample(sensors, s));
+  aht->stuckBusy = false;
+  TEST_ASSERT_TRUE(sensorFailure(sensors, ahtOk, ensOk));
+  TEST_ASSERT_TRUE(ahtOk);
+  TEST_ASSERT_TRUE(ensOk);
+  TEST_ASSERT_EQUAL(0, sensors.failures);
+
+  // The ENS160 was reset: its first conversion is awaited again
+  TEST_ASSERT_FALSE(readSample(sensors, s));
+  bus->delayMs(1000);
+  TEST_ASSERT_TRUE(readSample(sensors, s));
+}
+
+void test_bus_time_at_400khz_is_shorter()
+{
+  EmulatedBus fast(400000);
+  Ens160Model fastEns;
+  Aht21Model fastAht;
+  fast.attach(ENS160_ADDR, &fastEns);
+  fast.attach(AHT21_ADDR, &fastAht);
+  RoomSensors quick;
+  sensorsInit(quick, fast);
+  TEST_ASSERT_TRUE(sensorsBeginAht21(quick) && sensorsBeginEns160(quick));
+  beginBoth();
+  fast.delayMs(2000);
+  bus->delayMs(2000);
+  uint64_t fastBus = fast.busUs, slowBus = bus->busUs;
+  Sample s;
+  TEST_ASSERT_TRUE(readSample(quick, s));
+  TEST_ASSERT_TRUE(readSample(sensors, s));
+  TEST_ASSERT_TRUE((fast.busUs - fastBus) * 3 < bus->busUs - slowBus);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_reading_follows_the_profiles);
+  RUN_TEST(test_negative_temperature_in_fixed_point);
+  RUN_TEST(test_ens160_gets_compensation_from_aht21);
+  RUN_TEST(test_acquisition_waits_for_the_aht21_conversion);
+  RUN_TEST(test_no_gas_data_before_the_first_conversion);
+  RUN_TEST(test_warm_up_is_reported_not_rejected);
+  RUN_TEST(test_invalid_output_is_rejected);
+  RUN_TEST(test_missing_aht21_fails_begin);
+  RUN_TEST(test_wrong_ens160_part_id_fails_begin);
+  RUN_TEST(test_uncalibrated_aht21_is_initialized);
+  RUN_TEST(test_stuck_aht21_times_out);
+  RUN_TEST(test_corrupted_aht21_frame_is_rejected);
+  RUN_TEST(test_single_nack_skips_one_slot);
+  RUN_TEST(test_consecutive_failures_reinitialize_both_sensors);
+  RUN_TEST(test_bus_time_at_400khz_is_shorter);
+  return UNITY_END();
+}
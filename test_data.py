@@ -2,7 +2,7 @@
 # -*- coding: utf-8 -*-
 """
 Test Data Generator for TVOC Monitoring Server
-Simulates an ESP32 device publishing sensor data to either Bedroom or Workingroom MQTT topic
+Simulates an ESP32 device publishing sensor data on <root>/<site>/<room>/<device>
 Run two instances in separate terminals for Bedroom and Workingroom
 """
 
@@ -16,7 +16,7 @@ from datetime import datetime
 import paho.mqtt.client as mqtt
 from dotenv import load_dotenv
 
-from config import MQTT_BROKER, MQTT_PORT, MQTT_TOPIC_BEDROOM, MQTT_TOPIC_WORKINGROOM
+from config import MQTT_BROKER, MQTT_PORT, MQTT_SITE, MQTT_TOPIC_ROOT
 
 # Load .env file
 load_dotenv()
@@ -35,7 +35,7 @@ def on_connect(client, userdata, flags, rc):
     else:
         logger.error(f"MQTT connection failed: {rc}")
 
-def generate_sensor_data():
+def generate_sensor_data(device):
     """Generate random but realistic sensor data"""
     # Realistic ranges for sensor data
     tvoc = random.uniform(0, 1000)  # TVOC in ppb (0 to 1000)
@@ -45,6 +45,7 @@ def generate_sensor_data():
     aqi = random.randint(1, 5)  # AQI level (1 to 5)
 
     return {
+        "device": device,
         "tvoc": round(tvoc, 2),
         "temperature": round(temperature, 1),
         "humidity": round(humidity, 1),
@@ -52,10 +53,10 @@ def generate_sensor_data():
         "aqi": aqi
     }
 
-def publish_data(topic):
+def publish_data(topic, device):
     """Publish sensor data to the specified MQTT topic"""
     try:
-        data = generate_sensor_data()
+        data = generate_sensor_data(device)
         client.publish(topic, json.dumps(data))
         logger.info(f"Published to {topic}: {data}")
     except Exception as e:
@@ -64,12 +65,13 @@ def publish_data(topic):
 def main():
     """Main function to connect to MQTT and publish data"""
     # Parse command-line arguments
-    parser = argparse.ArgumentParser(description="Simulate ESP32 sensor data for Bedroom or Workingroom")
-    parser.add_argument("room", choices=["bedroom", "workingroom"], help="Room to simulate (bedroom or workingroom)")
+    parser = argparse.ArgumentParser(description="Simulate ESP32 sensor data for a room")
+    parser.add_argument("room", help="Room to simulate (bedroom, workingroom or a new room)")
+    parser.add_argument("--device", type=int, default=1, help="DEVICE_ID of the simulated node")
     args = parser.parse_args()
 
-    # Select MQTT topic based on room
-    topic = MQTT_TOPIC_BEDROOM if args.room == "bedroom" else MQTT_TOPIC_WORKINGROOM
+    # Topic of this device in the site/room/device hierarchy
+    topic = f"{MQTT_TOPIC_ROOT}/{MQTT_SITE}/{args.room}/{args.device}"
     logger.info(f"Starting test data generator for {args.room.capitalize()}...")
     logger.info(f"MQTT Broker: {MQTT_BROKER}:{MQTT_PORT}")
     logger.info(f"Topic: {topic}")
@@ -88,7 +90,7 @@ def main():
     # Publish data every 5 seconds
     try:
         while True:
-            publish_data(topic)
+            publish_data(topic, args.device)
             time.sleep(5)  # Wait 5 seconds between publications
     except KeyboardInterrupt:
         logger.info(f"Stopping test data generator for {args.room.capitalize()}...")
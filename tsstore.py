@@ -0,0 +1,1086 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Append-only time-series store for sensor history.
+
+Samples of a room go to an open head and are sealed every BLOCK_SAMPLES
+samples into an immutable block file: a small header, the block index
+(min and max of every metric), then the rows sorted by time as Gorilla
+columns, timestamps as delta-of-deltas and each metric as floats XOR-ed
+with the previous value. The codec is host/gorilla.cpp, built and loaded
+through firmware.py: decoding bit by bit in Python would cost more than
+the compression saves. Block files are named after their time range, so
+opening the store only lists directories and reads headers and indexes.
+Queries decode the block files they touch into packed rows and
+binary-search them; threshold queries (scan_above) skip the files whose
+index rules them out.
+
+The store is fed from the write-ahead log (server3.HistoryWriter). Every
+block file records the log position (LSN) of the last sample sealed into
+it, so samples replayed from the log after a restart are skipped if a
+block file already holds them, and the open heads, which only live in
+memory, are rebuilt from the log. The feeder keeps its checkpoint in the
+store directory: the oldest position still held by an open head.
+
+Alongside the raw rows each room keeps rollup tiers (1 min, 15 min, 1 h)
+with min/max/sum/count per metric, updated on every append, so long ranges
+are answered from a few hundred buckets instead of every raw sample. Only
+closed buckets are written out; on open, the rows sealed after the last
+closed bucket of a tier are folded in again.
+
+Cold history is moved into archive files: the same rows in groups of
+BLOCK_SAMPLES, stored as separately compressed columns (delta-of-delta
+timestamps and raw float64 values, each byte-shuffled and zlib-compressed).
+They answer the same queries, decoding only the groups a range touches,
+and decoding runs in C (zlib, slice assignment, itertools.accumulate),
+never a Python loop per value.
+
+Merging, archiving and trimming are driven from outside (compaction.py);
+the store only offers atomic replacement of a room's files. Every file
+gets a name of its own, and a file written to replace others is preceded
+by a tombstone (<name>.replaces) listing them, so after a crash the
+replaced files are deleted only if their replacement was installed.
+"""
+
+import bisect
+import ctypes
+import itertools
+import logging
+from array import array
+import mmap
+from operator import sub
+import os
+import struct
+import tempfile
+import threading
+import time
+import zlib
+
+import firmware
+
+logger = logging.getLogger(__name__)
+
+METRICS = ("tvoc", "temperature", "humidity", "eco2", "aqi")
+BLOCK_SAMPLES = 720  # 1 hour at the 5 s publish interval
+
+ROLLUP_TIERS = (60, 900, 3600)  # Bucket widths in seconds
+
+# Block file: magic, version, fields per row, row count, t_min, t_max, LSN
+# just past the last sample sealed into it (0 when not fed from a log), then
+# the block index (BLOCK_INDEX): min and max of every metric, so threshold
+# queries skip the blocks that cannot match without reading them, and the
+# byte length of every column. The columns follow, Gorilla-encoded by
+# host/gorilla.cpp: timestamps as delta-of-deltas, then one column per
+# metric of floats XOR-ed with the previous value.
+BLOCK_FILE_MAGIC = b"AQRB"
+BLOCK_FILE_VERSION = 3
+BLOCK_FILE_HEADER = struct.Struct("<4sHHIqqQ4x")
+BLOCK_FILE_SUFFIX = ".rows"
+# timestamp, then METRICS in order
+ROW = struct.Struct("<q" + "d" * len(METRICS))
+ROW_FIELDS = 1 + len(METRICS)
+BLOCK_INDEX = struct.Struct("<" + "dd" * len(METRICS) + "I" * ROW_FIELDS)
+SCAN_ROWS = 4096  # Rows per buffer handed out by scan()
+# Versions 1 and 2 held fixed-size ROW records after the header (version 1
+# without the LSN); they are still read, until compaction merges or
+# archives them
+ROW_FILE_HEADERS = {1: struct.Struct("<4sHHIqq4x"), 2: BLOCK_FILE_HEADER}
+# Tombstone next to a file: names of the files it replaces, one per line
+REPLACES_SUFFIX = ".replaces"
+TMP_SUFFIX = ".tmp"
+
+# Archive file: magic, version, group count, row count, t_min, t_max, LSN as
+# in block files, then groups of up to BLOCK_SAMPLES rows. A group is a
+# GROUP_HEADER, the compressed length of each column (COLUMN_LENGTHS), then
+# the columns: timestamps as int64 delta-of-deltas, then one float64 column
+# per metric. Each column is byte-shuffled (every first byte, then every
+# second byte, ...) so the near-constant high bytes form long runs, and
+# compressed on its own, so a reader can decode only the columns it needs.
+# Cold data is read rarely, so archives trade the Gorilla columns of block
+# files for zlib's better ratio.
+ARCHIVE_MAGIC = b"AQRA"
+ARCHIVE_VERSION = 3
+ARCHIVE_HEADER = struct.Struct("<4sHHIqqQ4x")
+ARCHIVE_SUFFIX = ".arc"
+# t_min, t_max, row count, length of the column lengths and columns
+GROUP_HEADER = struct.Struct("<qqII")
+COLUMN_LENGTHS = struct.Struct("<" + "I" * ROW_FIELDS)
+# Archives of versions 1 and 2 (version 1 without the LSN) held, per group,
+# one Gorilla stream per metric with the timestamps interleaved, each after
+# a LEGACY_BLOCK_HEADER: t_min, t_max, count, v_min, v_max, encoded length
+ARCHIVE_HEADERS = {
+    1: struct.Struct("<4sHHIqq4x"),
+    2: ARCHIVE_HEADER,
+    3: ARCHIVE_HEADER,
+}
+LEGACY_BLOCK_HEADER = struct.Struct("<qqIddI")
+# Feeder checkpoint in the store directory: one LSN
+CHECKPOINT_FILE = "checkpoint"
+CHECKPOINT = struct.Struct("<Q")
+# bucket start, count, then min, max, sum for every metric
+ROLLUP_RECORD = struct.Struct("<qI" + "ddd" * len(METRICS))
+
+
+def fsync_dir(directory):
+    fd = os.open(directory, os.O_RDONLY)
+    try:
+        os.fsync(fd)
+    finally:
+        os.close(fd)
+
+
+def install(tmp, directory, stem, suffix, replaces=()):
+    """
+    Give a finished temporary file the first free name of stem + suffix,
+    stem.1 + suffix, ... and return its path. Names are never reused, so no
+    file is overwritten. The tombstone of replaces is made durable before
+    the file appears under its name.
+    """
+    for n in itertools.count():
+        path = os.path.join(directory, f"{stem}.{n}{suffix}" if n else stem + suffix)
+        if os.path.exists(path):
+            continue
+        tombstone = path + REPLACES_SUFFIX
+        if replaces:
+            with open(tombstone, "w") as f:
+                f.write("".join(os.path.basename(p) + "\n" for p in replaces))
+                f.flush()
+                os.fsync(f.fileno())
+        try:
+            os.link(tmp, path)
+        except FileExistsError:
+            if replaces:
+                os.remove(tombstone)
+            continue
+        os.remove(tmp)
+        fsync_dir(directory)
+        return path
+
+
+def shuffle(data, width=8):
+    """Bytes of width-byte items regrouped by byte position"""
+    return b"".join(data[i::width] for i in range(width))
+
+
+def unshuffle(data, width=8):
+    out = bytearray(len(data))
+    n = len(data) // width
+    for i in range(width):
+        out[i::width] = data[i * n : (i + 1) * n]
+    return out
+
+
+def encode_times(times):
+    """Compressed column of sorted integer timestamps"""
+    deltas = list(map(sub, times[1:], times[:-1]))
+    dods = times[:1] + deltas[:1] + list(map(sub, deltas[1:], deltas[:-1]))
+    return zlib.compress(shuffle(array("q", dods).tobytes()))
+
+
+def decode_times(data):
+    """Inverse of encode_times, as an int64 array"""
+    dods = array("q", unshuffle(zlib.decompress(data)))
+    deltas = itertools.accumulate(dods[1:])
+    return array("q", itertools.accumulate(itertools.chain(dods[:1], deltas)))
+
+
+def encode_values(values):
+    """Compressed column of floats"""
+    return zlib.compress(shuffle(array("d", values).tobytes()))
+
+
+def decode_values(data):
+    """Inverse of encode_values, as packed float64"""
+    return bytes(unshuffle(zlib.decompress(data)))
+
+
+def gorilla_encode(times, columns):
+    """Gorilla columns of sorted integer timestamps and of each list of floats"""
+    lib = firmware.load("gorilla")
+    times = array("q", times)
+    # Worst case: 77 bits per value after the first
+    out = ctypes.create_string_buffer(len(times) * 10 + 16)
+    n = lib.gorilla_encode_times(times.buffer_info()[0], len(times), out, len(out))
+    encoded = [out.raw[:n]]
+    for values in columns:
+        values = array("d", values)
+        address = values.buffer_info()[0]
+        n = lib.gorilla_encode_values(address, len(values), out, len(out))
+        encoded.append(out.raw[:n])
+    return encoded
+
+
+def gorilla_decode(data, count, out, field=0, stride=1):
+    """
+    Decode a Gorilla column of count values into the 8-byte slots field,
+    field + stride, ... of a writable buffer: timestamps for field 0, floats
+    otherwise
+    """
+    lib = firmware.load("gorilla")
+    view = (ctypes.c_char * memoryview(out).nbytes).from_buffer(out)
+    decode = lib.gorilla_decode_values if field else lib.gorilla_decode_times
+    failed = decode(data, len(data), count, ctypes.addressof(view) + 8 * field, stride)
+    del view  # Unpin out
+    if failed:
+        raise ValueError("Truncated Gorilla column")
+
+
+class BlockFile:
+    """Immutable file of Gorilla-encoded columns sorted by time, with a min/max index"""
+
+    __slots__ = ("path", "t_min", "t_max", "count", "lsn", "size", "ranges", "lengths")
+
+    def __init__(self, path, t_min, t_max, count, lsn, size, ranges, lengths):
+        self.path = path
+        self.t_min = t_min
+        self.t_max = t_max
+        self.count = count
+        self.lsn = lsn
+        self.size = size  # Bytes on disk
+        self.ranges = ranges  # (min, max) per metric, None if not known
+        self.lengths = lengths  # Encoded length of each column
+
+    @classmethod
+    def write(cls, directory, rows, lsn=0, replaces=()):
+        """
+        Write sorted rows to a new block file, atomically and durably: the
+        log it was fed from may be released once this returns. replaces are
+        the paths of the files it takes the place of.
+        """
+        t_min, t_max = rows[0][0], rows[-1][0]
+        columns = [[row[i] for row in rows] for i in range(1, ROW_FIELDS)]
+        ranges = [(min(values), max(values)) for values in columns]
+        encoded = gorilla_encode([row[0] for row in rows], columns)
+        lengths = [len(data) for data in encoded]
+        header = BLOCK_FILE_HEADER.pack(
+            BLOCK_FILE_MAGIC,
+            BLOCK_FILE_VERSION,
+            ROW_FIELDS,
+            len(rows),
+            t_min,
+            t_max,
+            lsn,
+        )
+        index = BLOCK_INDEX.pack(*itertools.chain(*ranges), *lengths)
+        fd, tmp = tempfile.mkstemp(TMP_SUFFIX, dir=directory)
+        with os.fdopen(fd, "wb") as f:
+            f.write(header)
+            f.write(index)
+            f.write(b"".join(encoded))
+            f.flush()
+            os.fsync(f.fileno())
+        stem = f"{t_min:010d}-{t_max:010d}"
+        path = install(tmp, directory, stem, BLOCK_FILE_SUFFIX, replaces)
+        size = len(header) + len(index) + sum(lengths)
+        return cls(path, t_min, t_max, len(rows), lsn, size, ranges, lengths)
+
+    @classmethod
+    def open(cls, path):
+        """Block file at path, None if it is not a complete one"""
+        with open(path, "rb") as f:
+            header = f.read(BLOCK_FILE_HEADER.size + BLOCK_INDEX.size)
+            size = os.fstat(f.fileno()).st_size
+        if len(header) < 6 or header[:4] != BLOCK_FILE_MAGIC:
+            return None
+        version = struct.unpack_from("<H", header, 4)[0]
+        if version in ROW_FILE_HEADERS:
+            return RowBlockFile.open_rows(path, version, header, size)
+        if version != BLOCK_FILE_VERSION:
+            logger.error(f"{path}: block file version {version} is not supported")
+            return None
+        if len(header) < BLOCK_FILE_HEADER.size + BLOCK_INDEX.size:
+            return None
+        _, _, fields, count, t_min, t_max, lsn = BLOCK_FILE_HEADER.unpack_from(header)
+        index = BLOCK_INDEX.unpack_from(header, BLOCK_FILE_HEADER.size)
+        bounds = index[: 2 * len(METRICS)]
+        ranges = list(zip(bounds[0::2], bounds[1::2]))
+        lengths = index[2 * len(METRICS) :]
+        if fields != ROW_FIELDS or size != len(header) + sum(lengths):
+            return None
+        return cls(path, t_min, t_max, count, lsn, size, ranges, lengths)
+
+    def _load(self, values=True):
+        """Encoded columns, only the timestamps unless values"""
+        lengths = self.lengths if values else self.lengths[:1]
+        with open(self.path, "rb") as f:
+            f.seek(BLOCK_FILE_HEADER.size + BLOCK_INDEX.size)
+            data = f.read(sum(lengths))
+        ends = list(itertools.accumulate(lengths))
+        return [data[end - n : end] for n, end in zip(lengths, ends)]
+
+    def _range(self, times, start, end):
+        """Indices of the first row >= start and past the last row <= end"""
+        first = 0 if start <= self.t_min else bisect.bisect_left(times, start)
+        last = self.count if end >= self.t_max else bisect.bisect_right(times, end)
+        return first, last
+
+    def count_range(self, start, end):
+        if start <= self.t_min and end >= self.t_max:
+            return self.count
+        times = array("q", bytes(8 * self.count))
+        gorilla_decode(self._load(False)[0], self.count, times)
+        first, last = self._range(times, start, end)
+        return last - first
+
+    def scan(self, start, end):
+        """Buffers of up to SCAN_ROWS packed rows with start <= t <= end"""
+        rows = bytearray(self.count * ROW.size)
+        for field, data in enumerate(self._load()):
+            gorilla_decode(data, self.count, rows, field, ROW_FIELDS)
+        view = memoryview(rows)
+        first, last = self._range(view.cast("q")[0::ROW_FIELDS], start, end)
+        for i in range(first, last, SCAN_ROWS):
+            yield view[i * ROW.size : min(i + SCAN_ROWS, last) * ROW.size]
+
+    def columns(self, start, end):
+        """
+        Rows in [start, end] as columns: packed int64 timestamps and one
+        packed float64 column per metric
+        """
+        encoded = self._load()
+        times = array("q", bytes(8 * self.count))
+        gorilla_decode(encoded[0], self.count, times)
+        first, last = self._range(times, start, end)
+        if first == last:
+            return
+        columns = []
+        for field, data in enumerate(encoded[1:], 1):
+            values = array("d", bytes(8 * self.count))
+            gorilla_decode(data, self.count, values, field)
+            columns.append(values[first:last].tobytes())
+        yield times[first:last].tobytes(), columns
+
+
+class RowBlockFile(BlockFile):
+    """Block file of versions 1 and 2: fixed-size rows, no min/max index"""
+
+    __slots__ = ("offset",)
+
+    @classmethod
+    def open_rows(cls, path, version, header, size):
+        layout = ROW_FILE_HEADERS[version]
+        if len(header) < layout.size:
+            return None
+        fields = layout.unpack_from(header)
+        row_size, count, t_min, t_max = fields[2:6]
+        lsn = fields[6] if len(fields) > 6 else 0
+        if row_size != ROW.size or size != layout.size + count * ROW.size:
+            return None
+        block = cls(path, t_min, t_max, count, lsn, size, None, None)
+        block.offset = layout.size
+        return block
+
+    def _map(self):
+        with open(self.path, "rb") as f:
+            # The mapping outlives the descriptor and is unmapped once the
+            # last memoryview over it is gone
+            return memoryview(mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ))
+
+    def count_range(self, start, end):
+        if start <= self.t_min and end >= self.t_max:
+            return self.count
+        first, last = self._rows(self._map()[self.offset :], start, end)
+        return last - first
+
+    def _rows(self, view, start, end):
+        times = view[: self.count * ROW.size].cast("q")
+        return self._range(times[0::ROW_FIELDS], start, end)
+
+    def scan(self, start, end):
+        view = self._map()[self.offset :]
+        first, last = self._rows(view, start, end)
+        for i in range(first, last, SCAN_ROWS):
+            yield view[i * ROW.size : min(i + SCAN_ROWS, last) * ROW.size]
+
+    def columns(self, start, end):
+        for chunk in self.scan(start, end):
+            values = chunk.cast("d")
+            yield chunk.cast("q")[0::ROW_FIELDS].tobytes(), [
+                values[i::ROW_FIELDS].tobytes() for i in range(1, ROW_FIELDS)
+            ]
+
+
+class ArchiveWriter:
+    """Builds an archive file group by group, so the work can be spread out"""
+
+    def __init__(self, directory, lsn=0):
+        self.directory = directory
+        self.lsn = lsn  # Newest LSN of the files it replaces
+        fd, self.tmp = tempfile.mkstemp(TMP_SUFFIX, dir=directory)
+        self.file = os.fdopen(fd, "wb")
+        self.file.write(bytes(ARCHIVE_HEADER.size))
+        self.size = ARCHIVE_HEADER.size
+        self.groups = 0
+        self.count = 0
+        self.t_min = None
+        self.t_max = None
+
+    def add(self, rows):
+        """Compress sorted rows as one group, returns the bytes written"""
+        times = [row[0] for row in rows]
+        columns = [encode_times(times)] + [
+            encode_values([row[i] for row in rows]) for i in range(1, ROW_FIELDS)
+        ]
+        data = COLUMN_LENGTHS.pack(*map(len, columns)) + b"".join(columns)
+        self.file.write(GROUP_HEADER.pack(times[0], times[-1], len(rows), len(data)))
+        self.file.write(data)
+        if self.t_min is None:
+            self.t_min = times[0]
+        self.t_max = times[-1]
+        self.groups += 1
+        self.count += len(rows)
+        self.size += GROUP_HEADER.size + len(data)
+        return GROUP_HEADER.size + len(data)
+
+    def close(self, replaces=()):
+        """Seal the file under its final name, taking the place of replaces"""
+        self.file.seek(0)
+        self.file.write(
+            ARCHIVE_HEADER.pack(
+                ARCHIVE_MAGIC,
+                ARCHIVE_VERSION,
+                self.groups,
+                self.count,
+                self.t_min,
+                self.t_max,
+                self.lsn,
+            )
+        )
+        self.file.flush()
+        os.fsync(self.file.fileno())
+        self.file.close()
+        stem = f"{self.t_min:010d}-{self.t_max:010d}"
+        path = install(self.tmp, self.directory, stem, ARCHIVE_SUFFIX, replaces)
+        return ArchiveFile(
+            path, self.t_min, self.t_max, self.count, self.size, self.lsn
+        )
+
+    def abort(self):
+        self.file.close()
+        os.remove(self.tmp)
+
+
+class ArchiveFile:
+    """Immutable compressed counterpart of a block file"""
+
+    __slots__ = ("path", "t_min", "t_max", "count", "size", "lsn", "version", "groups")
+    ranges = None  # No min/max index
+
+    def __init__(self, path, t_min, t_max, count, size, lsn=0, version=ARCHIVE_VERSION):
+        self.path = path
+        self.t_min = t_min
+        self.t_max = t_max
+        self.count = count
+        self.size = size  # Bytes on disk
+        self.lsn = lsn
+        self.version = version
+        self.groups = None  # (t_min, t_max, count, offset, length), read on demand
+
+    @classmethod
+    def open(cls, path):
+        """Archive file at path, None if its header is not valid"""
+        with open(path, "rb") as f:
+            header = f.read(ARCHIVE_HEADER.size)
+            size = os.fstat(f.fileno()).st_size
+        if len(header) < 6 or header[:4] != ARCHIVE_MAGIC:
+            return None
+        version = struct.unpack_from("<H", header, 4)[0]
+        layout = ARCHIVE_HEADERS.get(version)
+        if layout is None:
+            logger.error(f"{path}: archive version {version} is not supported")
+            return None
+        if len(header) < layout.size:
+            return None
+        fields = layout.unpack_from(header)
+        count, t_min, t_max = fields[3:6]
+        lsn = fields[6] if len(fields) > 6 else 0
+        return cls(path, t_min, t_max, count, size, lsn, version)
+
+    def _index(self):
+        if self.groups is None:
+            groups = []
+            with open(self.path, "rb") as f:
+                offset = ARCHIVE_HEADERS[self.version].size
+                while True:
+                    f.seek(offset)
+                    header = f.read(GROUP_HEADER.size)
+                    if len(header) < GROUP_HEADER.size:
+                        break
+                    t_min, t_max, count, length = GROUP_HEADER.unpack(header)
+                    groups.append((t_min, t_max, count, offset + len(header), length))
+                    offset += len(header) + length
+            self.groups = groups
+        return self.groups
+
+    def _groups(self, start, end, values=True):
+        """
+        Per group touching [start, end]: int64 timestamps in the range and,
+        with values, one packed float64 column per metric
+        """
+        with open(self.path, "rb") as f:
+            for t_min, t_max, count, offset, length in self._index():
+                if t_max < start or t_min > end:
+                    continue
+                f.seek(offset)
+                data = f.read(length)
+                if self.version < ARCHIVE_VERSION:
+                    times, columns = self._decode_legacy(data, count)
+                else:
+                    lengths = COLUMN_LENGTHS.unpack_from(data)
+                    position = COLUMN_LENGTHS.size
+                    times = decode_times(data[position : position + lengths[0]])
+                    columns = None
+                first, last = 0, len(times)
+                if t_min < start or t_max > end:
+                    # Sorted within a group
+                    first = bisect.bisect_left(times, start)
+                    last = bisect.bisect_right(times, end)
+                if first == last:
+                    continue
+                if not values:
+                    columns = []
+                elif columns is None:
+                    columns = []
+                    position += lengths[0]
+                    for n in lengths[1:]:
+                        column = decode_values(data[position : position + n])
+                        columns.append(column[first * 8 : last * 8])
+                        position += n
+                else:
+                    columns = [column[first * 8 : last * 8] for column in columns]
+                yield times[first:last], columns
+
+    @staticmethod
+    def _decode_legacy(data, count):
+        """
+        Timestamps and packed float64 columns of a version 1 or 2 group: one
+        interleaved Gorilla stream per metric, all with the same timestamps
+        """
+        lib = firmware.load("gorilla")
+        times = array("q", bytes(8 * count))
+        columns, position = [], 0
+        for _ in METRICS:
+            length = LEGACY_BLOCK_HEADER.unpack_from(data, position)[5]
+            position += LEGACY_BLOCK_HEADER.size
+            values = array("d", bytes(8 * count))
+            stream = data[position : position + length]
+            position += length
+            failed = lib.gorilla_decode_block(
+                stream,
+                len(stream),
+                count,
+                times.buffer_info()[0],
+                values.buffer_info()[0],
+            )
+            if failed:
+                raise ValueError("Truncated Gorilla block in a legacy archive")
+            columns.append(values.tobytes())
+        return times, columns
+
+    def count_range(self, start, end):
+        if start <= self.t_min and end >= self.t_max:
+            return self.count
+        return sum(len(times) for times, _ in self._groups(start, end, False))
+
+    def scan(self, start, end):
+        """Packed ROW buffers of the rows in [start, end], one per group"""
+        for times, columns in self._groups(start, end):
+            # Interleave the columns as 8-byte fields
+            rows = array("q", bytes(len(times) * ROW.size))
+            rows[0::ROW_FIELDS] = times
+            for i, column in enumerate(columns, 1):
+                rows[i::ROW_FIELDS] = array("q", column)
+            yield rows.tobytes()
+
+    def columns(self, start, end):
+        """Same as BlockFile.columns, one group at a time, without building rows"""
+        for times, columns in self._groups(start, end):
+            yield times.tobytes(), columns
+
+
+def load_room(directory):
+    """
+    Block and archive files of a room directory in time order, and apart
+    from them the paths left over by a run that stopped: files replaced by
+    a merge or archive whose output was installed (as listed in its
+    tombstone), spent tombstones and unfinished temporary files, in the
+    order to delete them. Only reads, nothing is changed on disk.
+    """
+    names = set(os.listdir(directory))
+    leftover, tombstones = [], []
+    for name in sorted(names):
+        if name.endswith(TMP_SUFFIX):
+            leftover.append(name)
+        elif name.endswith(REPLACES_SUFFIX):
+            tombstones.append(name)
+            # Written before its file was installed: without the file, the
+            # replaced ones are still the valid copy
+            if name[: -len(REPLACES_SUFFIX)] in names:
+                with open(os.path.join(directory, name)) as f:
+                    leftover += [old for old in f.read().split() if old in names]
+    leftover += tombstones
+    files = []
+    for name in sorted(names.difference(leftover)):
+        if name.endswith(BLOCK_FILE_SUFFIX):
+            block = BlockFile.open(os.path.join(directory, name))
+        elif name.endswith(ARCHIVE_SUFFIX):
+            block = ArchiveFile.open(os.path.join(directory, name))
+        else:
+            continue
+        if block is None:
+            logger.warning(f"Skipping damaged history block {directory}/{name}")
+            continue
+        files.append(block)
+    files.sort(key=lambda b: b.t_min)
+    return files, [os.path.join(directory, name) for name in leftover]
+
+
+class RoomHistory:
+    """Block files of a room ordered by time plus the open head"""
+
+    def __init__(self):
+        self.blocks = []
+        # Running maximum of t_max, so bisect stays valid if the clock stepped back
+        self.block_ends = []
+        self.head = []  # Rows not sealed yet
+        self.head_lsn = None  # LSN of the first head row
+        self.head_since = 0.0  # Monotonic time of the first head row
+        self.last_lsn = None  # LSN of the last row appended
+        self.sealed_lsn = 0  # Rows below this LSN are in block files
+
+    def add_block(self, block):
+        self.blocks.append(block)
+        self.sealed_lsn = max(self.sealed_lsn, block.lsn)
+        end = max(block.t_max, self.block_ends[-1]) if self.block_ends else block.t_max
+        self.block_ends.append(end)
+
+    def earliest(self):
+        if self.blocks:
+            return self.blocks[0].t_min
+        return self.head[0][0] if self.head else None
+
+    def overlapping(self, start, end):
+        """Blocks that may hold rows in [start, end]"""
+        i = bisect.bisect_left(self.block_ends, start)
+        return [block for block in self.blocks[i:] if block.t_min <= end]
+
+    def replace(self, old, new):
+        """Swap files for ones holding the same rows"""
+        gone = set(id(block) for block in old)
+        blocks = [block for block in self.blocks if id(block) not in gone] + new
+        blocks.sort(key=lambda block: block.t_min)
+        self.blocks = []
+        self.block_ends = []
+        for block in blocks:
+            self.add_block(block)
+
+
+class Rollup:
+    """One downsampled tier of a room: min/max/sum/count per metric per bucket"""
+
+    def __init__(self, width):
+        self.width = width
+        self.starts = []  # Sealed bucket start times, for bisect
+        self.records = []  # (start, count, mins, maxs, sums)
+        self.open = None
+
+    def add_record(self, record):
+        self.starts.append(record[0])
+        self.records.append(record)
+
+    def trim(self, before):
+        """Drop the sealed buckets that start before a time"""
+        first = bisect.bisect_left(self.starts, before)
+        del self.starts[:first]
+        del self.records[:first]
+        return first
+
+    def add(self, t, values):
+        """
+        Fold one sample in, returns the sealed record when a bucket closes.
+        Closed buckets are never reopened: a row older than the open bucket
+        is left out, which also keeps rows replayed after a restart from
+        being counted twice.
+        """
+        bucket = t - t % self.width
+        if (self.open is not None and bucket < self.open[0]) or (
+            self.starts and bucket <= self.starts[-1]
+        ):
+            return None
+        sealed = None
+        if self.open is not None and self.open[0] != bucket:
+            sealed = self._seal()
+        if self.open is None:
+            self.open = [bucket, 0, list(values), list(values), [0.0] * len(values)]
+        _, _, mins, maxs, sums = self.open
+        self.open[1] += 1
+        for i, v in enumerate(values):
+            if v < mins[i]:
+                mins[i] = v
+            if v > maxs[i]:
+                maxs[i] = v
+            sums[i] += v
+        return sealed
+
+    def _seal(self):
+        start, count, mins, maxs, sums = self.open
+        record = (start, count, tuple(mins), tuple(maxs), tuple(sums))
+        self.open = None
+        self.add_record(record)
+        return record
+
+    def query(self, start, end):
+        first = bisect.bisect_right(self.starts, start - self.width)
+        records = []
+        for record in self.records[first:]:
+            if record[0] > end:
+                break
+            records.append(record)
+        if self.open is not None and start - self.width < self.open[0] <= end:
+            bucket, count, mins, maxs, sums = self.open
+            records.append((bucket, count, tuple(mins), tuple(maxs), tuple(sums)))
+        return records
+
+    @staticmethod
+    def pack(record):
+        start, count, mins, maxs, sums = record
+        fields = []
+        for i in range(len(METRICS)):
+            fields += [mins[i], maxs[i], sums[i]]
+        return ROLLUP_RECORD.pack(start, count, *fields)
+
+    @staticmethod
+    def unpack(raw):
+        start, count, *fields = ROLLUP_RECORD.unpack(raw)
+        return (start, count, tuple(fields[0::3]), tuple(fields[1::3]), tuple(fields[2::3]))
+
+
+def pick_tier(step):
+    """Coarsest rollup width not wider than the requested step, None for raw data"""
+    tiers = [width for width in ROLLUP_TIERS if width <= step]
+    return max(tiers) if tiers else None
+
+
+class TimeSeriesStore:
+    """Per-room history in block files plus rollup tiers"""
+
+    def __init__(self, path):
+        self.path = path
+        self.lock = threading.RLock()
+        self.rooms = {}  # room -> RoomHistory
+        self.rollups = {}  # (room, width) -> Rollup
+        # Files of threshold queries skipped by their min/max index, and read
+        self.skipped_blocks = 0
+        self.scanned_blocks = 0
+        os.makedirs(path, exist_ok=True)
+        self._load()
+
+    def _rollup_file(self, room, width):
+        return os.path.join(self.path, room, f"rollup_{width}.bin")
+
+    def _load(self):
+        for room in sorted(os.listdir(self.path)):
+            directory = os.path.join(self.path, room)
+            if not os.path.isdir(directory):
+                continue
+            history = self.rooms[room] = RoomHistory()
+            files, leftover = load_room(directory)
+            for block in files:
+                history.add_block(block)
+            for path in leftover:
+                logger.info(f"Removing leftover history file {path}")
+                os.remove(path)
+            for width in ROLLUP_TIERS:
+                filename = self._rollup_file(room, width)
+                if os.path.exists(filename):
+                    self.rollups[(room, width)] = self._load_rollup(filename, width)
+            self._catch_up_rollups(room)
+
+    def _catch_up_rollups(self, room):
+        """
+        Fold the sealed rows after the last closed bucket of each tier back
+        in: open buckets were only in memory. A tier without buckets (all
+        trimmed, or a new tier) starts where the others end.
+        """
+        ends = {}
+        for width in ROLLUP_TIERS:
+            rollup = self.rollups.get((room, width))
+            if rollup and rollup.starts:
+                ends[width] = rollup.starts[-1] + width
+        default = max(ends.values()) if ends else None
+        starts = {width: ends.get(width, default) for width in ROLLUP_TIERS}
+        start = min((t for t in starts.values() if t is not None), default=None)
+        if start is None:
+            start = self.earliest(room)
+            if start is None:
+                return
+        for chunk in self.scan(room, start, 1 << 62):
+            for row in ROW.iter_unpack(chunk):
+                t = row[0]
+                for width in ROLLUP_TIERS:
+                    if starts[width] is None or t >= starts[width]:
+                        self._fold(room, width, t, row[1:])
+
+    def _load_rollup(self, filename, width):
+        rollup = Rollup(width)
+        with open(filename, "rb") as f:
+            while True:
+                raw = f.read(ROLLUP_RECORD.size)
+                if len(raw) < ROLLUP_RECORD.size:
+                    break
+                rollup.add_record(Rollup.unpack(raw))
+        return rollup
+
+    def append(self, room, timestamp, values, lsn=None):
+        """
+        Append one sample; values maps each metric name to its value. lsn
+        is its position in the log the store is fed from: False if a block
+        file already holds it.
+        """
+        t = int(timestamp)
+        row = tuple(float(values[metric]) for metric in METRICS)
+        with self.lock:
+            history = self.rooms.get(room)
+            if history is None:
+                os.makedirs(os.path.join(self.path, room), exist_ok=True)
+                history = self.rooms[room] = RoomHistory()
+            if lsn is not None and lsn < history.sealed_lsn:
+                return False
+            if not history.head:
+                history.head_lsn = lsn
+                history.head_since = time.monotonic()
+            history.head.append((t,) + row)
+            history.last_lsn = lsn
+            if len(history.head) >= BLOCK_SAMPLES:
+                self._seal(room, history)
+            for width in ROLLUP_TIERS:
+                self._fold(room, width, t, row)
+        return True
+
+    def _seal(self, room, history):
+        # Several devices per room: arrival order is only nearly sorted
+        history.head.sort(key=lambda r: r[0])
+        directory = os.path.join(self.path, room)
+        lsn = 0 if history.last_lsn is None else history.last_lsn + 1
+        history.add_block(BlockFile.write(directory, history.head, lsn))
+        history.head = []
+
+    def _fold(self, room, width, t, row):
+        rollup = self.rollups.get((room, width))
+        if rollup is None:
+            rollup = self.rollups[(room, width)] = Rollup(width)
+        record = rollup.add(t, row)
+        if record is not None:
+            with open(self._rollup_file(room, width), "ab") as f:
+                f.write(Rollup.pack(record))
+
+    def seal_idle(self, max_age):
+        """Seal the heads opened more than max_age seconds ago, returns how many"""
+        sealed = 0
+        with self.lock:
+            now = time.monotonic()
+            for room, history in self.rooms.items():
+                if history.head and now - history.head_since >= max_age:
+                    self._seal(room, history)
+                    sealed += 1
+        return sealed
+
+    def replay_from(self, position):
+        """
+        Log position to replay from after a restart, for a feeder that has
+        read up to position: the oldest row still held in an open head
+        """
+        with self.lock:
+            return min(
+                (
+                    h.head_lsn
+                    for h in self.rooms.values()
+                    if h.head and h.head_lsn is not None
+                ),
+                default=position,
+            )
+
+    def sealed_lsn(self):
+        """LSN past the newest sample held in a block file of any room"""
+        with self.lock:
+            return max((h.sealed_lsn for h in self.rooms.values()), default=0)
+
+    def read_checkpoint(self):
+        """Log position saved by the feeder, 0 if there is none"""
+        try:
+            with open(os.path.join(self.path, CHECKPOINT_FILE), "rb") as f:
+                return CHECKPOINT.unpack(f.read(CHECKPOINT.size))[0]
+        except (FileNotFoundError, struct.error):
+            return 0
+
+    def write_checkpoint(self, lsn):
+        """Save the feeder's position; the block files it relies on are already durable"""
+        filename = os.path.join(self.path, CHECKPOINT_FILE)
+        with open(filename + ".tmp", "wb") as f:
+            f.write(CHECKPOINT.pack(lsn))
+            f.flush()
+            os.fsync(f.fileno())
+        os.replace(filename + ".tmp", filename)
+
+    def files(self, room):
+        """Block and archive files of a room, oldest first"""
+        with self.lock:
+            history = self.rooms.get(room)
+            return list(history.blocks) if history else []
+
+    def replace_files(self, room, old, new):
+        """
+        Atomically swap files for ones holding the same rows. The old files
+        are left on disk for scans already under way; the caller deletes
+        them later.
+        """
+        with self.lock:
+            self.rooms[room].replace(old, new)
+
+    def trim_rollup(self, room, width, before):
+        """Drop the buckets of a tier older than a time, returns the bytes rewritten"""
+        with self.lock:
+            rollup = self.rollups.get((room, width))
+            dropped = rollup.trim(before) if rollup else 0
+            if not dropped:
+                return 0
+            # The file holds the sealed records in order, keep its tail as is
+            filename = self._rollup_file(room, width)
+            with open(filename, "rb") as f:
+                f.seek(dropped * ROLLUP_RECORD.size)
+                data = f.read()
+            with open(filename + ".tmp", "wb") as f:
+                f.write(data)
+            os.replace(filename + ".tmp", filename)
+            return len(data)
+
+    def earliest(self, room):
+        """Oldest timestamp held for a room, or None"""
+        with self.lock:
+            history = self.rooms.get(room)
+            return history.earliest() if history else None
+
+    def covers(self, room, start):
+        earliest = self.earliest(room)
+        return earliest is not None and earliest <= start
+
+    def _snapshot(self, room, start, end):
+        """Blocks and head rows of a room in [start, end], stable without the lock"""
+        with self.lock:
+            history = self.rooms.get(room)
+            if history is None:
+                return [], []
+            head = [row for row in history.head if start <= row[0] <= end]
+            # Rows of several devices arrive only nearly in time order
+            head.sort(key=lambda r: r[0])
+            return history.overlapping(start, end), head
+
+    def count(self, room, start, end):
+        """Number of rows in [start, end]"""
+        blocks, head = self._snapshot(room, start, end)
+        return sum(block.count_range(start, end) for block in blocks) + len(head)
+
+    def scan(self, room, start, end):
+        """Rows in [start, end] as buffers of packed ROW records, in time order"""
+        blocks, head = self._snapshot(room, start, end)
+        for block in blocks:
+            yield from block.scan(start, end)
+        if head:
+            yield b"".join(ROW.pack(*row) for row in head)
+
+    def scan_above(self, room, start, end, metric, threshold):
+        """
+        Rows in [start, end] whose metric is above threshold, as buffers of
+        packed ROW records in time order. Blocks whose maximum of the metric
+        is not above threshold are skipped without being read.
+        """
+        field = 1 + METRICS.index(metric)
+        threshold = float(threshold)
+        blocks, head = self._snapshot(room, start, end)
+        for block in blocks:
+            ranges = block.ranges
+            if ranges is not None and ranges[field - 1][1] <= threshold:
+                self.skipped_blocks += 1
+                continue
+            self.scanned_blocks += 1
+            for chunk in block.scan(start, end):
+                if ranges is not None and ranges[field - 1][0] > threshold:
+                    yield chunk
+                    continue
+                chunk = memoryview(chunk)
+                values = chunk.cast("d")[field::ROW_FIELDS]
+                above = map(threshold.__lt__, values)
+                keep = itertools.compress(range(len(values)), above)
+                rows = b"".join(chunk[i * ROW.size : (i + 1) * ROW.size] for i in keep)
+                if rows:
+                    yield rows
+        rows = b"".join(ROW.pack(*row) for row in head if row[field] > threshold)
+        if rows:
+            yield rows
+
+    def query(self, room, start, end):
+        """Rows (timestamp, tvoc, temperature, humidity, eco2, aqi) in [start, end]"""
+        return [
+            row
+            for chunk in self.scan(room, start, end)
+            for row in ROW.iter_unpack(chunk)
+        ]
+
+    def query_columns(self, room, start, end):
+        """
+        Timestamps in [start, end] as an int64 array and one float64 array per
+        metric, in METRICS order, filled from the files' columns without
+        unpacking rows
+        """
+        blocks, head = self._snapshot(room, start, end)
+        times, values = array("q"), [array("d") for _ in METRICS]
+        for block in blocks:
+            for chunk, columns in block.columns(start, end):
+                times.frombytes(chunk)
+                for column, data in zip(values, columns):
+                    column.frombytes(data)
+        for row in head:
+            times.append(row[0])
+            for column, value in zip(values, row[1:]):
+                column.append(value)
+        return times, values
+
+    def query_rollup(self, room, start, end, width):
+        """
+        Buckets (start, count, mins, maxs, avgs) of one tier overlapping
+        [start, end]. Fine tiers are trimmed by compaction; if the tier no
+        longer reaches back to start, the next coarser one that does is used.
+        """
+        with self.lock:
+            coarsest = self.rollups.get((room, ROLLUP_TIERS[-1]))
+            if coarsest and coarsest.starts:
+                # Nothing is older than the first bucket of the untrimmed tier
+                start = max(start, coarsest.starts[0])
+            for tier in ROLLUP_TIERS[ROLLUP_TIERS.index(width) :]:
+                rollup = self.rollups.get((room, tier))
+                if rollup and rollup.starts and rollup.starts[0] <= start + tier:
+                    break
+            records = rollup.query(start, end) if rollup else []
+        return [
+            (bucket, count, mins, maxs, tuple(total / count for total in sums))
+            for bucket, count, mins, maxs, sums in records
+        ]
+
+    def stats(self):
+        with self.lock:
+            files = [b for h in self.rooms.values() for b in h.blocks]
+            blocks = [b for b in files if isinstance(b, BlockFile)]
+            sealed = sum(b.count for b in files)
+            size = sum(b.size for b in files)
+            return {
+                "rooms": len(self.rooms),
+                "block_files": len(blocks),
+                "archive_files": len(files) - len(blocks),
+                "sealed_points": sealed,
+                "head_points": sum(len(h.head) for h in self.rooms.values()),
+                "disk_bytes": size,
+                # Per sample of all metrics, block and archive files together
+                "bytes_per_point": round(size / sealed, 1) if sealed else 0,
+                "threshold_blocks_skipped": self.skipped_blocks,
+                "threshold_blocks_scanned": self.scanned_blocks,
+            }
@@ -0,0 +1,427 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Write-ahead log for ingested samples.
+
+The log is a run of fixed-size segment files. A segment is preallocated when
+it is created, so appends never change file metadata and fdatasync stays
+cheap. A log position (LSN) is a byte address: segment number * segment
+size + offset. Every record is
+
+    <uint32 length, uint32 crc32, uint64 lsn> payload
+
+with the CRC covering the LSN and the payload, so neither a torn tail nor
+the zeroes of a preallocated segment pass as a record. A record that does
+not fit the rest of a segment goes to the next one and the tail is left as
+zero padding.
+
+Since LSNs are computed from the segment size, the size a log was created
+with is kept next to its segments (SEGMENT_SIZE_FILE) and reused when it is
+reopened: a changed WAL_SEGMENT_MB only applies to a new log. A log
+from before the file existed has it inferred from its preallocated segments.
+
+Appends reach the OS immediately and readers in the same process see them
+as soon as append() returns; a sync thread makes them durable in batches
+(group commit). Consumers keep their own checkpoint: they read from the LSN
+they last made durable downstream and release the segments below it; a
+segment is deleted once every consumer registered with add_consumer() has
+released it. On
+open, the end of the log is found by scanning the newest segment up to its
+first invalid record, and a consumer starting from its checkpoint replays
+everything after it.
+
+The log can be capped (max_bytes). A consumer that stays down long enough,
+such as the database writer through a long outage, would otherwise fill
+the disk. When a roll would take the log past the cap, the oldest segments
+are dropped whether or not they were consumed, and readers still
+positioned in them skip to the new start. on_pressure(backlog, dropped) is
+called once when the backlog first passes WARN_FRACTION of the cap
+(dropped = 0) and after every drop, outside the log's lock.
+"""
+
+import logging
+import os
+import struct
+import threading
+import time
+import zlib
+from collections import deque
+
+logger = logging.getLogger(__name__)
+
+HEADER = struct.Struct("<IIQ")
+_LSN = struct.Struct("<Q")
+SEGMENT_SUFFIX = ".wal"
+SEGMENT_SIZE_FILE = "segment_bytes"  # Segment size of the log, decimal
+READ_CHUNK = 1 << 20  # Bytes read at a time by readers and the recovery scan
+MAX_RECORD = 1 << 16
+WARN_FRACTION = 0.8  # Backlog of the cap that triggers the first warning
+
+
+class WalError(Exception):
+    pass
+
+
+def record_crc(lsn, payload):
+    return zlib.crc32(payload, zlib.crc32(_LSN.pack(lsn)))
+
+
+class WriteAheadLog:
+    """Segmented append-only log with batched fdatasync"""
+
+    def __init__(
+        self, path, segment_bytes, sync_interval, max_bytes=0, on_pressure=None
+    ):
+        self.name = "wal"
+        self.path = path
+        os.makedirs(path, exist_ok=True)
+        segments = self.segments()
+        segment_bytes = self._segment_size(segments, segment_bytes)
+        self.segment_bytes = segment_bytes
+        self.sync_interval = sync_interval
+        # The segment being written and the one before it are never dropped
+        self.max_bytes = max(max_bytes, 2 * segment_bytes) if max_bytes else 0
+        self.on_pressure = on_pressure
+        self.warned = False  # Backlog above WARN_FRACTION reported
+        self.dropped_bytes = 0
+        self.consumers = {}  # name -> released LSN, None until the first release
+        self.cond = threading.Condition()
+        self.fd = None  # Current segment, created on the first append
+        # Fds of rolled segments, synced and closed by the sync thread
+        self.retired = []
+        self.appended = 0
+        self.syncs = 0
+        self.unsynced_since = None  # Monotonic time of the oldest unsynced append
+        self.sync_lags = deque(maxlen=1000)  # Append-to-durable seconds, worst per sync
+        if segments:
+            self.start_lsn = segments[0] * segment_bytes
+            self.segment = segments[-1]
+            self.end_lsn = self._scan_end(self.segment)
+            self.fd = os.open(self._segment_file(self.segment), os.O_RDWR)
+        else:
+            self.start_lsn = self.end_lsn = 0
+            self.segment = 0
+        self.synced_lsn = self.end_lsn
+        self.thread = threading.Thread(target=self._sync_loop, name="wal", daemon=True)
+
+    def start(self):
+        self.thread.start()
+
+    def _segment_file(self, segment):
+        return os.path.join(self.path, f"{segment:010d}{SEGMENT_SUFFIX}")
+
+    def segments(self):
+        """Numbers of the segment files on disk, oldest first"""
+        return sorted(
+            int(name[: -len(SEGMENT_SUFFIX)])
+            for name in os.listdir(self.path)
+            if name.endswith(SEGMENT_SUFFIX)
+        )
+
+    def _segment_size(self, segments, configured):
+        """
+        Segment size of the log on disk: the recorded one, else the size of
+        its oldest preallocated segment; configured for an empty log
+        """
+        size_file = os.path.join(self.path, SEGMENT_SIZE_FILE)
+        try:
+            with open(size_file) as f:
+                recorded = int(f.read())
+        except (FileNotFoundError, ValueError):
+            recorded = None
+        if not segments:
+            size = configured
+        elif recorded:
+            size = recorded
+        else:
+            size = os.path.getsize(self._segment_file(segments[0])) or configured
+        if size != configured:
+            logger.warning(
+                f"Write-ahead log in {self.path} has {size} byte segments, "
+                f"keeping that size instead of {configured}"
+            )
+        if size != recorded:
+            tmp = size_file + ".tmp"
+            with open(tmp, "w") as f:
+                f.write(str(size))
+                f.flush()
+                os.fsync(f.fileno())
+            os.replace(tmp, size_file)
+            self._sync_dir()
+        return size
+
+    def _sync_dir(self):
+        dir_fd = os.open(self.path, os.O_RDONLY)
+        try:
+            os.fsync(dir_fd)
+        finally:
+            os.close(dir_fd)
+
+    def _scan_end(self, segment):
+        """LSN just past the last valid record of a segment"""
+        reader = WalReader(self, segment * self.segment_bytes)
+        limit = (segment + 1) * self.segment_bytes
+        records = []
+        while reader.read_valid(limit, 1000, records) and reader.position < limit:
+            records.clear()
+        reader.close()
+        return reader.position
+
+    def _create(self, segment):
+        fd = os.open(self._segment_file(segment), os.O_RDWR | os.O_CREAT, 0o644)
+        try:
+            os.posix_fallocate(fd, 0, self.segment_bytes)
+        except (AttributeError, OSError):
+            os.ftruncate(fd, self.segment_bytes)  # Sparse, but still fixed size
+        self._sync_dir()  # Make the new directory entry durable too
+        return fd
+
+    def append(self, payload):
+        """Append one record, returns its LSN"""
+        if len(payload) > MAX_RECORD:
+            raise WalError(f"Record of {len(payload)} bytes is too large")
+        size = HEADER.size + len(payload)
+        pressure = None
+        with self.cond:
+            offset = self.end_lsn - self.segment * self.segment_bytes
+            if self.fd is None or offset + size > self.segment_bytes:
+                pressure = self._roll()
+                offset = self.end_lsn - self.segment * self.segment_bytes
+            lsn = self.end_lsn
+            record = HEADER.pack(len(payload), record_crc(lsn, payload), lsn) + payload
+            os.pwrite(self.fd, record, offset)
+            self.end_lsn = lsn + size
+            self.appended += 1
+            if self.unsynced_since is None:
+                self.unsynced_since = time.monotonic()
+            self.cond.notify_all()
+        if pressure and self.on_pressure:
+            self.on_pressure(*pressure)
+        return lsn
+
+    def _roll(self):
+        """Start the next segment, returns (backlog, dropped) to report or None"""
+        if self.fd is not None:
+            self.retired.append(self.fd)
+            self.segment += 1
+        self.fd = self._create(self.segment)
+        self.end_lsn = self.segment * self.segment_bytes
+        if not self.max_bytes:
+            return None
+        end = self.end_lsn + self.segment_bytes
+        backlog = end - self.start_lsn
+        if backlog <= self.max_bytes * WARN_FRACTION:
+            self.warned = False
+            return None
+        if backlog <= self.max_bytes:
+            if self.warned:
+                return None
+            self.warned = True
+            return backlog, 0
+        # Readers see the new start before the files disappear
+        old_start = self.start_lsn
+        keep = -(-(end - self.max_bytes) // self.segment_bytes)  # Rounded up
+        self.start_lsn = keep * self.segment_bytes
+        self._remove(keep)
+        dropped = self.start_lsn - old_start
+        self.dropped_bytes += dropped
+        logger.error(f"Write-ahead log over its cap, dropped {dropped} unconsumed bytes")
+        return end - self.start_lsn, dropped
+
+    def _remove(self, end):
+        """Delete the segment files numbered below end"""
+        for segment in self.segments():
+            if segment >= end:
+                break
+            os.remove(self._segment_file(segment))
+
+    def _sync_loop(self):
+        while True:
+            time.sleep(self.sync_interval)
+            with self.cond:
+                if self.end_lsn == self.synced_lsn:
+                    continue
+                fd, end, since = self.fd, self.end_lsn, self.unsynced_since
+                retired, self.retired = self.retired, []
+                self.unsynced_since = None
+            # Older segments first, so durability never has gaps
+            for old in retired:
+                os.fdatasync(old)
+                os.close(old)
+            os.fdatasync(fd)
+            self.synced_lsn = end
+            self.syncs += 1
+            if since is not None:
+                self.sync_lags.append(time.monotonic() - since)
+
+    def wait(self, lsn, timeout):
+        """Wait until the log extends past lsn, False on timeout"""
+        with self.cond:
+            return self.cond.wait_for(lambda: self.end_lsn > lsn, timeout)
+
+    def add_consumer(self, name):
+        """Register a reader whose position holds segments back"""
+        with self.cond:
+            self.consumers[name] = None
+
+    def restart_at(self, lsn):
+        """
+        Continue an empty log (a new or wiped directory) at a segment past
+        lsn, so positions keep increasing for a consumer that outlived it
+        """
+        with self.cond:
+            if self.end_lsn != self.start_lsn or lsn < self.end_lsn:
+                return
+            if self.fd is not None:
+                os.close(self.fd)
+                self.fd = None
+            self._remove(self.segment + 1)
+            self.segment = lsn // self.segment_bytes + 1
+            self.start_lsn = self.end_lsn = self.synced_lsn = (
+                self.segment * self.segment_bytes
+            )
+
+    def release(self, name, lsn):
+        """
+        Record that a consumer is done with everything below lsn, delete the
+        segments that every consumer is done with
+        """
+        with self.cond:
+            self.consumers[name] = lsn
+            if None in self.consumers.values():
+                return
+            lsn = min(self.consumers.values())
+            keep = min(lsn // self.segment_bytes, self.segment)
+            self.start_lsn = max(self.start_lsn, keep * self.segment_bytes)
+            self._remove(keep)
+
+    def stats(self):
+        lags = sorted(self.sync_lags)
+        p99 = lags[int(len(lags) * 0.99)] if lags else 0
+        return {
+            "appended": self.appended,
+            "syncs": self.syncs,
+            "segments": (self.end_lsn - self.start_lsn) // self.segment_bytes + 1,
+            "unsynced_bytes": self.end_lsn - self.synced_lsn,
+            "dropped_bytes": self.dropped_bytes,
+            "p99_durable_ms": round(p99 * 1000, 1),
+        }
+
+
+class WalReader:
+    """Sequential reader from an LSN, reads segment files in large chunks"""
+
+    def __init__(self, wal, lsn, with_lsn=False):
+        self.wal = wal
+        self.with_lsn = with_lsn  # Records as (lsn, payload)
+        self.position = lsn
+        self.skipped = 0  # Corrupt segment tails skipped
+        self.lost = 0  # Bytes dropped by the log's cap before they were read
+        self.fd = None
+        self.fd_segment = None
+        self.buf = memoryview(b"")
+        self.buf_lsn = lsn
+
+    def close(self):
+        if self.fd is not None:
+            os.close(self.fd)
+            self.fd = None
+
+    def read(self, max_records):
+        """
+        Payloads, or (lsn, payload) with with_lsn, of up to max_records
+        records between the position and the end of the log
+        """
+        records = []
+        segment_bytes = self.wal.segment_bytes
+        end = self.wal.end_lsn
+        while len(records) < max_records and self.position < end:
+            start = self.wal.start_lsn
+            if self.position < start:
+                logger.error(f"WAL dropped {start - self.position} unread bytes")
+                self.lost += start - self.position
+                self.position = start
+                self.buf, self.buf_lsn = memoryview(b""), start
+                continue
+            segment_end = (self.position // segment_bytes + 1) * segment_bytes
+            try:
+                if self.read_valid(min(end, segment_end), max_records, records):
+                    continue
+            except FileNotFoundError:
+                continue  # Dropped after the check above, skip to the new start
+            # Only zero padding may follow the last record of a rolled segment;
+            # anything else is damage and the rest of the segment is unusable
+            if end < segment_end or self._length(segment_end):
+                self.skipped += 1
+                logger.error(f"Corrupt WAL record at {self.position}, skipping segment")
+            self.position = segment_end
+        return records
+
+    def read_valid(self, limit, max_records, records):
+        """
+        Append to records the payloads of the valid records that end by
+        limit, up to max_records. False if it stopped at an invalid record.
+        """
+        while len(records) < max_records and self.position < limit:
+            if not self._parse(max_records, records):
+                return False
+            # The buffer ran out before the next record did
+            if len(records) < max_records and self.position < limit:
+                if not self._fill(self._needed(), limit):
+                    return False
+        return True
+
+    def _parse(self, max_records, records):
+        """Take records out of the buffer until it runs out, False at an invalid record"""
+        buf = self.buf
+        size = len(buf)
+        offset = self.position - self.buf_lsn
+        while len(records) < max_records:
+            if offset + HEADER.size > size:
+                break
+            length, crc, lsn = HEADER.unpack_from(buf, offset)
+            record_end = offset + HEADER.size + length
+            if length == 0 or length > MAX_RECORD or lsn != self.buf_lsn + offset:
+                self.position = self.buf_lsn + offset
+                return False
+            if record_end > size:
+                break
+            # The CRC covers the LSN field and the payload after it
+            if zlib.crc32(buf[offset + 8 : record_end]) != crc:
+                self.position = self.buf_lsn + offset
+                return False
+            payload = bytes(buf[offset + HEADER.size : record_end])
+            records.append((lsn, payload) if self.with_lsn else payload)
+            offset = record_end
+        self.position = self.buf_lsn + offset
+        return True
+
+    def _needed(self):
+        """Bytes of the next record, or of its header if that is not buffered yet"""
+        offset = self.position - self.buf_lsn
+        if offset + HEADER.size > len(self.buf):
+            return HEADER.size
+        return HEADER.size + HEADER.unpack_from(self.buf, offset)[0]
+
+    def _length(self, limit):
+        if not self._fill(HEADER.size, limit):
+            return 0
+        return HEADER.unpack_from(self.buf, self.position - self.buf_lsn)[0]
+
+    def _fill(self, size, limit):
+        """Make at least size bytes from the position available, False if past limit"""
+        offset = self.position - self.buf_lsn
+        if offset + size <= len(self.buf):
+            return True
+        if self.position + size > limit:
+            return False
+        segment, start = divmod(self.position, self.wal.segment_bytes)
+        if self.fd_segment != segment:
+            self.close()
+            self.fd = os.open(self.wal._segment_file(segment), os.O_RDONLY)
+            self.fd_segment = segment
+        # Never past limit: bytes beyond the end of the log are not written yet
+        chunk = max(min(READ_CHUNK, limit - self.position), size)
+        self.buf = memoryview(os.pread(self.fd, chunk, start))
+        self.buf_lsn = self.position
+        return len(self.buf) >= size